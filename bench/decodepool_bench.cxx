@@ -0,0 +1,151 @@
+#include "kstub.h"
+#include "decodepool.h"
+#include "rawdecoder.h"
+#include "spec.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* decodepool_bench:
+ *   Decodes ExecutionReports from several sessions, each fed by its own
+ *   thread as QuickFIX's session threads are, first inline on the session
+ *   thread and then through a DecodePool. In both cases every session must
+ *   see its messages in MsgSeqNum order with none missing. Reports messages
+ *   decoded per second and the time the session threads spent handing
+ *   messages over, which is what a burst costs their socket reads. Exits 1
+ *   on any message lost or out of order.
+ *
+ *   usage: decodepool_bench [spec] [sessions] [messages per session] [threads]
+ */
+
+static const Spec* spec = nullptr;
+
+static std::string Frame(const std::string& body)
+{
+    std::string msg = "8=FIX.4.2\0019=" + std::to_string(body.size()) + "\001" + body;
+    unsigned sum = 0;
+    for (unsigned char c : msg) sum += c;
+
+    char trailer[16];
+    snprintf(trailer, sizeof(trailer), "10=%03u\001", sum % 256);
+    return msg + trailer;
+}
+
+static std::string Report(long seq)
+{
+    std::string n = std::to_string(seq);
+    return Frame(
+        "35=8\00134=" + n + "\00149=BROKER\00152=20160304-14:21:36.567\00156=AQUAQ\001"
+        "6=101.2525\00111=ORD" + n + "\00114=500\00117=EXEC" + n + "\00120=0\00131=101.25\00132=100\001"
+        "37=BRK" + n + "\00138=1000\00139=1\00140=2\00144=101.5\00154=1\00155=VOD.L\001"
+        "60=20160304-14:21:36.567\001150=1\001151=500\00158=" + std::string(seq % 7 * 40, 'x') + "\001");
+}
+
+static K DecodeReport(DecodeTask& task)
+{
+    return DecodeRaw(task.raw.data(), task.raw.size(), task.spec->types, task.spec->groups, task.filter);
+}
+
+// MsgSeqNum of a decoded message, -1 if it has none
+static J SeqNum(K x)
+{
+    K keys = kK(x)[0];
+    for (J i = 0; i < keys->n; i++) {
+        if (34 != kJ(keys)[i]) continue;
+        K value = kK(kK(x)[1])[i];
+        return -KI == value->t ? value->i : -KJ == value->t ? value->j : -1;
+    }
+    return -1;
+}
+
+// what q would see of one session
+struct Session
+{
+    std::atomic<long> delivered{0};
+    std::atomic<bool> ordered{true};
+
+    void receive(K x)
+    {
+        if (!x || SeqNum(x) != delivered.load(std::memory_order_relaxed) + 1) ordered = false;
+        delivered.store(delivered.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        r0(x);
+    }
+};
+
+static bool Run(const char* name, const std::vector<std::string>& reports, size_t sessions, size_t threads)
+{
+    std::vector<std::unique_ptr<Session>> received;
+    std::vector<std::unique_ptr<ReorderWindow>> windows;
+    for (size_t s = 0; s < sessions; s++) {
+        received.emplace_back(new Session);
+        Session* session = received.back().get();
+        windows.emplace_back(new ReorderWindow([session](K x, Trace&, const std::string&) { session->receive(x); }));
+    }
+    std::unique_ptr<DecodePool> pool(threads ? new DecodePool(threads, DecodeReport) : nullptr);
+
+    std::atomic<long long> handing(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> feeds;
+    for (size_t s = 0; s < sessions; s++) {
+        feeds.emplace_back([&, s] {
+            auto begin = std::chrono::steady_clock::now();
+            for (auto& report : reports) {
+                if (!pool) {
+                    received[s]->receive(DecodeRaw(report.data(), report.size(), spec->types, spec->groups));
+                    continue;
+                }
+                DecodeTask task;
+                task.raw = report;
+                task.window = windows[s].get();
+                task.seq = task.window->issue();
+                task.spec = spec;
+                task.filter = nullptr;
+                task.lazy = false;
+                pool->submit(task);
+            }
+            handing += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+        });
+    }
+    for (auto& feed : feeds) feed.join();
+    pool.reset();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    bool ok = true;
+    for (auto& session : received) {
+        ok = ok && session->ordered && session->delivered == (long) reports.size();
+    }
+
+    long long total = (long long) (reports.size() * sessions);
+    std::cout << name << "\t" << (long long) (total / seconds) << " msgs/s\tsession thread "
+              << handing.load() / total << " ns/msg" << (ok ? "" : "\tLOST OR OUT OF ORDER") << std::endl;
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* path = argc > 1 ? argv[1] : "spec/FIX42.xml";
+    size_t sessions = argc > 2 ? (size_t) atol(argv[2]) : 4;
+    long messages = argc > 3 ? atol(argv[3]) : 100000;
+    size_t threads = argc > 4 ? (size_t) atol(argv[4]) : std::max(std::thread::hardware_concurrency(), 2u);
+
+    Spec loaded;
+    if (!LoadSpec(path, loaded)) {
+        std::cerr << "unable to load " << path << std::endl;
+        return 1;
+    }
+    spec = &loaded;
+
+    std::vector<std::string> reports;
+    for (long seq = 1; seq <= messages; seq++) reports.push_back(Report(seq));
+
+    bool ok = Run("inline", reports, sessions, 0);
+    ok = Run("pool", reports, sessions, threads) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,275 @@
+#include "kstub.h"
+#include "decoder.h"
+#include "spec.h"
+
+#include <pugixml.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/* decoder_bench:
+ *   Compares the original per-field decoding (unordered_map lookup of the
+ *   type name followed by string comparisons) with the dense TagTable on the
+ *   body of a typical ExecutionReport. Reports fields decoded per second, and
+ *   UTCTimestamp values parsed and formatted per second using the original
+ *   sscanf/mktime and gmtime/strftime code against temporal.h, and CompIDs
+ *   interned per second with sn and through the InternCache. Finally the
+ *   time to load the whole spec from the XML and from its compiled cache.
+ *
+ *   usage: decoder_bench [spec] [messages]
+ */
+
+// the original temporal conversions, kept here for comparison
+struct Tm : std::tm {
+    int tm_usecs;
+
+    Tm(const int year, const int month, const int mday, const int hour,
+       const int min, const int sec, const int usecs, const int isDST = -1)
+          : tm_usecs{usecs} {
+        tm_year = year - 1900;
+        tm_mon = month - 1;
+        tm_mday = mday;
+        tm_hour = hour;
+        tm_min = min;
+        tm_sec = sec;
+        tm_isdst = isDST;
+    }
+
+    template <typename Clock_t = std::chrono::high_resolution_clock>
+    auto to_time_point() -> typename Clock_t::time_point {
+        auto time_c = mktime(this);
+        return Clock_t::from_time_t(time_c);
+    }
+};
+
+static K pu(I x){
+    return k(0, (S) "`timestamp$", kz(x/8.64e4 - 10957), (K)0);
+}
+
+static J strtotemporal(const char* datestring){
+
+    int year, month, day, hour, minute, second, ms = 0;
+
+    sscanf(datestring,
+        "%4d%2d%2d-%2d:%2d:%2d.%3d",
+        &year,
+        &month,
+        &day,
+        &hour,
+        &minute,
+        &second,
+        &ms);
+
+    auto tp_micro = Tm(year, month, day, hour, minute, second, ms).to_time_point();
+    K tp = pu(std::chrono::high_resolution_clock::to_time_t(tp_micro)); // ms from Unix epoch
+    J time = tp->j + ms*1e6;
+    r0(tp);
+
+    return time;
+}
+
+static int strtodate(const char* date){
+    int year, month, day;
+    sscanf(date,
+        "%4d%2d%2d",
+        &year,
+        &month,
+        &day);
+    struct std::tm a = {0,0,0,day,month-1,year-1900};
+    struct std::tm b = {0,0,0,1,0,100};
+    std::time_t x = std::mktime(&a);
+    std::time_t y = std::mktime(&b);
+    int difference = std::difftime(x,y) / (60*60*24);
+    return difference;
+}
+
+static int strtotime(const char* time){
+
+    int hour, minute, second;
+    sscanf(time,
+        "%2d:%2d:%2d",
+        &hour,
+        &minute,
+        &second);
+    struct std::tm a = {second,minute,hour,1,0,0};
+    struct std::tm b = {0,0,0,1,0,0};
+    std::time_t x = std::mktime(&a);
+    std::time_t y = std::mktime(&b);
+    int difference = std::difftime(x,y) *1e3;
+    return difference;
+}
+
+static std::string legacyformat(J kdbtime)
+{
+    long unixtime = (kdbtime/8.64e13+10957)*8.64e4;
+    time_t seconds(unixtime);
+    tm *p = gmtime(&seconds);
+
+    char buffer[80];
+    strftime(buffer, 80, "%Y%m%d-%T.000", p);
+
+    std::string timestr = std::to_string(kdbtime);
+    buffer[18] = timestr[9];
+    buffer[19] = timestr[10];
+    buffer[20] = timestr[11];
+    return std::string(buffer);
+}
+
+static std::unordered_map<int, std::string> legacytypes;
+
+static K legacyconvert(std::string field, std::string type)
+{
+    if ("FLOAT" == type) return kf(std::stof(field));
+    else if ("STRING" == type) return kp(const_cast<char *>(field.c_str()));
+    else if ("INT" == type) return ki(std::stoi(field));
+    else if ("CHAR" == type) return kc(field[0u]);
+    else if ("BOOLEAN" == type) return kb("Y" == field ? 1 : 0);
+    else if ("TIMESTAMP" == type) return ktj(-KP, strtotemporal(field.c_str()));
+    else if ("DATE" == type) return kd(strtodate(field.c_str()));
+    else if ("TIME" == type) return kt(strtotime(field.c_str()));
+    else return kp(const_cast<char *>(field.c_str()));
+}
+
+static void legacydecode(const std::vector<std::pair<J, std::string>>& fields, K* keys, K* values)
+{
+    for (auto& field : fields) {
+        J tag = field.first;
+        auto str = field.second.c_str();
+        std::unordered_map<int, std::string>::const_iterator found = legacytypes.find((int) tag);
+        ja(keys, &tag);
+        if (55 == tag) jk(values, ks(const_cast<char *>(str)));
+        else jk(values, legacyconvert(str, found->second));
+    }
+}
+
+static void tabledecode(const TagTable& table, const std::vector<std::pair<J, std::string>>& fields, K* keys, K* values)
+{
+    for (auto& field : fields) {
+        J tag = field.first;
+        ja(keys, &tag);
+        jk(values, table.decode((int) tag, field.second.c_str(), field.second.size()));
+    }
+}
+
+template<typename F>
+static double rate(const char* name, const char* unit, long count, F body)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < count; i++) body(i);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double result = (double) count / seconds;
+
+    std::cout << name << "\t" << (long long) result << " " << unit << std::endl;
+    return result;
+}
+
+template<typename F>
+static double run(const char* name, long messages, size_t width, F decode)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < messages; i++) {
+        K keys = ktn(KJ, 0);
+        K values = ktn(0, 0);
+        decode(&keys, &values);
+        r0(xD(keys, values));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double rate = (double) messages * (double) width / seconds;
+
+    std::cout << name << "\t" << (long long) rate << " fields/s" << std::endl;
+    return rate;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* spec = argc > 1 ? argv[1] : "spec/FIX42.xml";
+    long messages = argc > 2 ? atol(argv[2]) : 200000;
+
+    static const char* names[FIELD_TYPE_COUNT] = {
+        "STRING", "FLOAT", "INT", "CHAR", "BOOLEAN", "TIMESTAMP", "DATE", "TIME", "STRING"
+    };
+
+    pugi::xml_document doc;
+    if (!doc.load_file(spec)) {
+        std::cerr << "unable to load " << spec << std::endl;
+        return 1;
+    }
+
+    TagTable table;
+    pugi::xml_node fields = doc.child("fix").child("fields");
+    for (pugi::xml_node field = fields.child("field"); field; field = field.next_sibling("field")) {
+        int tag = field.attribute("number").as_int();
+        FieldType type = typeconvert(field.attribute("type").value());
+        table.set(tag, type);
+        legacytypes[tag] = names[type];
+    }
+    table.set(55, FIELD_SYMBOL);
+
+    std::vector<std::pair<J, std::string>> report = {
+        {8, "FIX.4.2"}, {9, "245"}, {35, "8"}, {34, "1024"}, {49, "BROKER"}, {56, "AQUAQ"},
+        {52, "20160304-14:21:36.567"}, {6, "101.2525"}, {11, "ORD000123"}, {14, "500"},
+        {17, "EXEC000987"}, {20, "0"}, {31, "101.25"}, {32, "100"}, {37, "BRK0001"},
+        {38, "1000"}, {39, "1"}, {40, "2"}, {44, "101.5"}, {54, "1"}, {55, "VOD.L"},
+        {60, "20160304-14:21:36.567"}, {150, "1"}, {151, "500"}, {10, "128"}
+    };
+
+    std::cout << "messages\t" << messages << "\nfields/message\t" << report.size() << std::endl;
+
+    double before = run("legacy", messages, report.size(), [&](K* keys, K* values) {
+        legacydecode(report, keys, values);
+    });
+    double after = run("tagtable", messages, report.size(), [&](K* keys, K* values) {
+        tabledecode(table, report, keys, values);
+    });
+
+    std::cout << "speedup\t" << after / before << "x" << std::endl;
+
+    const char* timestamp = "20160304-14:21:36.567";
+    size_t length = strlen(timestamp);
+    volatile J sink = 0;
+
+    before = rate("legacy parse", "timestamps/s", messages, [&](long) { sink = sink + strtotemporal(timestamp); });
+    after = rate("temporal parse", "timestamps/s", messages, [&](long) { sink = sink + parsetimestamp(timestamp, length); });
+    std::cout << "speedup\t" << after / before << "x" << std::endl;
+
+    J value = parsetimestamp(timestamp, length);
+    before = rate("legacy format", "timestamps/s", messages, [&](long i) { sink = sink + legacyformat(value + i).size(); });
+    after = rate("temporal format", "timestamps/s", messages, [&](long i) {
+        char buffer[32];
+        sink = sink + formattimestamp(buffer, value + i);
+    });
+    std::cout << "speedup\t" << after / before << "x" << std::endl;
+
+    std::vector<std::string> compids;
+    for (int i = 0; i < 64; i++) compids.push_back("BROKER" + std::to_string(i));
+    before = rate("sn", "symbols/s", messages, [&](long i) {
+        const std::string& id = compids[i & 63];
+        sink = sink + (J) (size_t) sn((S) id.data(), (I) id.size());
+    });
+    after = rate("intern cache", "symbols/s", messages, [&](long i) {
+        const std::string& id = compids[i & 63];
+        sink = sink + (J) (size_t) internsymbol(id.data(), id.size());
+    });
+    std::cout << "speedup\t" << after / before << "x" << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    Spec compiled;
+    CompileSpec(spec, compiled);
+    double xml = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    WriteSpecCache(spec, compiled);
+    start = std::chrono::steady_clock::now();
+    Spec cached;
+    bool loaded = ReadSpecCache(spec, cached);
+    double cache = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "spec xml\t" << xml << " us\nspec cache\t" << (loaded ? cache : 0) << " us" << std::endl;
+
+    return 0;
+}
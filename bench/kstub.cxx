@@ -0,0 +1,281 @@
+#include "kstub.h"
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <map>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
+std::function<K(const char*, K*, int)> kstub_handler;
+
+static std::atomic<long long> allocations(0);
+
+long long kstub_allocations() { return allocations.load(); }
+
+// descriptors registered with sd1, only used from the thread playing q
+static std::map<I, K (*)(I)> callbacks;
+
+int kstub_poll(int timeout)
+{
+    std::vector<pollfd> fds;
+    for (auto& callback : callbacks) fds.push_back({ callback.first, POLLIN, 0 });
+    if (fds.empty() || poll(fds.data(), fds.size(), timeout) <= 0) return 0;
+
+    int called = 0;
+    for (auto& fd : fds) {
+        auto found = callbacks.find(fd.fd);
+        if (!(fd.revents & POLLIN) || found == callbacks.end()) continue;
+
+        K r = found->second(fd.fd);
+        if (r) r0(r);
+        called++;
+    }
+    return called;
+}
+
+static size_t ElementSize(I t)
+{
+    switch (t < 0 ? -t : t) {
+        case KB: case KG: case KC: return 1;
+        case KH: return 2;
+        case KI: case KE: case KM: case KD: case KU: case KV: case KT: return 4;
+        case UU: return 16;
+        default: return 8;
+    }
+}
+
+static bool IsVector(I t) { return t >= 0 && t <= KT; }
+
+// like q, blocks are sized in powers of two so appends are amortised
+static size_t BlockSize(I t, J n)
+{
+    size_t size = offsetof(struct k0, G0) + (IsVector(t) ? (size_t) n * ElementSize(t) : 16) + 1;
+    size_t block = 32;
+    while (block < size) block <<= 1;
+    return block;
+}
+
+static K Allocate(I t, J n)
+{
+    allocations++;
+    K x = (K) calloc(1, BlockSize(t, n));
+    x->t = (signed char) t;
+    if (IsVector(t) || XD == t) x->n = n;
+    return x;
+}
+
+static K Atom(I t) { return Allocate(t, 0); }
+
+static void Append(K* x, const void* value, J count)
+{
+    size_t width = ElementSize((*x)->t);
+    if (BlockSize((*x)->t, (*x)->n + count) > BlockSize((*x)->t, (*x)->n)) {
+        K y = (K) realloc(*x, BlockSize((*x)->t, (*x)->n + count));
+        *x = y;
+    }
+    memcpy(kG(*x) + (size_t) (*x)->n * width, value, (size_t) count * width);
+    (*x)->n += count;
+}
+
+// the kdb+ IPC encoding, little endian and uncompressed, for b9 and d9
+static void Serialise(K* bytes, K x)
+{
+    G type = (G) x->t;
+    Append(bytes, &type, 1);
+    if (x->t < 0) {
+        if (-KS == x->t || -128 == x->t) Append(bytes, x->s, (J) strlen(x->s) + 1);
+        else Append(bytes, -UU == x->t ? (const void*) &x->j : (const void*) &x->g, (J) ElementSize(x->t));
+        return;
+    }
+    if (XT == x->t) {
+        G attr = 0;
+        Append(bytes, &attr, 1);
+        Serialise(bytes, x->k);
+        return;
+    }
+    if (XD == x->t) {
+        Serialise(bytes, kK(x)[0]);
+        Serialise(bytes, kK(x)[1]);
+        return;
+    }
+
+    G attr = 0;
+    I n = (I) x->n;
+    Append(bytes, &attr, 1);
+    Append(bytes, &n, 4);
+    if (0 == x->t) {
+        for (J i = 0; i < x->n; i++) Serialise(bytes, kK(x)[i]);
+    } else if (KS == x->t) {
+        for (J i = 0; i < x->n; i++) Append(bytes, kS(x)[i], (J) strlen(kS(x)[i]) + 1);
+    } else {
+        Append(bytes, kG(x), x->n * (J) ElementSize(x->t));
+    }
+}
+
+static K Deserialise(const G** p, const G* end)
+{
+    if (*p >= end) return krr((S) "badmsg");
+    I t = (signed char) *(*p)++;
+    if (t < 0) {
+        if (-KS == t || -128 == t) {
+            K x = Atom(t);
+            x->s = ss((S) *p);
+            *p += strlen((const char*) *p) + 1;
+            return x;
+        }
+        K x = Atom(t);
+        memcpy(-UU == t ? (void*) &x->j : (void*) &x->g, *p, ElementSize(t));
+        *p += ElementSize(t);
+        return x;
+    }
+    if (XT == t) {
+        (*p)++;
+        return xT(Deserialise(p, end));
+    }
+    if (XD == t) {
+        K keys = Deserialise(p, end);
+        return xD(keys, Deserialise(p, end));
+    }
+
+    I n;
+    (*p)++;
+    memcpy(&n, *p, 4);
+    *p += 4;
+    K x = Allocate(t, 0);
+    for (I i = 0; i < n; i++) {
+        if (0 == t) {
+            jk(&x, Deserialise(p, end));
+        } else if (KS == t) {
+            js(&x, ss((S) *p));
+            *p += strlen((const char*) *p) + 1;
+        } else {
+            Append(&x, *p, 1);
+            *p += ElementSize(t);
+        }
+    }
+    return x;
+}
+
+extern "C" {
+
+K ktn(I t, J n) { return Allocate(t, n); }
+K kpn(S s, J n) { K x = Allocate(KC, n); memcpy(kG(x), s, (size_t) n); return x; }
+K kp(S s) { return kpn(s, (J) strlen(s)); }
+
+S ss(S s)
+{
+    static std::mutex lock;
+    static std::unordered_set<std::string> pool;
+    std::lock_guard<std::mutex> guard(lock);
+    return (S) pool.insert(s).first->c_str();
+}
+
+S sn(S s, I n) { return ss((S) std::string(s, (size_t) n).c_str()); }
+
+K ka(I t) { return Atom(t); }
+K kb(I i) { K x = Atom(-KB); x->g = (G) i; return x; }
+K kg(I i) { K x = Atom(-KG); x->g = (G) i; return x; }
+K kh(I i) { K x = Atom(-KH); x->h = (H) i; return x; }
+K ki(I i) { K x = Atom(-KI); x->i = i; return x; }
+K kj(J j) { K x = Atom(-KJ); x->j = j; return x; }
+K ke(F f) { K x = Atom(-KE); x->e = (E) f; return x; }
+K kf(F f) { K x = Atom(-KF); x->f = f; return x; }
+K kc(I i) { K x = Atom(-KC); x->g = (G) i; return x; }
+K ks(S s) { K x = Atom(-KS); x->s = ss(s); return x; }
+K kd(I i) { K x = Atom(-KD); x->i = i; return x; }
+K kz(F f) { K x = Atom(-KZ); x->f = f; return x; }
+K kt(I i) { K x = Atom(-KT); x->i = i; return x; }
+K ktj(I t, J j) { K x = Atom(t); x->j = j; return x; }
+K ku(U u) { K x = Atom(-UU); memcpy(&x->j, &u, sizeof(J)); return x; }
+
+K ja(K* x, V* v) { Append(x, v, 1); return *x; }
+K js(K* x, S s) { Append(x, &s, 1); return *x; }
+K jk(K* x, K y) { Append(x, &y, 1); return *x; }
+K jv(K* x, K y) { Append(x, kG(y), y->n); return *x; }
+
+K xD(K x, K y) { K d = Allocate(0, 2); d->t = XD; kK(d)[0] = x; kK(d)[1] = y; return d; }
+K xT(K x) { K t = Atom(XT); t->k = x; return t; }
+
+K knk(I n, ...)
+{
+    K x = Allocate(0, n);
+    va_list args;
+    va_start(args, n);
+    for (I i = 0; i < n; i++) kK(x)[i] = va_arg(args, K);
+    va_end(args);
+    return x;
+}
+
+K r1(K x) { x->r++; return x; }
+
+V r0(K x)
+{
+    if (!x) return;
+    if (x->r > 0) { x->r--; return; }
+    if (0 == x->t || XD == x->t) for (J i = 0; i < x->n; i++) r0(kK(x)[i]);
+    if (XT == x->t) r0(x->k);
+    free(x);
+}
+
+K krr(const S s) { K x = Atom(-128); x->s = s; return x; }
+K orr(const S s) { return krr(s); }
+
+K k(I h, const S f, ...)
+{
+    K args[8];
+    int n = 0;
+    va_list list;
+    va_start(list, f);
+    for (K y = va_arg(list, K); y && n < 8; y = va_arg(list, K)) args[n++] = y;
+    va_end(list);
+
+    if (kstub_handler) return kstub_handler(f, args, n);
+
+    // the legacy timestamp conversion is the only expression evaluated in q
+    K r = (K) 0;
+    if (0 == strcmp(f, "`timestamp$") && 1 == n && -KZ == args[0]->t) {
+        r = ktj(-KP, (J) (args[0]->f * 8.64e13));
+    }
+    for (int i = 0; i < n; i++) r0(args[i]);
+    return r;
+}
+
+K sd1(I d, K (*f)(I)) { callbacks[d] = f; return (K) 0; }
+V sd0(I d) { if (callbacks.erase(d)) close(d); }
+K dl(V* f, I n) { return Atom(112); }
+I setm(I m) { return 0; }
+V m9() {}
+I khpu(const S h, I p, const S u) { return -1; }
+I khp(const S h, I p) { return -1; }
+I khpun(const S h, I p, const S u, I t) { return -1; }
+V kclose(I h) {}
+K dot(K x, K y) { return (K) 0; }
+I ymd(I y, I m, I d) { return 0; }
+I dj(I d) { return 0; }
+I okx(K x) { return 1; }
+K ktd(K x) { return x; }
+K b9(I m, K x)
+{
+    K bytes = Allocate(KG, 0);
+    G header[8] = { 1, 0, 0, 0, 0, 0, 0, 0 };
+    Append(&bytes, header, 8);
+    Serialise(&bytes, x);
+    I length = (I) bytes->n;
+    memcpy(kG(bytes) + 4, &length, 4);
+    return bytes;
+}
+
+K d9(K x)
+{
+    const G* p = kG(x) + 8;
+    return Deserialise(&p, kG(x) + x->n);
+}
+
+}
@@ -0,0 +1,24 @@
+#ifndef KDBFIX_KSTUB_H
+#define KDBFIX_KSTUB_H
+
+#include <kx/k.h>
+
+#include <functional>
+
+/* kstub:
+ *   A heap backed implementation of the parts of the kdb+ C API used by the
+ *   library so that benchmarks can run without a q process. Calls made with
+ *   k() are passed to kstub_handler when it is set, otherwise the arguments
+ *   are released and (K) 0 is returned.
+ */
+extern std::function<K(const char*, K*, int)> kstub_handler;
+
+// number of K objects allocated since start up
+long long kstub_allocations();
+
+// stands in for the q event loop: calls the callbacks registered with sd1
+// for the descriptors that become readable within timeout milliseconds and
+// returns how many were called
+int kstub_poll(int timeout);
+
+#endif
@@ -0,0 +1,322 @@
+#include "kstub.h"
+
+#include <quickfix/Session.h>
+#include <quickfix/SessionID.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+/* loopback_bench:
+ *   Runs an acceptor and an initiator in this process, connected over
+ *   127.0.0.1, through the same entry points q calls. The stub kdb+ API plays
+ *   the q main thread: its event loop serves the descriptors the library
+ *   registers with sd1 and .fix.onrecv is answered by the benchmark. The
+ *   initiator sends a mix of NewOrderSingle (D), ExecutionReport (8) and
+ *   MarketDataIncrementalRefresh (X) with .fix.send, at a fixed rate or as
+ *   fast as possible, and the latency of a message is the time from the
+ *   .fix.send call (from when it was due, at a fixed rate) to .fix.onrecv on
+ *   the acceptor. The results are printed as one JSON object.
+ *
+ *   usage: loopback_bench [-n messages] [-w warmup] [-r rate] [-m mix]
+ *                         [-e entries] [-p port] [-d directory] [-s Key=Value]...
+ *
+ *   The mix weights each MsgType, e.g. D:2,8:1 sends two orders for every
+ *   report (default D). X messages carry -e MDEntries (default 5). Each -s
+ *   setting is added to the [DEFAULT] section of both sessions, so stores,
+ *   logs and decoders can be compared. The sessions use TransportType=ring
+ *   since the stub cannot serialise with b9/d9, and BatchMode and LazyDecode
+ *   are not timed. Run it from the build directory so that spec/FIX42.xml is
+ *   found.
+ */
+
+extern "C" {
+K LoadLibrary(K x);
+K CreateAcceptor(K x);
+K CreateInitiator(K x);
+K SendMessageDict(K x);
+K Stop(K x);
+}
+
+// every operator new in the process, including QuickFIX and the session threads
+static std::atomic<long long> heapAllocations(0);
+
+void* operator new(size_t size)
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
+static int64_t Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string Settings(const std::string& directory, const std::vector<std::string>& extra, bool acceptor, int port)
+{
+    std::ostringstream out;
+    out << "[DEFAULT]\n"
+        << "BeginString=FIX.4.2\n"
+        << "StartTime=00:00:00\n"
+        << "EndTime=00:00:00\n"
+        << "HeartBtInt=30\n"
+        << "ReconnectInterval=1\n"
+        << "ResetOnLogon=Y\n"
+        << "SocketNodelay=Y\n"
+        << "FileStorePath=" << directory << "/store\n"
+        << "FileLogPath=" << directory << "/log\n"
+        << "DataDictionary=spec/FIX42.xml\n"
+        << "TransportType=ring\n";
+    for (auto& setting : extra) out << setting << "\n";
+
+    out << "\n[SESSION]\n";
+    if (acceptor) {
+        out << "ConnectionType=acceptor\n"
+            << "SocketAcceptPort=" << port << "\n"
+            << "SocketReuseAddress=Y\n"
+            << "SenderCompID=BROKER\n"
+            << "TargetCompID=AQUAQ\n";
+    } else {
+        out << "ConnectionType=initiator\n"
+            << "SocketConnectHost=127.0.0.1\n"
+            << "SocketConnectPort=" << port << "\n"
+            << "SenderCompID=AQUAQ\n"
+            << "TargetCompID=BROKER\n";
+    }
+
+    return out.str();
+}
+
+static K Sym(const char* s) { return ks((S) s); }
+static K Text(const char* s) { return kp((S) s); }
+
+// a .fix.send dictionary, the value at index 0 is replaced by the message id
+static K Message(const char* msgtype, int idtag, std::vector<std::pair<int, K>> fields)
+{
+    fields.insert(fields.begin(), { idtag, Text("0") });
+    fields.insert(fields.end(), { { 8, Text("FIX.4.2") }, { 35, Text(msgtype) }, { 49, Text("AQUAQ") }, { 56, Text("BROKER") } });
+
+    K keys = ktn(KJ, (J) fields.size());
+    K values = ktn(0, (J) fields.size());
+    for (size_t i = 0; i < fields.size(); i++) {
+        kJ(keys)[i] = fields[i].first;
+        kK(values)[i] = fields[i].second;
+    }
+    return xD(keys, values);
+}
+
+// an MDEntries table of entries price level updates
+static K Entries(int entries)
+{
+    K names = ktn(KS, 5);
+    const char* tags[] = { "279", "269", "55", "270", "271" };
+    for (int c = 0; c < 5; c++) kS(names)[c] = ss((S) tags[c]);
+
+    K action = ktn(0, entries), type = ktn(0, entries), symbol = ktn(KS, entries);
+    K price = ktn(KF, entries), size = ktn(KF, entries);
+    for (int i = 0; i < entries; i++) {
+        kK(action)[i] = Text("1");
+        kK(type)[i] = Text(i % 2 ? "1" : "0");
+        kS(symbol)[i] = ss((S) "VOD.L");
+        kF(price)[i] = 101.25 + (i / 2) * (i % 2 ? 0.25 : -0.25);
+        kF(size)[i] = 100 * (i + 1);
+    }
+
+    return xT(xD(names, knk(5, action, type, symbol, price, size)));
+}
+
+static K Template(char msgtype, int entries)
+{
+    switch (msgtype) {
+    case 'D':
+        return Message("D", 11, { { 21, Text("1") }, { 55, Sym("VOD.L") }, { 54, Text("1") },
+            { 60, Text("20160304-14:21:36.567") }, { 38, kf(1000) }, { 40, Text("2") }, { 44, kf(101.5) } });
+    case '8':
+        return Message("8", 11, { { 37, Text("BRK1") }, { 17, Text("EXEC1") }, { 20, Text("0") },
+            { 150, Text("1") }, { 39, Text("1") }, { 55, Sym("VOD.L") }, { 54, Text("1") }, { 38, kf(1000) },
+            { 32, kf(100) }, { 31, kf(101.25) }, { 151, kf(500) }, { 14, kf(500) }, { 6, kf(101.2525) } });
+    case 'X':
+        return Message("X", 262, { { 268, Entries(entries) } });
+    }
+    return (K) 0;
+}
+
+// the message id carried in ClOrdID or MDReqID, -1 if there is none
+static long MessageId(K msg)
+{
+    if (XD != msg->t || KJ != kK(msg)[0]->t) return -1;
+
+    K keys = kK(msg)[0];
+    K values = kK(msg)[1];
+    for (J i = 0; i < keys->n; i++) {
+        J tag = kJ(keys)[i];
+        if ((11 == tag || 262 == tag) && KC == kK(values)[i]->t) {
+            return atol(std::string((char*) kC(kK(values)[i]), (size_t) kK(values)[i]->n).c_str());
+        }
+    }
+    return -1;
+}
+
+static bool LoggedOn(const FIX::SessionID& id)
+{
+    FIX::Session* session = FIX::Session::lookupSession(id);
+    return session && session->isLoggedOn();
+}
+
+static long long Percentile(const std::vector<int64_t>& sorted, double q)
+{
+    if (sorted.empty()) return 0;
+    size_t rank = (size_t) (q * sorted.size());
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+int main(int argc, char* argv[])
+{
+    long count = 100000, warmup = 1000;
+    double rate = 0;
+    int entries = 5, port = 7191;
+    std::string mix = "D", directory = "loopback_bench";
+    std::vector<std::string> extra;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        if ("-n" == option) count = atol(argv[i + 1]);
+        else if ("-w" == option) warmup = atol(argv[i + 1]);
+        else if ("-r" == option) rate = atof(argv[i + 1]);
+        else if ("-m" == option) mix = argv[i + 1];
+        else if ("-e" == option) entries = atoi(argv[i + 1]);
+        else if ("-p" == option) port = atoi(argv[i + 1]);
+        else if ("-d" == option) directory = argv[i + 1];
+        else if ("-s" == option) extra.push_back(argv[i + 1]);
+        else {
+            std::cerr << "unknown option " << option << std::endl;
+            return 2;
+        }
+    }
+
+    // the send order for one cycle of the mix
+    std::vector<char> cycle;
+    std::istringstream weights(mix);
+    for (std::string item; std::getline(weights, item, ',');) {
+        int weight = item.size() > 2 && ':' == item[1] ? atoi(item.c_str() + 2) : 1;
+        if (std::string("D8X").find(item[0]) == std::string::npos || weight < 1) {
+            std::cerr << "bad mix " << mix << std::endl;
+            return 2;
+        }
+        cycle.insert(cycle.end(), (size_t) weight, item[0]);
+    }
+
+    std::vector<K> templates;
+    for (char msgtype : cycle) templates.push_back(Template(msgtype, entries));
+
+    mkdir(directory.c_str(), 0755);
+    std::ofstream(directory + "/acceptor.ini") << Settings(directory, extra, true, port);
+    std::ofstream(directory + "/initiator.ini") << Settings(directory, extra, false, port);
+
+    long total = warmup + count;
+    std::vector<int64_t> sent((size_t) total, 0), latency;
+    latency.reserve((size_t) count);
+    long received = 0;
+
+    kstub_handler = [&](const char* f, K* args, int n) -> K {
+        if (0 == strcmp(f, ".fix.onrecv") && 2 == n) {
+            int64_t now = Now();
+            long id = MessageId(args[1]);
+            if (id >= 0 && id < total) {
+                received++;
+                if (id >= warmup) latency.push_back(now - sent[(size_t) id]);
+            }
+        }
+        for (int i = 0; i < n; i++) r0(args[i]);
+        return (K) 0;
+    };
+
+    r0(LoadLibrary((K) 0));
+    K acceptorPath = ks((S) (directory + "/acceptor.ini").c_str());
+    K initiatorPath = ks((S) (directory + "/initiator.ini").c_str());
+    K acceptor = CreateAcceptor(acceptorPath);
+    K initiator = CreateInitiator(initiatorPath);
+    r0(acceptorPath);
+    r0(initiatorPath);
+    if (-KJ != acceptor->t || -KJ != initiator->t) {
+        std::cerr << "unable to create the sessions" << std::endl;
+        return 1;
+    }
+
+    FIX::SessionID initiatorID("FIX.4.2", "AQUAQ", "BROKER");
+    FIX::SessionID acceptorID("FIX.4.2", "BROKER", "AQUAQ");
+    int64_t deadline = Now() + 10 * 1000000000LL;
+    while (!(LoggedOn(initiatorID) && LoggedOn(acceptorID)) && Now() < deadline) kstub_poll(10);
+    if (!LoggedOn(initiatorID)) {
+        std::cerr << "sessions did not log on" << std::endl;
+        return 1;
+    }
+
+    int64_t period = rate > 0 ? (int64_t) (1e9 / rate) : 0;
+    int64_t start = 0, finish = 0;
+    long long heap = 0, objects = 0;
+
+    for (long i = 0; i < total; i++) {
+        if (i == warmup) {
+            // let the warmup drain so it is not counted
+            deadline = Now() + 10 * 1000000000LL;
+            while (received < warmup && Now() < deadline) kstub_poll(1);
+            start = Now();
+            heap = heapAllocations.load();
+            objects = kstub_allocations();
+        }
+
+        int64_t due = period && i >= warmup ? start + (i - warmup) * period : 0;
+        while (due && Now() < due) kstub_poll(0);
+
+        K msg = templates[(size_t) i % templates.size()];
+        K& id = kK(kK(msg)[1])[0];
+        r0(id);
+        id = kp((S) std::to_string(i).c_str());
+
+        sent[(size_t) i] = due ? due : Now();
+        r0(SendMessageDict(msg));
+        kstub_poll(0);
+    }
+
+    deadline = Now() + 10 * 1000000000LL;
+    while (received < total && Now() < deadline) kstub_poll(1);
+    finish = Now();
+    heap = heapAllocations.load() - heap;
+    objects = kstub_allocations() - objects;
+
+    r0(Stop(initiator));
+    r0(Stop(acceptor));
+    for (K msg : templates) r0(msg);
+
+    std::sort(latency.begin(), latency.end());
+    double mean = 0;
+    for (int64_t v : latency) mean += v;
+    double seconds = (finish - start) / 1e9;
+    double measured = (double) std::max<long>(count, 1);
+
+    printf("{\"mix\":\"%s\",\"entries\":%d,\"rate\":%.0f,\"messages\":%ld,\"received\":%ld,"
+           "\"seconds\":%.6f,\"msgsPerSec\":%.0f,\"meanNs\":%.0f,\"p50Ns\":%lld,\"p99Ns\":%lld,"
+           "\"p999Ns\":%lld,\"maxNs\":%lld,\"heapAllocsPerMsg\":%.2f,\"kAllocsPerMsg\":%.2f}\n",
+           mix.c_str(), entries, rate, count, received - std::min(received, warmup),
+           seconds, seconds > 0 ? latency.size() / seconds : 0.0, latency.empty() ? 0.0 : mean / latency.size(),
+           Percentile(latency, 0.5), Percentile(latency, 0.99), Percentile(latency, 0.999),
+           latency.empty() ? 0LL : (long long) latency.back(), heap / measured, objects / measured);
+
+    return received == total ? 0 : 1;
+}
@@ -0,0 +1,178 @@
+#include "kstub.h"
+#include "numeric.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/* numeric_bench:
+ *   Checks and times numeric.h against the C library. Every value is parsed
+ *   with parsedecimal and strtod and the doubles must be bit for bit equal;
+ *   formatdecimal must print what %.15g (or %.7g for reals) prints, when
+ *   that has no exponent, and read back as the same double; parsefixed
+ *   must match the decimal scaled by hand. The values are random prices
+ *   and quantities plus edge cases (long mantissas, many places, leading
+ *   zeros, malformed text). Then reports values parsed per second with
+ *   strtof, strtod and parsedecimal and formatted per second with snprintf
+ *   and formatdecimal. Exits 1 on any mismatch.
+ *
+ *   usage: numeric_bench [values]
+ */
+
+static long failures = 0;
+
+static void fail(const std::string& what, const std::string& text)
+{
+    if (++failures <= 20) std::cerr << what << "\t" << text << std::endl;
+}
+
+static bool same(double a, double b)
+{
+    return 0 == memcmp(&a, &b, sizeof a);
+}
+
+// str * 10^scale rounded half away from zero, done on the digits as text
+static J fixedbyhand(const std::string& str, int scale)
+{
+    bool negative = !str.empty() && '-' == str[0];
+    std::string digits = str.substr(negative || (!str.empty() && '+' == str[0]) ? 1 : 0);
+    size_t point = digits.find('.');
+    std::string whole = std::string::npos == point ? digits : digits.substr(0, point);
+    std::string places = std::string::npos == point ? "" : digits.substr(point + 1);
+    places.resize(std::max(places.size(), (size_t) scale + 1), '0');
+
+    J v = std::stoll("0" + whole + places.substr(0, (size_t) scale));
+    if (places[(size_t) scale] >= '5') v++;
+    return negative ? -v : v;
+}
+
+static void check(const std::string& text)
+{
+    double expected = strtod(text.c_str(), NULL);
+    double parsed = parsedecimal(text.data(), text.size());
+    if (!same(expected, parsed)) fail("parsedecimal", text);
+
+    char buffer[32], reference[32];
+    size_t len = formatdecimal(buffer, expected, 15);
+    int n = snprintf(reference, sizeof reference, "%.15g", expected);
+    std::string printed(buffer, len);
+    bool exponent = nullptr != strchr(reference, 'e');
+    if (!exponent && 0 != expected && printed != std::string(reference, (size_t) n)) fail("formatdecimal", text + " " + printed + " " + reference);
+    if (nullptr != strchr(printed.c_str(), 'e') && std::fabs(expected) >= 1e-7 && std::fabs(expected) < 1e15) fail("exponent", text + " " + printed);
+
+    // reals are sent with 7 significant digits
+    float real = (float) expected;
+    len = formatdecimal(buffer, real, 7);
+    n = snprintf(reference, sizeof reference, "%.7g", real);
+    if (!strchr(reference, 'e') && 0 != real && std::string(buffer, len) != std::string(reference, (size_t) n)) {
+        fail("formatdecimal real", text + " " + std::string(buffer, len) + " " + reference);
+    }
+
+    // 15 significant digits read back exactly when the input had no more
+    DecimalDigits d;
+    scandecimal(text.data(), text.size(), &d);
+    if (d.mantissa < 1000000000000000ULL && !d.truncated && strtod(printed.c_str(), NULL) != expected) {
+        fail("round trip", text + " " + printed);
+    }
+
+    if (text.size() < 16) {
+        for (int scale : { 0, 2, 4, 8 }) {
+            if (parsefixed(text.data(), text.size(), scale) != fixedbyhand(text, scale)) {
+                fail("parsefixed " + std::to_string(scale), text);
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    long values = argc > 1 ? atol(argv[1]) : 1000000;
+
+    std::mt19937_64 random(42);
+    std::vector<std::string> texts;
+    for (long i = 0; i < values; i++) {
+        int places = (int) (random() % 9);
+        uint64_t digits = random() % 10000000000ULL;
+        std::string text = std::to_string(digits);
+        if (places) {
+            if (text.size() <= (size_t) places) text.insert(0, (size_t) places + 1 - text.size(), '0');
+            text.insert(text.size() - (size_t) places, ".");
+        }
+        if (0 == random() % 4) text.insert(0, "-");
+        texts.push_back(text);
+    }
+
+    const char* edges[] = {
+        "0", "-0", "0.0", "1", "+1", ".5", "5.", "0.1", "0.3", "101.25", "101.2525", "1.005", "2.675",
+        "9007199254740992", "9007199254740993", "123456789012345678901234567890", "0.000000000000000000000001",
+        "1.7976931348623157", "4.9406564584124654", "0.00001", "0.0001234", "12345678.123456789",
+        "99999999999999.99", "1000000000000000", "0.30000000000000004", "000123.4500", "3.14159265358979323846",
+        "1234567890123456789", "12345678901234567890", "-922337203685.4775807",
+    };
+    for (const char* edge : edges) check(edge);
+    for (auto& text : texts) check(text);
+
+    // doubles that did not come from short decimals, formatted both ways
+    std::uniform_real_distribution<double> exponents(-7, 15);
+    for (long i = 0; i < values / 4; i++) {
+        double x = std::pow(10.0, exponents(random));
+        char buffer[32], reference[32];
+        size_t len = formatdecimal(buffer, x, 15);
+        int n = snprintf(reference, sizeof reference, "%.15g", x);
+        if (!strchr(reference, 'e') && std::string(buffer, len) != std::string(reference, (size_t) n)) {
+            fail("formatdecimal", std::string(buffer, len) + " " + reference);
+        }
+    }
+
+    const char* malformed[] = { "", "-", ".", "1.2.3", "1e5", "12a", " 1", "--1", "0x10" };
+    for (const char* text : malformed) {
+        size_t len = strlen(text);
+        if (!std::isnan(parsedecimal(text, len))) fail("malformed decimal", text);
+        if (nj != parsefixed(text, len, 4)) fail("malformed fixed", text);
+        if (ni != parseint(text, len)) fail("malformed int", text);
+    }
+    if (nj != parsefixed("92233720368547758.08", 20, 2)) fail("fixed overflow", "92233720368547758.08");
+    if (ni != parseint("2147483648", 10)) fail("int overflow", "2147483648");
+    if (-2147483647 != parseint("-2147483647", 11)) fail("int", "-2147483647");
+
+    std::cout << "values\t" << texts.size() << "\nmismatches\t" << failures << std::endl;
+
+    volatile double sink = 0;
+    auto time = [&](const char* name, const char* unit, std::function<void(const std::string&)> body) {
+        auto start = std::chrono::steady_clock::now();
+        for (auto& text : texts) body(text);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double rate = (double) texts.size() / seconds;
+        std::cout << name << "\t" << (long long) rate << " " << unit << std::endl;
+        return rate;
+    };
+
+    time("strtof", "values/s", [&](const std::string& text) { sink = sink + strtof(text.c_str(), NULL); });
+    double before = time("strtod", "values/s", [&](const std::string& text) { sink = sink + strtod(text.c_str(), NULL); });
+    double after = time("parsedecimal", "values/s", [&](const std::string& text) { sink = sink + parsedecimal(text.data(), text.size()); });
+    std::cout << "speedup\t" << after / before << "x" << std::endl;
+    time("parsefixed", "values/s", [&](const std::string& text) { sink = sink + (double) parsefixed(text.data(), text.size(), 4); });
+
+    std::vector<double> numbers;
+    for (auto& text : texts) numbers.push_back(parsedecimal(text.data(), text.size()));
+    size_t i = 0;
+    before = time("snprintf", "values/s", [&](const std::string&) {
+        char buffer[32];
+        sink = sink + snprintf(buffer, sizeof buffer, "%.15g", numbers[i++ % numbers.size()]);
+    });
+    after = time("formatdecimal", "values/s", [&](const std::string&) {
+        char buffer[32];
+        sink = sink + (double) formatdecimal(buffer, numbers[i++ % numbers.size()], 15);
+    });
+    std::cout << "speedup\t" << after / before << "x" << std::endl;
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+#include "kstub.h"
+#include "channel.h"
+#include "stats.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+/* poll_bench:
+ *   Times a ring channel from push on a producer thread to the start of the
+ *   consumer's callback, as the wakeup stage of .fix.stats does, in the two
+ *   delivery modes: the consumer sleeping in poll() on the descriptor and
+ *   draining when woken, as the q event loop does for sd1, and the consumer
+ *   spinning on a polled channel, as a process calling .fix.poll does. The
+ *   producer sends a message every gap microseconds so that the consumer
+ *   goes idle between them. Each thread can be pinned to a core. Exits 1 if
+ *   a message is lost or out of order.
+ *
+ *   usage: poll_bench [messages] [gap] [producer cpu] [consumer cpu]
+ */
+
+static void Pin(int cpu)
+{
+#ifdef __linux__
+    if (cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (0 != pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) std::cerr << "unable to pin to " << cpu << std::endl;
+#endif
+}
+
+static bool Run(const char* name, bool polled, long messages, int gap, int producerCpu, int consumerCpu)
+{
+    Channel channel(65536, nullptr, polled);
+    Histogram wakeup;
+    bool ok = true;
+
+    std::thread producer([&] {
+        Pin(producerCpu);
+        for (long i = 0; i < messages; i++) {
+            auto next = std::chrono::steady_clock::now() + std::chrono::microseconds(gap);
+            Trace trace;
+            trace.enqueued = monotonicnanos();
+            channel.push(kj(i), trace);
+            while (std::chrono::steady_clock::now() < next) std::this_thread::yield();
+        }
+    });
+
+    // with one core between them the spinning consumer has to let the
+    // producer run
+    Pin(consumerCpu);
+    bool shared = std::thread::hardware_concurrency() < 2 || (producerCpu >= 0 && producerCpu == consumerCpu);
+    long expected = 0;
+    auto deliver = [&](K x, Trace& trace, int64_t woke) {
+        wakeup.record(woke - trace.enqueued);
+        if (x->j != expected++) ok = false;
+        r0(x);
+    };
+
+    while (expected < messages) {
+        if (polled) {
+            int64_t woke = monotonicnanos();
+            size_t n = channel.poll([&](K x, Trace& trace) { deliver(x, trace, woke); }, 256);
+            if (!n && shared) std::this_thread::yield();
+        } else {
+            pollfd fd = { channel.fd(), POLLIN, 0 };
+            if (poll(&fd, 1, 1000) <= 0) break;
+            int64_t woke = monotonicnanos();
+            channel.drain([&](K x, Trace& trace) { deliver(x, trace, woke); }, 256);
+        }
+    }
+    producer.join();
+
+    static const double quantiles[] = { 0.5, 0.99, 0.999 };
+    uint64_t values[3];
+    wakeup.percentiles(quantiles, values, 3);
+    std::cout << name << "\tmean " << wakeup.mean() << " ns\tp50 " << values[0] << " ns\tp99 " << values[1]
+              << " ns\tp999 " << values[2] << " ns\tmax " << wakeup.max() << " ns" << std::endl;
+
+    if (!polled) close(channel.fd());
+    return ok && expected == messages;
+}
+
+int main(int argc, char* argv[])
+{
+    long messages = argc > 1 ? atol(argv[1]) : 200000;
+    int gap = argc > 2 ? atoi(argv[2]) : 5;
+    int producerCpu = argc > 3 ? atoi(argv[3]) : -1;
+    int consumerCpu = argc > 4 ? atoi(argv[4]) : -1;
+
+    bool ok = Run("wakeup", false, messages, gap, producerCpu, consumerCpu);
+    ok = Run("busypoll", true, messages, gap, producerCpu, consumerCpu) && ok;
+
+    if (!ok) std::cerr << "messages lost or out of order" << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,372 @@
+#include "kstub.h"
+#include "spec.h"
+#include "tickerplant.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* publish_bench:
+ *   Publishes ExecutionReport rows through a TickerplantPublisher to a stub
+ *   tickerplant in the same process, which accepts kdb+ IPC logins and
+ *   decodes each message with d9. Every .u.upd call must name the table,
+ *   carry typed columns of equal length and, over all calls, the rows in
+ *   the order they were pushed. Reports rows published per second and the
+ *   cost of a push on the session thread. Then stops the tickerplant while
+ *   rows are pushed, alternating between two sessions that type Price
+ *   differently, and starts it again, which must lose nothing and keep
+ *   Price a float column, and
+ *   repeats that with a buffer too small to hold the rows, which must drop
+ *   the oldest and account for every row. Exits 1 on any mismatch.
+ *
+ *   usage: publish_bench [spec] [rows]
+ */
+
+static long failures = 0;
+
+static void fail(const std::string& what)
+{
+    if (++failures <= 20) std::cerr << what << std::endl;
+}
+
+// accepts connections on port and checks the .u.upd calls they carry
+class StubTickerplant
+{
+    public:
+    StubTickerplant() : listener(-1), port(0), rows(0), calls(0) {}
+
+    ~StubTickerplant() { stop(); }
+
+    bool start(int at)
+    {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons((uint16_t) at);
+        socklen_t size = sizeof address;
+        if (0 != bind(listener, (sockaddr*) &address, size) || 0 != listen(listener, 4) ||
+            0 != getsockname(listener, (sockaddr*) &address, &size)) {
+            return false;
+        }
+        port = ntohs(address.sin_port);
+
+        acceptor = std::thread([this] {
+            for (int fd; -1 != (fd = accept(listener, nullptr, nullptr)); ) {
+                std::lock_guard<std::mutex> guard(lock);
+                connections.push_back(fd);
+                readers.emplace_back([this, fd] { serve(fd); });
+            }
+        });
+        return true;
+    }
+
+    void stop()
+    {
+        if (-1 == listener) return;
+        shutdown(listener, SHUT_RDWR);
+        close(listener);
+        acceptor.join();
+        listener = -1;
+
+        for (int fd : connections) shutdown(fd, SHUT_RDWR);
+        for (auto& reader : readers) reader.join();
+        for (int fd : connections) close(fd);
+        connections.clear();
+        readers.clear();
+    }
+
+    // rows with a quantity of their sequence number, in order received
+    std::vector<J> sequence()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return received;
+    }
+
+    int listener;
+    int port;
+    std::atomic<long> rows;
+    std::atomic<long> calls;
+
+    private:
+    static bool read(int fd, void* buffer, size_t size)
+    {
+        for (size_t got = 0; got < size; ) {
+            ssize_t n = recv(fd, (char*) buffer + got, size - got, 0);
+            if (n <= 0) return false;
+            got += (size_t) n;
+        }
+        return true;
+    }
+
+    void serve(int fd)
+    {
+        char c;
+        do {
+            if (!read(fd, &c, 1)) return;
+        } while (c);
+        char capability = 3;
+        if (1 != send(fd, &capability, 1, MSG_NOSIGNAL)) return;
+
+        for (;;) {
+            G header[8];
+            if (!read(fd, header, 8)) return;
+            I length;
+            memcpy(&length, header + 4, 4);
+
+            K bytes = ktn(KG, length);
+            memcpy(kG(bytes), header, 8);
+            if (!read(fd, kG(bytes) + 8, (size_t) length - 8)) {
+                r0(bytes);
+                return;
+            }
+            K call = d9(bytes);
+            r0(bytes);
+            check(call);
+            r0(call);
+        }
+    }
+
+    void check(K call)
+    {
+        calls++;
+        if (0 != call->t || 3 != call->n || KC != kK(call)[0]->t || -KS != kK(call)[1]->t || 0 != kK(call)[2]->t) {
+            fail("call shape");
+            return;
+        }
+        if (std::string((S) kC(kK(call)[0]), (size_t) kK(call)[0]->n) != ".u.upd") fail("function");
+        if (std::string(kK(call)[1]->s) != "ExecutionReport") fail("table");
+
+        K columns = kK(call)[2];
+        const I types[] = { KS, KC, KF, KF, KP, 0 };
+        if (6 != columns->n) {
+            fail("columns");
+            return;
+        }
+        J n = kK(columns)[0]->n;
+        for (int c = 0; c < 6; c++) {
+            if (kK(columns)[c]->t != types[c] || kK(columns)[c]->n != n) {
+                fail("column " + std::to_string(c));
+                return;
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        for (J i = 0; i < n; i++) {
+            J seq = (J) kF(kK(columns)[2])[i];
+            std::string symbol = "SYM" + std::to_string(seq % 100);
+            if (symbol != kS(kK(columns)[0])[i]) fail("symbol " + std::to_string(seq));
+            if ((seq % 2 ? '1' : '2') != kC(kK(columns)[1])[i]) fail("side " + std::to_string(seq));
+            if ((0 == seq % 3) == std::isnan(kF(kK(columns)[3])[i])) fail("price " + std::to_string(seq));
+            received.push_back(seq);
+        }
+        rows += (long) n;
+    }
+
+    std::thread acceptor;
+    std::vector<std::thread> readers;
+    std::vector<int> connections;
+    std::mutex lock;
+    std::vector<J> received;
+};
+
+// the body of one row, the price only on every third
+struct Row
+{
+    std::string symbol, side, qty, price, time, text;
+
+    explicit Row(long seq)
+        : symbol("SYM" + std::to_string(seq % 100)), side(seq % 2 ? "1" : "2"), qty(std::to_string(seq)),
+          price(std::to_string(100 + seq % 50) + ".25"), time("20240102-10:11:12.123"), text("fill " + qty) {}
+
+    void fields(std::vector<PublishField>& out, long seq) const
+    {
+        out.clear();
+        out.push_back({ symbol.data(), (int32_t) symbol.size() });
+        out.push_back({ side.data(), (int32_t) side.size() });
+        out.push_back({ qty.data(), (int32_t) qty.size() });
+        if (seq % 3) out.push_back({ nullptr, -1 });
+        else out.push_back({ price.data(), (int32_t) price.size() });
+        out.push_back({ time.data(), (int32_t) time.size() });
+        out.push_back({ text.data(), (int32_t) text.size() });
+    }
+};
+
+static bool waitfor(std::function<bool()> done, int seconds)
+{
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    while (!done()) {
+        if (std::chrono::steady_clock::now() > until) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+static void expect(StubTickerplant& tickerplant, long from, long to)
+{
+    std::vector<J> seqs = tickerplant.sequence();
+    if ((long) seqs.size() != to - from) {
+        fail("rows " + std::to_string(seqs.size()) + " expected " + std::to_string(to - from));
+        return;
+    }
+    for (long i = from; i < to; i++) {
+        if (seqs[(size_t) (i - from)] != i) {
+            fail("order at " + std::to_string(i));
+            return;
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const char* path = argc > 1 ? argv[1] : "spec/FIX42.xml";
+    long rows = argc > 2 ? atol(argv[2]) : 1000000;
+
+    Spec spec;
+    if (!LoadSpec(path, spec)) {
+        std::cerr << "unable to load " << path << std::endl;
+        return 1;
+    }
+    SpecOptions options;
+    options.symbols.insert(55);
+    ApplySpecOptions(spec, options);
+
+    // a second session with Price as a fixed point long, whose rows must
+    // still arrive with Price as a float
+    Spec fixed = spec;
+    SpecOptions scaled;
+    scaled.scales[44] = 2;
+    ApplySpecOptions(fixed, scaled);
+
+    PublishEntry entry;
+    entry.table = "ExecutionReport";
+    entry.tags = { 55, 54, 38, 44, 60, 58 };
+
+    std::vector<Row> bodies;
+    for (long seq = 0; seq < 1000; seq++) bodies.emplace_back(seq);
+    std::vector<PublishField> fields;
+
+    TickerplantPublisher::Settings settings;
+    settings.host = "127.0.0.1";
+    settings.reconnect = 50;
+
+    // throughput, every row delivered in order
+    {
+        StubTickerplant tickerplant;
+        if (!tickerplant.start(0)) return 1;
+        settings.port = tickerplant.port;
+        TickerplantPublisher publisher(settings);
+
+        auto start = std::chrono::steady_clock::now();
+        for (long seq = 0; seq < rows; seq++) {
+            Row& row = bodies[(size_t) (seq % 1000)];
+            row.qty = std::to_string(seq);
+            row.fields(fields, seq);
+            publisher.push(&entry, &spec, fields);
+        }
+        double pushed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!waitfor([&] { return tickerplant.rows.load() >= rows; }, 60)) fail("timed out");
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        expect(tickerplant, 0, rows);
+        std::cout << "rows\t" << tickerplant.rows.load() << "\ncalls\t" << tickerplant.calls.load()
+                  << "\npush\t" << (long long) (pushed * 1e9 / (double) rows) << " ns/row"
+                  << "\npublished\t" << (long long) ((double) rows / seconds) << " rows/s" << std::endl;
+        if (publisher.published.load() != (uint64_t) rows || publisher.dropped.load()) fail("publisher counters");
+    }
+
+    // the tickerplant restarts while rows from both sessions are pushed,
+    // nothing is lost
+    {
+        StubTickerplant tickerplant;
+        if (!tickerplant.start(0)) return 1;
+        int port = tickerplant.port;
+        settings.port = port;
+        TickerplantPublisher publisher(settings);
+
+        long half = 50000;
+        for (long seq = 0; seq < half; seq++) {
+            bodies[0].qty = std::to_string(seq);
+            bodies[0].symbol = "SYM" + std::to_string(seq % 100);
+            bodies[0].side = seq % 2 ? "1" : "2";
+            bodies[0].fields(fields, seq);
+            publisher.push(&entry, seq % 2 ? &fixed : &spec, fields);
+        }
+        if (!waitfor([&] { return tickerplant.rows.load() >= half; }, 60)) fail("timed out before restart");
+        tickerplant.stop();
+        waitfor([&] { return !publisher.connected.load(); }, 5);
+
+        for (long seq = half; seq < 2 * half; seq++) {
+            bodies[0].qty = std::to_string(seq);
+            bodies[0].symbol = "SYM" + std::to_string(seq % 100);
+            bodies[0].side = seq % 2 ? "1" : "2";
+            bodies[0].fields(fields, seq);
+            publisher.push(&entry, seq % 2 ? &fixed : &spec, fields);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+        StubTickerplant restarted;
+        if (!restarted.start(port)) return 1;
+        if (!waitfor([&] { return restarted.rows.load() >= half; }, 60)) fail("timed out after restart");
+        expect(restarted, half, 2 * half);
+        std::cout << "reconnect\t" << publisher.connects.load() << " connects, "
+                  << publisher.dropped.load() << " dropped" << std::endl;
+        if (publisher.connects.load() < 2 || publisher.dropped.load()) fail("reconnect counters");
+    }
+
+    // a buffer too small for the outage drops the oldest rows
+    {
+        StubTickerplant tickerplant;
+        if (!tickerplant.start(0)) return 1;
+        int port = tickerplant.port;
+        tickerplant.stop();
+
+        settings.port = port;
+        settings.capacity = 1 << 16;
+        TickerplantPublisher publisher(settings);
+
+        long total = 100000;
+        for (long seq = 0; seq < total; seq++) {
+            bodies[0].qty = std::to_string(seq);
+            bodies[0].symbol = "SYM" + std::to_string(seq % 100);
+            bodies[0].side = seq % 2 ? "1" : "2";
+            bodies[0].fields(fields, seq);
+            publisher.push(&entry, &spec, fields);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        StubTickerplant restarted;
+        if (!restarted.start(port)) return 1;
+        waitfor([&] { return 0 == publisher.buffered.load() && restarted.rows.load() > 0; }, 60);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        long received = restarted.rows.load();
+        long dropped = (long) publisher.dropped.load();
+        std::vector<J> seqs = restarted.sequence();
+        for (size_t i = 1; i < seqs.size(); i++) {
+            if (seqs[i] <= seqs[i - 1]) fail("order after drop");
+        }
+        std::cout << "overflow\t" << received << " received, " << dropped << " dropped" << std::endl;
+        if (!dropped || received + dropped != total) fail("overflow counters");
+    }
+
+    std::cout << "mismatches\t" << failures << std::endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,148 @@
+#include "kstub.h"
+#include "decoder.h"
+#include "message.h"
+#include "rawdecoder.h"
+#include "lazymessage.h"
+
+#include <quickfix/DataDictionary.h>
+#include <quickfix/Message.h>
+
+#include <pugixml.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* raw_bench:
+ *   Decodes captured ExecutionReports with the existing path (QuickFIX parse
+ *   then ConvertToDictionary) and with DecodeRaw on the wire bytes. QuickFIX
+ *   still parses every message for session handling when RawDecode=Y, so the
+ *   parse is reported on its own as well as the two decoders. The lazy case
+ *   indexes the message and decodes the eight tags a typical handler reads.
+ *
+ *   usage: raw_bench [spec] [capture] [iterations]
+ *
+ *   The capture is a FileLogPath messages file (or one raw message per line);
+ *   without one a set of ExecutionReports is generated.
+ */
+
+static std::string Frame(const std::string& beginString, const std::string& body)
+{
+    std::string msg = "8=" + beginString + "\0019=" + std::to_string(body.size()) + "\001" + body;
+    unsigned sum = 0;
+    for (unsigned char c : msg) sum += c;
+
+    char trailer[16];
+    snprintf(trailer, sizeof(trailer), "10=%03u\001", sum % 256);
+    return msg + trailer;
+}
+
+static std::vector<std::string> Generate(size_t count)
+{
+    std::vector<std::string> msgs;
+    for (size_t i = 0; i < count; i++) {
+        std::string n = std::to_string(i + 1);
+        std::string body =
+            "35=8\00134=" + n + "\00149=BROKER\00152=20160304-14:21:36.567\00156=AQUAQ\001"
+            "6=101.2525\00111=ORD" + n + "\00114=500\00117=EXEC" + n + "\00120=0\00131=101.25\00132=100\001"
+            "37=BRK" + n + "\00138=1000\00139=1\00140=2\00144=101.5\00154=1\00155=VOD.L\001"
+            "60=20160304-14:21:36.567\001150=1\001151=500\001";
+        msgs.push_back(Frame("FIX.4.2", body));
+    }
+    return msgs;
+}
+
+static std::vector<std::string> Load(const char* path)
+{
+    std::vector<std::string> msgs;
+    std::ifstream file(path);
+    std::string line;
+
+    while (std::getline(file, line)) {
+        size_t start = line.find("8=FIX");
+        if (start == std::string::npos || line.find("\00135=8\001") == std::string::npos) continue;
+        msgs.push_back(line.substr(start));
+    }
+    return msgs;
+}
+
+template<typename F>
+static double run(const char* name, const std::vector<std::string>& msgs, long iterations, F body)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        for (auto& msg : msgs) body(msg);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double rate = (double) msgs.size() * (double) iterations / seconds;
+
+    std::cout << name << "\t" << (long long) rate << " msgs/s" << std::endl;
+    return rate;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* spec = argc > 1 ? argv[1] : "spec/FIX42.xml";
+    std::vector<std::string> msgs = argc > 2 ? Load(argv[2]) : Generate(1000);
+    long iterations = argc > 3 ? atol(argv[3]) : 200;
+
+    if (msgs.empty()) {
+        std::cerr << "no ExecutionReports found" << std::endl;
+        return 1;
+    }
+
+    pugi::xml_document doc;
+    if (!doc.load_file(spec)) {
+        std::cerr << "unable to load " << spec << std::endl;
+        return 1;
+    }
+
+    TagTable table;
+    pugi::xml_node fields = doc.child("fix").child("fields");
+    for (pugi::xml_node field = fields.child("field"); field; field = field.next_sibling("field")) {
+        std::string type = field.attribute("type").value();
+        int tag = field.attribute("number").as_int();
+        table.set(tag, typeconvert(type));
+        if ("LENGTH" == type) table.setflags(tag, TAG_LENGTH);
+        if ("DATA" == type) table.setflags(tag, TAG_DATA);
+    }
+    table.set(55, FIELD_SYMBOL);
+
+    // the generated ExecutionReports have no repeating groups
+    GroupTable groups;
+
+    FIX::DataDictionary dictionary(spec);
+
+    std::vector<FIX::Message> parsed;
+    for (auto& msg : msgs) parsed.push_back(FIX::Message(msg, dictionary, false));
+
+    std::cout << "messages\t" << msgs.size() << "\niterations\t" << iterations << std::endl;
+
+    run("quickfix parse", msgs, iterations, [&](const std::string& msg) {
+        FIX::Message message(msg, dictionary, false);
+    });
+
+    size_t i = 0;
+    double before = run("ConvertToDictionary", msgs, iterations, [&](const std::string&) {
+        r0(ConvertToDictionary(parsed[i++ % parsed.size()], table, groups));
+    });
+
+    double after = run("DecodeRaw", msgs, iterations, [&](const std::string& msg) {
+        r0(DecodeRaw(msg.data(), msg.size(), table, groups));
+    });
+
+    std::cout << "speedup\t" << after / before << "x" << std::endl;
+
+    static const int handled[] = { 35, 11, 37, 39, 150, 14, 151, 6 };
+    double lazy = run("IndexRaw+8 gets", msgs, iterations, [&](const std::string& msg) {
+        K x = IndexRaw(msg.data(), msg.size(), table, 0);
+        for (int tag : handled) r0(LazyGet(x, tag, table));
+        r0(x);
+    });
+
+    std::cout << "speedup\t" << lazy / before << "x" << std::endl;
+    return 0;
+}
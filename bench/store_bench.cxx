@@ -0,0 +1,90 @@
+#include "mmapstore.h"
+
+#include <quickfix/FileStore.h>
+#include <quickfix/SessionID.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* store_bench:
+ *   Compares QuickFIX's FileStore with the memory mapped store. The outbound
+ *   figures time what Session::send asks of the store for every message
+ *   (set followed by incrNextSenderMsgSeqNum), and the resend figure is the
+ *   time to fetch every stored message for a ResendRequest from 1 to the
+ *   last sequence number. Each store starts from a reset, in a directory
+ *   that is created under the given path.
+ *
+ *   usage: store_bench [messages] [path]
+ */
+
+static void Report(const char* name, std::vector<double>& nanos)
+{
+    std::sort(nanos.begin(), nanos.end());
+    double total = 0;
+    for (double v : nanos) total += v;
+
+    std::cout << name << "\tmean " << (long long) (total / nanos.size())
+              << " ns\tp50 " << (long long) nanos[nanos.size() / 2]
+              << " ns\tp99 " << (long long) nanos[nanos.size() * 99 / 100]
+              << " ns\tmax " << (long long) nanos.back() << " ns" << std::endl;
+}
+
+static void Run(const char* name, FIX::MessageStore& store, const std::vector<std::string>& messages)
+{
+    store.reset();
+
+    std::vector<double> nanos;
+    nanos.reserve(messages.size());
+    for (size_t i = 0; i < messages.size(); i++) {
+        auto start = std::chrono::steady_clock::now();
+        store.set(store.getNextSenderMsgSeqNum(), messages[i]);
+        store.incrNextSenderMsgSeqNum();
+        nanos.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+    }
+    Report(name, nanos);
+
+    std::vector<std::string> resent;
+    auto start = std::chrono::steady_clock::now();
+    store.get(1, (int) messages.size(), resent);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << "\tresend " << resent.size() << " messages in " << ms << " ms" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    long count = argc > 1 ? atol(argv[1]) : 100000;
+    std::string path = argc > 2 ? argv[2] : "store_bench";
+    mkdir(path.c_str(), 0755);
+
+    // ExecutionReport sized messages with a distinct sequence number each
+    std::vector<std::string> messages;
+    for (long i = 1; i <= count; i++) {
+        std::string n = std::to_string(i);
+        messages.push_back(
+            "8=FIX.4.2\0019=0000\00135=8\00134=" + n + "\00149=AQUAQ\00152=20160304-14:21:36.567\00156=BROKER\001"
+            "6=101.2525\00111=ORD" + n + "\00114=500\00117=EXEC" + n + "\00120=0\00131=101.25\00132=100\00137=BRK" + n +
+            "\00138=1000\00139=1\00140=2\00144=101.5\00154=1\00155=VOD.L\00160=20160304-14:21:36.567\001150=1\001"
+            "151=500\00110=000\001");
+    }
+
+    std::cout << "messages\t" << count << std::endl;
+
+    FIX::SessionID sessionID("FIX.4.2", "AQUAQ", "BROKER");
+    FIX::FileStoreFactory files(path);
+    FIX::MessageStore* file = files.create(sessionID);
+    Run("file", *file, messages);
+    files.destroy(file);
+
+    MmapStore none(path + "/bench.none", 64 << 20, STORE_SYNC_NONE);
+    Run("mmap", none, messages);
+
+    MmapStore synced(path + "/bench.message", 64 << 20, STORE_SYNC_MESSAGE);
+    Run("mmap+sync", synced, std::vector<std::string>(messages.begin(), messages.begin() + std::min<long>(count, 10000)));
+
+    return 0;
+}
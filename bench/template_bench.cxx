@@ -0,0 +1,148 @@
+#include "kstub.h"
+#include "encoder.h"
+#include "template.h"
+
+#include <quickfix/Message.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* template_bench:
+ *   Order entry latency from the q call to the bytes handed to send(), for
+ *   a NewOrderSingle built field by field from a dictionary (SendMessageDict)
+ *   and from a template with six variable fields (.fix.sendt). Both end with
+ *   the serialisation QuickFIX performs in Session::send. The stub answers
+ *   the q `string` callbacks made by the original conversion with snprintf,
+ *   so the dictionary figures do not include the cost of re-entering q.
+ *
+ *   usage: template_bench [orders]
+ */
+
+// the original atom conversion, kept here for comparison
+static std::string LegacyToString(K x)
+{
+    if (KC == x->t) {
+        return std::string(kC(x), kC(x) + x->n);
+    }
+
+    if (-1 == x->t) {
+        x = kp(const_cast<char *>(x->g ? "Y" : "N"));
+    } else if (x->t <= -2 && x->t >= -11) {
+        x = k(0, (S) "string ", r1(x), (K) 0);
+    } else {
+        char buffer[32];
+        x = kpn(buffer, (J) formattimestamp(buffer, x->j));
+    }
+
+    std::string rep(kC(x), kC(x) + x->n);
+    r0(x);
+    return rep;
+}
+
+static K StubString(const char* f, K* args, int n)
+{
+    K r = (K) 0;
+    if (0 == strcmp(f, "string ") && 1 == n) {
+        K x = args[0];
+        char buf[64];
+        int len = 0;
+        switch (x->t) {
+        case -KC: len = snprintf(buf, sizeof(buf), "%c", x->g); break;
+        case -KI: len = snprintf(buf, sizeof(buf), "%d", x->i); break;
+        case -KJ: len = snprintf(buf, sizeof(buf), "%lld", x->j); break;
+        case -KF: len = snprintf(buf, sizeof(buf), "%.7g", x->f); break;
+        case -KS: len = snprintf(buf, sizeof(buf), "%s", x->s); break;
+        }
+        r = kpn(buf, len);
+    }
+    for (int i = 0; i < n; i++) r0(args[i]);
+    return r;
+}
+
+static void Report(const char* name, std::vector<double>& nanos)
+{
+    std::sort(nanos.begin(), nanos.end());
+    double total = 0;
+    for (double v : nanos) total += v;
+
+    std::cout << name << "\tmean " << (long long) (total / nanos.size())
+              << " ns\tp50 " << (long long) nanos[nanos.size() / 2]
+              << " ns\tp99 " << (long long) nanos[nanos.size() * 99 / 100]
+              << " ns\tmax " << (long long) nanos.back() << " ns" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    long orders = argc > 1 ? atol(argv[1]) : 200000;
+    kstub_handler = StubString;
+
+    // 8, 35, 49, 56, 21, 40 and 59 are static, the rest vary per order
+    static const J statictags[] = { 8, 35, 49, 56, 21, 40, 59 };
+    static const J variabletags[] = { 11, 55, 54, 38, 44, 60 };
+
+    K statics = ktn(0, 7);
+    kK(statics)[0] = kp((S) "FIX.4.2");
+    kK(statics)[1] = kc('D');
+    kK(statics)[2] = ks((S) "AQUAQ");
+    kK(statics)[3] = ks((S) "BROKER");
+    kK(statics)[4] = kc('1');
+    kK(statics)[5] = kc('2');
+    kK(statics)[6] = kc('0');
+
+    MessageTemplate compiled(std::vector<int>(variabletags, variabletags + 6));
+    for (int i = 0; i < 7; i++) compiled.set((int) statictags[i], LegacyToString(kK(statics)[i]));
+    compiled.prepare();
+
+    std::vector<K> values;
+    for (long i = 0; i < 1000; i++) {
+        K row = ktn(0, 6);
+        kK(row)[0] = kp((S) ("ORD" + std::to_string(i)).c_str());
+        kK(row)[1] = ks((S) "VOD.L");
+        kK(row)[2] = kc('1');
+        kK(row)[3] = kf(100 + i % 900);
+        kK(row)[4] = kf(101.25 + (i % 7) * 0.25);
+        kK(row)[5] = ktj(-KP, 511021296567000000LL + i * 1000000);
+        values.push_back(row);
+    }
+
+    std::vector<double> dict, templ;
+    dict.reserve(orders);
+    templ.reserve(orders);
+    std::string wire;
+
+    for (long i = 0; i < orders; i++) {
+        K row = values[i % values.size()];
+
+        auto start = std::chrono::steady_clock::now();
+        FIX::Message message;
+        for (int j = 0; j < 7; j++) {
+            int tag = (int) statictags[j];
+            if (IsHeaderTag(tag)) message.getHeader().setField(tag, LegacyToString(kK(statics)[j]));
+            else message.setField(tag, LegacyToString(kK(statics)[j]));
+        }
+        for (int j = 0; j < 6; j++) {
+            message.setField((int) variabletags[j], LegacyToString(kK(row)[j]));
+        }
+        message.toString(wire);
+        dict.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+
+        start = std::chrono::steady_clock::now();
+        FIX::Message filled;
+        compiled.fill(kK(row), 6, filled);
+        filled.toString(wire);
+        templ.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    std::cout << "orders\t" << orders << std::endl;
+    Report("dictionary", dict);
+    Report("template", templ);
+
+    for (K row : values) r0(row);
+    r0(statics);
+    return 0;
+}
@@ -0,0 +1,348 @@
+#ifndef KDBFIX_ASYNCLOG_H
+#define KDBFIX_ASYNCLOG_H
+
+#include <quickfix/Log.h>
+#include <quickfix/SessionSettings.h>
+
+#include "logformat.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* LogBuffer:
+ *   A fixed size byte ring that several threads append records to without
+ *   locking (a session thread logs what it receives, and the q thread logs
+ *   what it sends on the same session) and one writer thread drains. A
+ *   producer reserves space by advancing the tail, copies its record in and
+ *   publishes it by storing the header word last. The writer stops at the
+ *   first record that has not been published yet and zeroes what it has
+ *   read, so a header word is only non-zero once its record is complete.
+ *   When there is no room the record is dropped rather than waiting.
+ */
+class LogBuffer
+{
+    public:
+    explicit LogBuffer(size_t capacity) : head(0), tail(0)
+    {
+        size_t size = 4096;
+        while (size < capacity) size <<= 1;
+        data.assign(size, 0);
+        mask = size - 1;
+    }
+
+    LogBuffer(const LogBuffer&) = delete;
+    LogBuffer& operator=(const LogBuffer&) = delete;
+
+    bool push(uint8_t type, int64_t time, const char* text, uint32_t length)
+    {
+        size_t size = align(HEADER + length);
+        size_t t = tail.load(std::memory_order_relaxed);
+        do {
+            if (t + size - head.load(std::memory_order_acquire) > data.size()) return false;
+        } while (!tail.compare_exchange_weak(t, t + size, std::memory_order_relaxed));
+
+        Entry entry = { 0, type, length, 0, time };
+        copy(t + sizeof(uint32_t), (const char*) &entry + sizeof(uint32_t), HEADER - sizeof(uint32_t));
+        copy(t + HEADER, text, length);
+
+        word(t).store((uint32_t) size, std::memory_order_release);
+        return true;
+    }
+
+    // passes each published record to write, returns the bytes consumed
+    template<typename F>
+    size_t drain(F write)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t start = h;
+        std::string text;
+
+        for (;;) {
+            uint32_t size = word(h).load(std::memory_order_acquire);
+            if (!size) break;
+
+            Entry entry;
+            read(h, (char*) &entry, HEADER);
+            text.resize(entry.length);
+            read(h + HEADER, &text[0], entry.length);
+            write(entry.type, entry.time, text);
+
+            clear(h, size);
+            h += size;
+        }
+
+        head.store(h, std::memory_order_release);
+        return h - start;
+    }
+
+    private:
+    struct Entry
+    {
+        uint32_t size;      // the publish word, total record bytes
+        uint32_t type;
+        uint32_t length;
+        uint32_t reserved;
+        int64_t time;
+    };
+
+    static const size_t HEADER = sizeof(Entry);
+
+    static size_t align(size_t n) { return (n + 7) & ~(size_t) 7; }
+
+    // record starts are 8 byte aligned so a header word never wraps
+    std::atomic<uint32_t>& word(size_t position)
+    {
+        return *reinterpret_cast<std::atomic<uint32_t>*>(&data[position & mask]);
+    }
+
+    void copy(size_t position, const char* from, size_t length)
+    {
+        size_t at = position & mask;
+        size_t first = std::min(length, data.size() - at);
+        memcpy(&data[at], from, first);
+        memcpy(&data[0], from + first, length - first);
+    }
+
+    void read(size_t position, char* to, size_t length)
+    {
+        size_t at = position & mask;
+        size_t first = std::min(length, data.size() - at);
+        memcpy(to, &data[at], first);
+        memcpy(to + first, &data[0], length - first);
+    }
+
+    void clear(size_t position, size_t length)
+    {
+        size_t at = position & mask;
+        size_t first = std::min(length, data.size() - at);
+        memset(&data[at], 0, first);
+        memset(&data[0], 0, length - first);
+    }
+
+    std::vector<char> data;
+    size_t mask;
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+};
+
+/* AsyncLog:
+ *   A FIX::Log that only copies the text into its LogBuffer with a
+ *   timestamp, leaving the formatting-free binary write to the factory's
+ *   writer thread. clear and backup are queued as events so that they are
+ *   applied in order with the records around them.
+ */
+class AsyncLog : public FIX::Log
+{
+    public:
+    AsyncLog(const std::string& path, const std::string& session, size_t capacity)
+        : path(path), session(session), flushed(0), dropped(0), buffer(capacity), fd(-1), backups(0)
+    {
+        open(0);
+    }
+
+    ~AsyncLog()
+    {
+        if (-1 != fd) close(fd);
+    }
+
+    void clear() { record(CONTROL_CLEAR, "", 0); }
+    void backup() { record(CONTROL_BACKUP, "", 0); }
+    void onIncoming(const std::string& value) { record(LOG_INCOMING, value.data(), value.size()); }
+    void onOutgoing(const std::string& value) { record(LOG_OUTGOING, value.data(), value.size()); }
+    void onEvent(const std::string& value) { record(LOG_EVENT, value.data(), value.size()); }
+
+    // writer thread, writes everything published so far in one call
+    void write()
+    {
+        pending.clear();
+        buffer.drain([&](uint8_t type, int64_t time, const std::string& text) {
+            if (CONTROL_CLEAR == type || CONTROL_BACKUP == type) {
+                output();
+                if (CONTROL_BACKUP == type) rotate();
+                else open(O_TRUNC);
+                return;
+            }
+            writelogrecord(pending, type, time, text.data(), (uint32_t) text.size());
+        });
+        output();
+    }
+
+    const std::string path;
+    const std::string session;
+
+    std::atomic<uint64_t> flushed;
+    std::atomic<uint64_t> dropped;
+
+    private:
+    static const uint8_t CONTROL_CLEAR = 0x80;
+    static const uint8_t CONTROL_BACKUP = 0x81;
+
+    void record(uint8_t type, const char* text, size_t length)
+    {
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        int64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+        if (!buffer.push(type, time, text, (uint32_t) length)) {
+            dropped.fetch_add(LOG_RECORD_HEADER + length, std::memory_order_relaxed);
+        }
+    }
+
+    void open(int flags)
+    {
+        if (-1 != fd) close(fd);
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | flags, 0644);
+
+        std::string header = logfileheader(session);
+        if (-1 != fd && 0 == lseek(fd, 0, SEEK_END)) {
+            ssize_t rc = ::write(fd, header.data(), header.size());
+            (void) rc;
+        }
+    }
+
+    // moves the current file aside as path.N, as FileLog does
+    void rotate()
+    {
+        if (-1 != fd) close(fd);
+        fd = -1;
+        std::string target = path + "." + std::to_string(++backups);
+        rename(path.c_str(), target.c_str());
+        open(O_TRUNC);
+    }
+
+    void output()
+    {
+        if (pending.empty() || -1 == fd) return;
+
+        size_t done = 0;
+        while (done < pending.size()) {
+            ssize_t rc = ::write(fd, pending.data() + done, pending.size() - done);
+            if (rc <= 0) break;
+            done += (size_t) rc;
+        }
+        flushed.fetch_add(done, std::memory_order_relaxed);
+        pending.clear();
+    }
+
+    LogBuffer buffer;
+    int fd;
+    int backups;
+    std::string pending;
+};
+
+/* AsyncLogFactory:
+ *   Creates an AsyncLog per session in its FileLogPath, as prefix.bin.log
+ *   with the prefix FileLog uses, and GLOBAL.bin.log for the global log.
+ *   LogBufferSize (default 4MB) sets the buffer of each log and
+ *   LogFlushInterval (default 10) the milliseconds between writes.
+ */
+class AsyncLogFactory : public FIX::LogFactory
+{
+    public:
+    explicit AsyncLogFactory(const FIX::SessionSettings& settings)
+        : settings(settings), capacity(4 << 20), interval(10), stopping(false)
+    {
+        const FIX::Dictionary& defaults = settings.get();
+        if (defaults.has("LogBufferSize") && defaults.getInt("LogBufferSize") > 0) {
+            capacity = (size_t) defaults.getInt("LogBufferSize");
+        }
+        if (defaults.has("LogFlushInterval") && defaults.getInt("LogFlushInterval") > 0) {
+            interval = defaults.getInt("LogFlushInterval");
+        }
+
+        writer = std::thread([this] { run(); });
+    }
+
+    ~AsyncLogFactory()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        writer.join();
+
+        for (AsyncLog* log : logs) delete log;
+    }
+
+    FIX::Log* create()
+    {
+        return add(directory(settings.get()) + "/GLOBAL.bin.log", "");
+    }
+
+    FIX::Log* create(const FIX::SessionID& sessionID)
+    {
+        std::string prefix = sessionID.getBeginString().getString() + "-" + sessionID.getSenderCompID().getString() + "-" + sessionID.getTargetCompID().getString();
+        if (!sessionID.getSessionQualifier().empty()) {
+            prefix += "-" + sessionID.getSessionQualifier();
+        }
+        return add(directory(settings.get(sessionID)) + "/" + prefix + ".bin.log", sessionID.toString());
+    }
+
+    void destroy(FIX::Log* log)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        AsyncLog* async = (AsyncLog*) log;
+        async->write();
+        logs.erase(async);
+        delete async;
+    }
+
+    // passes each log to f under the factory lock
+    template<typename F>
+    void each(F f)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (AsyncLog* log : logs) f(*log);
+    }
+
+    private:
+    static std::string directory(const FIX::Dictionary& dict)
+    {
+        std::string path = dict.has("FileLogPath") ? dict.getString("FileLogPath") : ".";
+        mkdir(path.c_str(), 0755);
+        return path;
+    }
+
+    AsyncLog* add(const std::string& path, const std::string& session)
+    {
+        auto log = new AsyncLog(path, session, capacity);
+        std::lock_guard<std::mutex> guard(lock);
+        logs.insert(log);
+        return log;
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        while (!stopping) {
+            wakeup.wait_for(guard, std::chrono::milliseconds(interval));
+            for (AsyncLog* log : logs) log->write();
+        }
+        for (AsyncLog* log : logs) log->write();
+    }
+
+    const FIX::SessionSettings& settings;
+    size_t capacity;
+    int interval;
+    bool stopping;
+    std::set<AsyncLog*> logs;
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::thread writer;
+};
+
+#endif
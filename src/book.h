@@ -0,0 +1,305 @@
+#ifndef KDBFIX_BOOK_H
+#define KDBFIX_BOOK_H
+
+#include <kx/k.h>
+
+#include "numeric.h"
+#include "temporal.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+# include <sys/timerfd.h>
+# include <unistd.h>
+#endif
+
+/* Market data books:
+ *   Sessions with BookDepth set apply MarketDataSnapshotFullRefresh (W) and
+ *   MarketDataIncrementalRefresh (X) messages to price level books on the
+ *   session thread instead of passing them to q. The q thread is woken by a
+ *   timer at most once per BookInterval and publishes the top levels of
+ *   every book that changed since the last publish, so bursts of updates to
+ *   one instrument are conflated into a single snapshot.
+ */
+
+struct BookLevel
+{
+    double price;
+    double size;
+
+    bool operator==(const BookLevel& other) const { return price == other.price && size == other.size; }
+};
+
+// one NoMDEntries instance
+struct BookEntry
+{
+    std::string symbol;
+    int side = -1;      // 0 bid, 1 offer, -1 anything else
+    int action = 0;     // 0 new, 1 change, 2 delete
+    double price = 0;
+    double size = 0;
+};
+
+/* OrderBook:
+ *   Bids and offers aggregated by price, best first, in contiguous arrays so
+ *   that updates near the top of the book touch a few cache lines.
+ */
+class OrderBook
+{
+    public:
+    explicit OrderBook(const std::string& symbol) : symbol(symbol), dirty(false) {}
+
+    const std::string symbol;
+    bool dirty;
+
+    void clear() { bids.clear(); asks.clear(); }
+
+    void apply(const BookEntry& entry)
+    {
+        // a price that is not a decimal cannot be placed in the book
+        if (entry.side < 0 || std::isnan(entry.price)) return;
+
+        std::vector<BookLevel>& levels = entry.side ? asks : bids;
+        auto at = std::lower_bound(levels.begin(), levels.end(), entry.price, [&](const BookLevel& level, double price) {
+            return entry.side ? level.price < price : level.price > price;
+        });
+        bool exists = at != levels.end() && at->price == entry.price;
+
+        if (2 == entry.action || !(entry.size > 0)) {
+            if (exists) levels.erase(at);
+        } else if (exists) {
+            at->size = entry.size;
+        } else {
+            levels.insert(at, BookLevel{ entry.price, entry.size });
+        }
+    }
+
+    // true if the top depth levels differ from the last snapshot
+    bool changed(size_t depth) const
+    {
+        return !same(bids, publishedBids, depth) || !same(asks, publishedAsks, depth);
+    }
+
+    /* snapshot:
+     *   The top depth levels as a dictionary of sym, time, bidPx, bidSize,
+     *   askPx and askSize, with missing levels null.
+     */
+    K snapshot(size_t depth, J time)
+    {
+        publishedBids.assign(bids.begin(), bids.begin() + std::min(depth, bids.size()));
+        publishedAsks.assign(asks.begin(), asks.begin() + std::min(depth, asks.size()));
+
+        K keys = ktn(KS, 6);
+        kS(keys)[0] = ss((S) "sym");
+        kS(keys)[1] = ss((S) "time");
+        kS(keys)[2] = ss((S) "bidPx");
+        kS(keys)[3] = ss((S) "bidSize");
+        kS(keys)[4] = ss((S) "askPx");
+        kS(keys)[5] = ss((S) "askSize");
+
+        K values = ktn(0, 6);
+        kK(values)[0] = ks(sn((S) symbol.data(), (I) symbol.size()));
+        kK(values)[1] = ktj(-KP, time);
+        levels(publishedBids, depth, &kK(values)[2], &kK(values)[3]);
+        levels(publishedAsks, depth, &kK(values)[4], &kK(values)[5]);
+
+        return xD(keys, values);
+    }
+
+    private:
+    static bool same(const std::vector<BookLevel>& levels, const std::vector<BookLevel>& published, size_t depth)
+    {
+        size_t n = std::min(depth, levels.size());
+        return n == published.size() && std::equal(published.begin(), published.end(), levels.begin());
+    }
+
+    static void levels(const std::vector<BookLevel>& side, size_t depth, K* prices, K* sizes)
+    {
+        *prices = ktn(KF, (J) depth);
+        *sizes = ktn(KF, (J) depth);
+        for (size_t i = 0; i < depth; i++) {
+            kF(*prices)[i] = i < side.size() ? side[i].price : nf;
+            kF(*sizes)[i] = i < side.size() ? side[i].size : nf;
+        }
+    }
+
+    std::vector<BookLevel> bids;
+    std::vector<BookLevel> asks;
+    std::vector<BookLevel> publishedBids;
+    std::vector<BookLevel> publishedAsks;
+};
+
+/* BookUpdate:
+ *   The NoMDEntries instances of one W or X message, collected from its
+ *   fields in wire order before the books are locked. A new entry starts at
+ *   the group delimiter; entries without their own Symbol or SecurityID use
+ *   the one given before the group.
+ */
+class BookUpdate
+{
+    public:
+    BookUpdate(bool snapshot, int delimiter) : snapshot(snapshot), delimiter(delimiter), ingroup(false) {}
+
+    void add(int tag, const char* value, size_t len)
+    {
+        if (268 == tag) {
+            ingroup = true;
+            return;
+        }
+
+        if (!ingroup) {
+            if (55 == tag || (48 == tag && symbol.empty())) symbol.assign(value, len);
+            return;
+        }
+
+        if (tag == delimiter) entries.push_back(BookEntry());
+        if (entries.empty()) return;
+
+        BookEntry& entry = entries.back();
+        switch (tag) {
+            case 55: entry.symbol.assign(value, len); break;
+            case 48: if (entry.symbol.empty()) entry.symbol.assign(value, len); break;
+            case 269: entry.side = 1 == len && ('0' == value[0] || '1' == value[0]) ? value[0] - '0' : -1; break;
+            case 279: entry.action = len ? value[0] - '0' : 0; break;
+            case 270: entry.price = parsedecimal(value, len); break;
+            case 271: entry.size = parsedecimal(value, len); break;
+        }
+    }
+
+    bool snapshot;
+    std::string symbol;
+    std::vector<BookEntry> entries;
+
+    private:
+    int delimiter;
+    bool ingroup;
+};
+
+/* BookSet:
+ *   The books of one session. The session thread applies updates and arms
+ *   the timer when the first book becomes dirty; the q thread publishes from
+ *   the timer callback. Both sides take the lock once per message or publish.
+ */
+class BookSet
+{
+    public:
+    BookSet(size_t depth, long interval)
+        : depth(depth ? depth : 1), interval(interval), armed(false), last()
+    {
+#ifdef __linux__
+        timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+#else
+        timer = -1;
+#endif
+    }
+
+    BookSet(const BookSet&) = delete;
+    BookSet& operator=(const BookSet&) = delete;
+
+    // descriptor to register with sd1, it is closed by sd0
+    int fd() const { return timer; }
+
+    // session thread
+    void apply(const BookUpdate& update)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (update.snapshot) {
+            OrderBook& target = book(update.symbol);
+            target.clear();
+            touch(target);
+        }
+
+        for (const BookEntry& entry : update.entries) {
+            OrderBook& target = book(entry.symbol.empty() ? update.symbol : entry.symbol);
+            target.apply(entry);
+            touch(target);
+        }
+
+        if (!dirty.empty() && !armed) {
+            armed = true;
+            auto wait = last + std::chrono::microseconds(interval) - std::chrono::steady_clock::now();
+            arm(std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count());
+        }
+    }
+
+    // q thread, passes a snapshot of each changed book to deliver
+    template<typename F>
+    void publish(F deliver)
+    {
+#ifdef __linux__
+        uint64_t expirations;
+        ssize_t rc = read(timer, &expirations, sizeof(expirations));
+        (void) rc;
+#endif
+        std::vector<K> snapshots;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            J time = currenttimestamp();
+
+            for (OrderBook* target : dirty) {
+                target->dirty = false;
+                if (target->changed(depth)) {
+                    snapshots.push_back(target->snapshot(depth, time));
+                }
+            }
+
+            dirty.clear();
+            armed = false;
+            last = std::chrono::steady_clock::now();
+        }
+
+        for (K x : snapshots) deliver(x);
+    }
+
+    private:
+    OrderBook& book(const std::string& symbol)
+    {
+        auto found = books.find(symbol);
+        if (found == books.end()) {
+            found = books.emplace(symbol, std::unique_ptr<OrderBook>(new OrderBook(symbol))).first;
+        }
+        return *found->second;
+    }
+
+    void touch(OrderBook& target)
+    {
+        if (target.dirty) return;
+        target.dirty = true;
+        dirty.push_back(&target);
+    }
+
+    void arm(long long nanos)
+    {
+#ifdef __linux__
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        if (nanos < 1) nanos = 1;
+        spec.it_value.tv_sec = (time_t) (nanos / 1000000000LL);
+        spec.it_value.tv_nsec = (long) (nanos % 1000000000LL);
+        timerfd_settime(timer, 0, &spec, NULL);
+#endif
+    }
+
+    size_t depth;
+    long interval;
+    int timer;
+    bool armed;
+    std::chrono::steady_clock::time_point last;
+
+    std::mutex lock;
+    std::unordered_map<std::string, std::unique_ptr<OrderBook>> books;
+    std::vector<OrderBook*> dirty;
+};
+
+#endif
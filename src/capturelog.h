@@ -0,0 +1,97 @@
+#ifndef KDBFIX_CAPTURELOG_H
+#define KDBFIX_CAPTURELOG_H
+
+#include <quickfix/Log.h>
+#include <quickfix/SessionSettings.h>
+
+#include <string>
+
+#include "stats.h"
+
+/* CaptureLog:
+ *   QuickFIX only exposes the raw text of an inbound message to its log, so
+ *   sessions that decode from the wire have their log wrapped in this class.
+ *   onIncoming is called on the session thread immediately before the same
+ *   bytes are parsed and passed to fromAdmin/fromApp, so the text is kept in
+ *   a per-thread buffer (reused, so it does not allocate once warm) and
+ *   everything is forwarded to the configured log. Sessions with Stats=Y
+ *   also note the time the text was seen, where the parse stage starts.
+ */
+class CaptureLog : public FIX::Log
+{
+    public:
+    CaptureLog(FIX::Log* log, bool capture, bool timed) : log(log), capture(capture), timed(timed) {}
+
+    void clear() { if (log) log->clear(); }
+    void backup() { if (log) log->backup(); }
+    void onOutgoing(const std::string& value) { if (log) log->onOutgoing(value); }
+    void onEvent(const std::string& value) { if (log) log->onEvent(value); }
+
+    void onIncoming(const std::string& value)
+    {
+        if (timed) arrived() = monotonicnanos();
+        if (capture) incoming().assign(value);
+        if (log) log->onIncoming(value);
+    }
+
+    // raw text of the last message received on this thread, empty once used
+    static std::string& incoming()
+    {
+        static thread_local std::string buffer;
+        return buffer;
+    }
+
+    // monotonicnanos() when the last message was seen on this thread, 0 once used
+    static int64_t& arrived()
+    {
+        static thread_local int64_t time = 0;
+        return time;
+    }
+
+    FIX::Log* log;
+    const bool capture;
+    const bool timed;
+};
+
+/* CaptureLogFactory:
+ *   Creates logs from the configured factory and wraps the ones belonging to
+ *   sessions with RawDecode=Y, LazyDecode=Y, DecodePool=Y or Stats=Y.
+ */
+class CaptureLogFactory : public FIX::LogFactory
+{
+    public:
+    CaptureLogFactory(FIX::LogFactory& factory, const FIX::SessionSettings& settings)
+        : factory(factory), settings(settings) {}
+
+    FIX::Log* create() { return factory.create(); }
+
+    FIX::Log* create(const FIX::SessionID& sessionID)
+    {
+        FIX::Log* log = factory.create(sessionID);
+        const FIX::Dictionary& dict = settings.get(sessionID);
+        bool capture = (dict.has("RawDecode") && dict.getBool("RawDecode")) || (dict.has("LazyDecode") && dict.getBool("LazyDecode")) ||
+            (dict.has("DecodePool") && dict.getBool("DecodePool"));
+        bool timed = dict.has("Stats") && dict.getBool("Stats");
+        if (capture || timed) {
+            return new CaptureLog(log, capture, timed);
+        }
+        return log;
+    }
+
+    void destroy(FIX::Log* log)
+    {
+        CaptureLog* capture = dynamic_cast<CaptureLog*>(log);
+        if (capture) {
+            factory.destroy(capture->log);
+            delete capture;
+        } else {
+            factory.destroy(log);
+        }
+    }
+
+    private:
+    FIX::LogFactory& factory;
+    const FIX::SessionSettings& settings;
+};
+
+#endif
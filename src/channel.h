@@ -0,0 +1,254 @@
+#ifndef KDBFIX_CHANNEL_H
+#define KDBFIX_CHANNEL_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+# include <sys/eventfd.h>
+# include <unistd.h>
+#else
+# include "socketpair.h"
+# ifndef WIN32
+#  include <unistd.h>
+# endif
+#endif
+
+#include <kx/k.h>
+
+#include "ringbuffer.h"
+#include "overflow.h"
+#include "stats.h"
+
+/* Channel:
+ *   Hands decoded messages from one QuickFIX session thread to the q main
+ *   thread without serialising them. The producer pushes K objects into an
+ *   SpscRing and only signals the wakeup descriptor (an eventfd on Linux, a
+ *   socketpair elsewhere) when the consumer has declared that it is about to
+ *   sleep, so a burst costs at most one syscall on each side. The descriptor
+ *   is registered with sd1 and the callback drains the ready slots, up to a
+ *   limit so that a busy session cannot keep the q thread from the others.
+ *   The descriptor registered with sd1 is closed by sd0.
+ *
+ *   When the ring is full the producer either waits for space (blocking the
+ *   session thread) or, with an Overflow, hands the message and everything
+ *   after it to the overflow until the consumer has caught up. The counters
+ *   are written by the producer and may be read from any thread.
+ *
+ *   Each message travels with its Trace. The overflow only keeps the
+ *   messages, so those that pass through it arrive with an empty trace.
+ *
+ *   A polled channel is never signalled: the consumer spins on poll (from
+ *   .fix.poll) instead of waiting on the descriptor, which is not
+ *   registered with sd1 and is closed with the channel.
+ */
+struct ChannelStats
+{
+    std::atomic<uint64_t> highWater{0};     // most messages queued at once
+    std::atomic<uint64_t> stalls{0};        // pushes that waited for space
+    std::atomic<uint64_t> overflowed{0};    // messages given to the overflow
+};
+
+// a queued message and the timestamps taken on the session thread
+struct Delivery
+{
+    K x;
+    Trace trace;
+};
+
+class Channel
+{
+    public:
+    explicit Channel(size_t capacity, Overflow* overflow = nullptr, bool polled = false)
+        : polled(polled), ring(capacity), waiting(!polled), overflowing(false), pending(0), overflow(overflow)
+    {
+#ifdef __linux__
+        fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+        dumb_socketpair(fds, 0);
+#endif
+    }
+
+    ~Channel()
+    {
+#ifdef WIN32
+        closesocket(fds[0]);
+        if (polled) closesocket(fds[1]);
+#else
+# ifndef __linux__
+        close(fds[0]);
+# endif
+        if (polled) close(fds[1]);
+#endif
+    }
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    // descriptor to register with sd1
+    int fd() const { return fds[1]; }
+
+    /* push:
+     *   Producer side. Without an overflow it spins while the ring is full so
+     *   nothing is dropped. key() is only called when a message goes to an
+     *   overflow that conflates.
+     */
+    void push(K x, const Trace& trace = Trace())
+    {
+        push(x, trace, [] { return std::string(); });
+    }
+
+    template<typename F>
+    void push(K x, const Trace& trace, F key)
+    {
+        Delivery delivery = { x, trace };
+        if (overflowing.load(std::memory_order_acquire) || !ring.push(delivery)) {
+            if (!spill(delivery, key)) {
+                stats.stalls.store(stats.stalls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                if (!polled) wake();
+                while (!(overflow ? spill(delivery, key) : ring.push(delivery))) std::this_thread::yield();
+            }
+        }
+
+        size_t queued = ring.size() + pending.load(std::memory_order_relaxed);
+        if (queued > stats.highWater.load(std::memory_order_relaxed)) {
+            stats.highWater.store(queued, std::memory_order_relaxed);
+        }
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed) && waiting.exchange(false)) {
+            wake();
+        }
+    }
+
+    // consumer side, passes up to limit queued messages (and their traces,
+    // which deliver may update) to deliver and
+    // re-arms the wakeup once the ring has been observed empty. If the limit
+    // is reached the descriptor is left readable so the q event loop comes
+    // back to this channel after serving the others.
+    template<typename F>
+    size_t drain(F deliver, size_t limit = SIZE_MAX)
+    {
+        size_t count = 0;
+        Delivery delivery;
+
+        acknowledge();
+        for (;;) {
+            while (count < limit && next(delivery)) {
+                deliver(delivery.x, delivery.trace);
+                count++;
+            }
+            if (count == limit) {
+                wake();
+                break;
+            }
+            waiting.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ring.empty() && !overflowing.load()) break;
+            waiting.store(false);
+        }
+
+        return count;
+    }
+
+    // consumer side of a polled channel, passes up to limit queued messages
+    // to deliver without touching the descriptor
+    template<typename F>
+    size_t poll(F deliver, size_t limit)
+    {
+        size_t count = 0;
+        Delivery delivery;
+        while (count < limit && next(delivery)) {
+            deliver(delivery.x, delivery.trace);
+            count++;
+        }
+        return count;
+    }
+
+    size_t size() const { return ring.size(); }
+    size_t capacity() const { return ring.capacity(); }
+
+    // messages waiting in the overflow
+    size_t overflowSize() const { return pending.load(std::memory_order_relaxed); }
+
+    size_t conflated()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return overflow ? overflow->conflated() : 0;
+    }
+
+    ChannelStats stats;
+    const bool polled;
+
+    private:
+    // hands x to the overflow, or to the ring if the consumer emptied the
+    // overflow in the meantime. False if there is no overflow or it is unable
+    // to take x.
+    template<typename F>
+    bool spill(const Delivery& delivery, F key)
+    {
+        if (!overflow) return false;
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (!overflowing.load(std::memory_order_relaxed) && ring.push(delivery)) return true;
+        if (!overflow->push(delivery.x, overflow->keyed() ? key() : std::string())) return false;
+
+        pending.store(overflow->size(), std::memory_order_relaxed);
+        overflowing.store(true, std::memory_order_release);
+        stats.overflowed.store(stats.overflowed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // the ring holds everything queued before the overflow was first used,
+    // so the overflow is only read once the ring is empty
+    bool next(Delivery& delivery)
+    {
+        if (ring.pop(delivery)) return true;
+        if (!overflowing.load(std::memory_order_acquire)) return false;
+
+        std::lock_guard<std::mutex> guard(lock);
+        delivery.trace = Trace();
+        bool popped = overflow->pop(delivery.x);
+        pending.store(overflow->size(), std::memory_order_relaxed);
+        if (!popped) overflowing.store(false, std::memory_order_release);
+        return popped;
+    }
+
+    void wake()
+    {
+#ifdef __linux__
+        uint64_t one = 1;
+        ssize_t rc = write(fds[0], &one, sizeof(one));
+        (void) rc;
+#else
+        char one = 1;
+        send(fds[0], &one, 1, 0);
+#endif
+    }
+
+    void acknowledge()
+    {
+#ifdef __linux__
+        uint64_t count;
+        ssize_t rc = read(fds[1], &count, sizeof(count));
+        (void) rc;
+#else
+        char buf[256];
+        recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT);
+#endif
+    }
+
+    SpscRing<Delivery> ring;
+    std::atomic<bool> waiting;
+    std::atomic<bool> overflowing;
+    std::atomic<size_t> pending;
+    std::unique_ptr<Overflow> overflow;
+    std::mutex lock;
+    int fds[2];
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef KDBFIX_COLUMNS_H
+#define KDBFIX_COLUMNS_H
+
+#include <kx/k.h>
+
+#include "decoder.h"
+
+/* Columns:
+ *   Typed table columns filled from decoded field atoms, shared by the
+ *   batched delivery tables and the repeating group tables. Strings and
+ *   anything without a simple type (such as nested groups) use a general
+ *   column.
+ */
+inline I columntype(FieldType type)
+{
+    static const I columntypes[FIELD_TYPE_COUNT] = { 0, KF, KI, KC, KB, KP, KD, KT, KS, KJ };
+    return columntypes[type];
+}
+
+inline void SetColumnNull(K column, I type, J row)
+{
+    switch (type) {
+        case KF: kF(column)[row] = nf; break;
+        case KI: case KD: case KT: kI(column)[row] = ni; break;
+        case KC: kC(column)[row] = ' '; break;
+        case KB: kG(column)[row] = 0; break;
+        case KP: case KJ: kJ(column)[row] = nj; break;
+        case KS: kS(column)[row] = ss((S) ""); break;
+        default: kK(column)[row] = ktn(KC, 0); break;
+    }
+}
+
+inline void SetColumnValue(K column, I type, J row, K atom)
+{
+    if (0 == type) {
+        kK(column)[row] = r1(atom);
+        return;
+    }
+
+    // the decoder and the column share the spec type, anything else is a null
+    if (atom->t != -type) {
+        SetColumnNull(column, type, row);
+        return;
+    }
+
+    switch (type) {
+        case KF: kF(column)[row] = atom->f; break;
+        case KI: case KD: case KT: kI(column)[row] = atom->i; break;
+        case KC: case KB: kG(column)[row] = atom->g; break;
+        case KP: case KJ: kJ(column)[row] = atom->j; break;
+        case KS: kS(column)[row] = atom->s; break;
+    }
+}
+
+// appends a null row to a column created with ktn(type, 0)
+inline void AppendColumnNull(K* column, I type)
+{
+    switch (type) {
+        case KF: { F v = nf; ja(column, &v); break; }
+        case KI: case KD: case KT: { I v = ni; ja(column, &v); break; }
+        case KC: { C v = ' '; ja(column, &v); break; }
+        case KB: { G v = 0; ja(column, &v); break; }
+        case KP: case KJ: { J v = nj; ja(column, &v); break; }
+        case KS: js(column, ss((S) "")); break;
+        default: jk(column, ktn(KC, 0)); break;
+    }
+}
+
+// appends a decoded atom to a column created with ktn(type, 0), a null if
+// the atom does not have the column's type
+inline void AppendColumnAtom(K* column, I type, K atom)
+{
+    if (0 == type) {
+        jk(column, r1(atom));
+        return;
+    }
+
+    if (atom->t != -type) {
+        AppendColumnNull(column, type);
+        return;
+    }
+
+    switch (type) {
+        case KF: ja(column, &atom->f); break;
+        case KI: case KD: case KT: ja(column, &atom->i); break;
+        case KC: case KB: ja(column, &atom->g); break;
+        case KP: case KJ: ja(column, &atom->j); break;
+        case KS: js(column, atom->s); break;
+    }
+}
+
+// appends the value of tag straight to a column of its columntype, giving
+// the same value as table.decode without building an atom
+inline void AppendColumnField(K* column, I type, const TagTable& table, int tag, const char* str, size_t len)
+{
+    FieldType field = table.type(tag);
+    if (0 == type) {
+        jk(column, table.decode(tag, str, len));
+        return;
+    }
+
+    if (type != columntype(field)) {
+        K atom = table.decode(tag, str, len);
+        AppendColumnAtom(column, type, atom);
+        r0(atom);
+        return;
+    }
+
+    switch (field) {
+        case FIELD_FLOAT: { F v = parsedecimal(str, len); ja(column, &v); break; }
+        case FIELD_INT: { I v = parseint(str, len); ja(column, &v); break; }
+        case FIELD_CHAR: { C v = len ? str[0] : ' '; ja(column, &v); break; }
+        case FIELD_BOOLEAN: { G v = 1 == len && 'Y' == str[0]; ja(column, &v); break; }
+        case FIELD_TIMESTAMP: { J v = parsetimestamp(str, len); ja(column, &v); break; }
+        case FIELD_DATE: { I v = parsedate(str, len); ja(column, &v); break; }
+        case FIELD_TIME: { I v = parsetime(str, len); ja(column, &v); break; }
+        case FIELD_SYMBOL: js(column, internsymbol(str, len)); break;
+        case FIELD_FIXED: { J v = parsefixed(str, len, table.scale(tag)); ja(column, &v); break; }
+        default: break;
+    }
+}
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef KDBFIX_DECODEPOOL_H
+#define KDBFIX_DECODEPOOL_H
+
+#include <kx/k.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "filter.h"
+#include "spec.h"
+#include "stats.h"
+
+/* ReorderWindow:
+ *   Puts one session's messages back in the order its thread received them,
+ *   which QuickFIX guarantees is MsgSeqNum order, after they have been
+ *   decoded by any of the pool's workers. The session thread numbers each
+ *   message with issue and whichever thread finishes the oldest message
+ *   hands it and every finished message after it to deliver, one thread at
+ *   a time, so deliver sees a single producer as Channel requires. The
+ *   session thread waits in issue while WINDOW messages are in flight.
+ */
+class ReorderWindow
+{
+    public:
+    typedef std::function<void(K, Trace&, const std::string&)> Deliver;
+
+    explicit ReorderWindow(Deliver deliver)
+        : deliver(deliver), slots(WINDOW), issued(0), next(0), delivering(false), waiting(false) {}
+
+    ReorderWindow(const ReorderWindow&) = delete;
+    ReorderWindow& operator=(const ReorderWindow&) = delete;
+
+    // session thread, the sequence number of the next message
+    uint64_t issue()
+    {
+        if (issued - next.load(std::memory_order_acquire) >= WINDOW) {
+            std::unique_lock<std::mutex> guard(lock);
+            waiting = true;
+            space.wait(guard, [this] { return issued - next.load(std::memory_order_relaxed) < WINDOW; });
+        }
+        return issued++;
+    }
+
+    // any thread, x is the decoded message numbered seq (or (K) 0 for none)
+    void complete(uint64_t seq, K x, const Trace& trace, std::string& key)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        Slot& slot = slots[seq & (WINDOW - 1)];
+        slot.x = x;
+        slot.trace = trace;
+        slot.key.swap(key);
+        slot.ready = true;
+        if (delivering || seq != next.load(std::memory_order_relaxed)) return;
+
+        delivering = true;
+        for (Slot* ready = &slot; ready->ready; ready = &slots[next.load(std::memory_order_relaxed) & (WINDOW - 1)]) {
+            K out = ready->x;
+            Trace outTrace = ready->trace;
+            std::string outKey;
+            outKey.swap(ready->key);
+            ready->ready = false;
+            next.store(next.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            if (waiting) {
+                waiting = false;
+                space.notify_all();
+            }
+
+            guard.unlock();
+            if (out) deliver(out, outTrace, outKey);
+            guard.lock();
+        }
+        delivering = false;
+    }
+
+    private:
+    static const uint64_t WINDOW = 1024;
+
+    struct Slot
+    {
+        K x = (K) 0;
+        Trace trace;
+        std::string key;
+        bool ready = false;
+    };
+
+    Deliver deliver;
+    std::mutex lock;
+    std::condition_variable space;
+    std::vector<Slot> slots;
+    uint64_t issued;                // only used by the session thread
+    std::atomic<uint64_t> next;
+    bool delivering;
+    bool waiting;
+};
+
+// one message for the pool: its wire text and what to decode it with
+struct DecodeTask
+{
+    ReorderWindow* window;
+    uint64_t seq;
+    std::string raw;
+    const Spec* spec;
+    const TagFilter* filter;
+    bool lazy;
+    Trace trace;
+    std::string key;                // conflation key, set when the session conflates
+};
+
+/* DecodePool:
+ *   A fixed set of threads decoding the messages of sessions with
+ *   DecodePool=Y so that a burst on one session is spread over cores
+ *   instead of holding up that session's socket reads. Each worker has a
+ *   deque; submit deals tasks round robin, a worker takes the oldest task
+ *   of its own deque and, once that is empty, steals the newest of
+ *   another's. Idle workers sleep until a task is submitted. Decoded
+ *   messages go to the task's ReorderWindow. Destroying the pool decodes
+ *   and delivers whatever is still queued.
+ */
+class DecodePool
+{
+    public:
+    typedef K (*Decode)(DecodeTask&);
+
+    DecodePool(size_t threads, Decode decode)
+        : decode(decode), queues(threads), dealt(0), queued(0), sleeping(0), stopping(false)
+    {
+        for (auto& queue : queues) queue.reset(new Queue);
+        for (size_t i = 0; i < threads; i++) workers.emplace_back([this, i] { run(i); });
+    }
+
+    DecodePool(const DecodePool&) = delete;
+    DecodePool& operator=(const DecodePool&) = delete;
+
+    ~DecodePool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(idleLock);
+            stopping = true;
+        }
+        idle.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    // session thread
+    void submit(DecodeTask& task)
+    {
+        Queue& queue = *queues[dealt.fetch_add(1, std::memory_order_relaxed) % queues.size()];
+        {
+            std::lock_guard<std::mutex> guard(queue.lock);
+            queue.tasks.push_back(std::move(task));
+        }
+
+        queued.fetch_add(1);
+        if (sleeping.load() > 0) {
+            std::lock_guard<std::mutex> guard(idleLock);
+            idle.notify_one();
+        }
+    }
+
+    size_t size() const { return workers.size(); }
+
+    private:
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<DecodeTask> tasks;
+    };
+
+    bool take(size_t self, DecodeTask& task)
+    {
+        for (size_t i = 0; i < queues.size(); i++) {
+            Queue& queue = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            if (queue.tasks.empty()) continue;
+
+            if (0 == i) {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            } else {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    void run(size_t self)
+    {
+        DecodeTask task;
+        for (;;) {
+            if (take(self, task)) {
+                K x = decode(task);
+                task.window->complete(task.seq, x, task.trace, task.key);
+                task.raw.clear();
+                continue;
+            }
+
+            // sleeping is raised before queued is read and submit raises
+            // queued before reading sleeping, so one of them sees the other
+            std::unique_lock<std::mutex> guard(idleLock);
+            sleeping.fetch_add(1);
+            if (queued.load() <= 0 && !stopping) idle.wait_for(guard, std::chrono::milliseconds(100));
+            sleeping.fetch_sub(1);
+            if (stopping && queued.load() <= 0) break;
+        }
+
+        m9();
+    }
+
+    const Decode decode;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> dealt;
+    std::atomic<long> queued;
+    std::atomic<int> sleeping;
+    std::mutex idleLock;
+    std::condition_variable idle;
+    bool stopping;
+};
+
+#endif
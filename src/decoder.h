@@ -0,0 +1,187 @@
+#ifndef KDBFIX_DECODER_H
+#define KDBFIX_DECODER_H
+
+#include <kx/k.h>
+
+#include "intern.h"
+#include "numeric.h"
+#include "temporal.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* FieldType:
+ *   The kdb+ representation used for a FIX field, derived from the type
+ *   attribute of the field in the spec. FIELD_FIXED is only set per tag by
+ *   the FixedPoint setting, for decimals wanted as scaled longs.
+ */
+enum FieldType : unsigned char
+{
+    FIELD_STRING = 0,
+    FIELD_FLOAT,
+    FIELD_INT,
+    FIELD_CHAR,
+    FIELD_BOOLEAN,
+    FIELD_TIMESTAMP,
+    FIELD_DATE,
+    FIELD_TIME,
+    FIELD_SYMBOL,
+    FIELD_FIXED,
+    FIELD_TYPE_COUNT
+};
+
+inline FieldType typeconvert(const std::string& s)
+{
+    static const std::unordered_map<std::string, FieldType> typemapconvert = {
+        {"STRING", FIELD_STRING},
+        {"MULTIPLEVALUESTRING", FIELD_STRING},
+        {"PRICE", FIELD_FLOAT},
+        {"CHAR", FIELD_CHAR},
+        {"INT", FIELD_INT},
+        {"AMT", FIELD_FLOAT},
+        {"CURRENCY", FIELD_FLOAT},
+        {"QTY", FIELD_FLOAT},
+        {"EXCHANGE", FIELD_STRING},
+        {"UTCTIMESTAMP", FIELD_TIMESTAMP},
+        {"BOOLEAN", FIELD_BOOLEAN},
+        {"LOCALMKTDATE", FIELD_DATE},
+        {"DATA", FIELD_STRING},
+        {"LENGTH", FIELD_FLOAT},
+        {"FLOAT", FIELD_FLOAT},
+        {"PRICEOFFSET", FIELD_FLOAT},
+        {"MONTHYEAR", FIELD_STRING},
+        {"DAYOFMONTH", FIELD_STRING},
+        {"UTCDATE", FIELD_DATE},
+        {"UTCTIMEONLY", FIELD_TIME},
+        {"COUNTRY", FIELD_STRING},
+        {"DATE", FIELD_STRING},
+        {"LANGUAGE", FIELD_STRING},
+        {"MULTIPLECHARVALUE", FIELD_STRING},
+        {"MULTIPLESTRINGVALUE", FIELD_STRING},
+        {"NUMINGROUP", FIELD_INT},
+        {"PERCENTAGE", FIELD_FLOAT},
+        {"SEQNUM", FIELD_INT},
+        {"TIME", FIELD_STRING},
+    };
+
+    auto found = typemapconvert.find(s);
+    return found != typemapconvert.end() ? found->second : FIELD_STRING;
+}
+
+/* Field decoders:
+ *   One per FieldType, all taking a pointer and a length so that callers do
+ *   not have to build a std::string per field. Numbers that are not valid
+ *   FIX decimals or ints decode as nulls.
+ */
+typedef K (*FieldDecoder)(const char* str, size_t len);
+
+static K decodestring(const char* str, size_t len) { return kpn((S) str, (J) len); }
+static K decodesymbol(const char* str, size_t len) { return ks(internsymbol(str, len)); }
+static K decodefloat(const char* str, size_t len) { return kf(parsedecimal(str, len)); }
+static K decodeint(const char* str, size_t len) { return ki(parseint(str, len)); }
+static K decodechar(const char* str, size_t len) { return kc(len ? str[0] : ' '); }
+static K decodeboolean(const char* str, size_t len) { return kb(1 == len && 'Y' == str[0]); }
+static K decodetimestamp(const char* str, size_t len) { return ktj(-KP, parsetimestamp(str, len)); }
+static K decodedate(const char* str, size_t len) { return kd(parsedate(str, len)); }
+static K decodetime(const char* str, size_t len) { return kt(parsetime(str, len)); }
+
+// TagTable::decode applies the tag's scale, this is the unscaled form
+static K decodefixed(const char* str, size_t len) { return kj(parsefixed(str, len, 0)); }
+
+static const FieldDecoder fielddecoders[FIELD_TYPE_COUNT] = {
+    decodestring,
+    decodefloat,
+    decodeint,
+    decodechar,
+    decodeboolean,
+    decodetimestamp,
+    decodedate,
+    decodetime,
+    decodesymbol,
+    decodefixed,
+};
+
+// properties of a tag that matter when splitting a raw message
+enum TagFlag : unsigned char
+{
+    TAG_LENGTH = 1,   // value is the byte length of the following DATA field
+    TAG_DATA = 2      // value may contain SOH and is delimited by its length
+};
+
+/* TagTable:
+ *   Spec field types stored densely by tag number so that decoding a field
+ *   is a single array load followed by an indirect call. Tags outside the
+ *   spec (including user defined tags) decode as strings. Fixed point tags
+ *   also have the power of ten their values are scaled by.
+ */
+class TagTable
+{
+    public:
+    void set(int tag, FieldType type)
+    {
+        if (tag < 0) return;
+        if ((size_t) tag >= types.size()) {
+            types.resize(tag + 1, FIELD_STRING);
+            flags.resize(tag + 1, 0);
+        }
+        types[tag] = type;
+    }
+
+    void setflags(int tag, unsigned char value)
+    {
+        if (tag < 0) return;
+        if ((size_t) tag >= types.size()) set(tag, FIELD_STRING);
+        flags[tag] = value;
+    }
+
+    bool hasflag(int tag, TagFlag flag) const
+    {
+        return (size_t) tag < flags.size() && (flags[tag] & flag);
+    }
+
+    unsigned char flagsof(int tag) const
+    {
+        return (size_t) tag < flags.size() ? flags[tag] : 0;
+    }
+
+    // decodes tag as a long of its value times 10^scale
+    void setscale(int tag, int scale)
+    {
+        if (tag < 0) return;
+        set(tag, FIELD_FIXED);
+        if ((size_t) tag >= scales.size()) scales.resize(tag + 1, 0);
+        scales[tag] = (unsigned char) scale;
+    }
+
+    int scale(int tag) const
+    {
+        return (size_t) tag < scales.size() ? scales[tag] : 0;
+    }
+
+    // one past the highest tag set
+    size_t size() const { return types.size(); }
+
+    FieldType type(int tag) const
+    {
+        return (size_t) tag < types.size() ? (FieldType) types[tag] : FIELD_STRING;
+    }
+
+    K decode(int tag, const char* str, size_t len) const
+    {
+        FieldType t = type(tag);
+        if (FIELD_FIXED == t) return kj(parsefixed(str, len, scale(tag)));
+        return fielddecoders[t](str, len);
+    }
+
+    void clear() { types.clear(); flags.clear(); scales.clear(); }
+
+    private:
+    std::vector<unsigned char> types;
+    std::vector<unsigned char> flags;
+    std::vector<unsigned char> scales;
+};
+
+#endif
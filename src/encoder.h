@@ -0,0 +1,154 @@
+#ifndef KDBFIX_ENCODER_H
+#define KDBFIX_ENCODER_H
+
+#include <kx/k.h>
+
+#include "numeric.h"
+#include "temporal.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/* Field encoders:
+ *   The inverse of the decoders, writing the FIX text for a kdb+ atom without
+ *   calling back into q. Booleans become Y/N, bytes are written in hex as q
+ *   does, other numbers in decimal (floats with up to 15 significant digits
+ *   so that 101.25 stays 101.25, and no exponent) and the temporal types
+ *   use the fixed width FIX formats. Nulls produce an empty string.
+ */
+
+// writes the decimal digits of v ending at end, returns the first character
+inline char* writeunsigned(char* end, unsigned long long v)
+{
+    do {
+        *--end = (char) ('0' + v % 10);
+        v /= 10;
+    } while (v);
+    return end;
+}
+
+inline size_t formatinteger(char* buf, long long v)
+{
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* p = writeunsigned(end, v < 0 ? 0ULL - (unsigned long long) v : (unsigned long long) v);
+    if (v < 0) *--p = '-';
+
+    size_t len = (size_t) (end - p);
+    memcpy(buf, p, len);
+    return len;
+}
+
+inline size_t formatfloat(char* buf, double v, int precision)
+{
+    if (v != v) return 0;
+    size_t len = formatdecimal(buf, v, precision);
+    return len < 32 ? len : 0;
+}
+
+// the character data of a string, symbol or char atom, 0 if x is not one
+inline const char* textof(K x, size_t* len)
+{
+    if (KC == x->t) { *len = (size_t) x->n; return (const char*) kC(x); }
+    if (-KS == x->t) { *len = strlen(x->s); return x->s; }
+    if (-KC == x->t) { *len = 1; return (const char*) &x->g; }
+    return nullptr;
+}
+
+static const char hexdigits[] = "0123456789abcdef";
+
+/* formatfield:
+ *   Writes the FIX text of a numeric, boolean or temporal atom into buf
+ *   (which must hold at least 32 bytes). Returns false for types that have
+ *   no native encoding.
+ */
+inline bool formatfield(K x, char* buf, size_t* len)
+{
+    switch (x->t) {
+    case -KB: *len = 1; buf[0] = x->g ? 'Y' : 'N'; return true;
+    case -KG: *len = 2; buf[0] = hexdigits[x->g >> 4]; buf[1] = hexdigits[x->g & 15]; return true;
+    case -KH: *len = nh == x->h ? 0 : formatinteger(buf, x->h); return true;
+    case -KI: *len = ni == x->i ? 0 : formatinteger(buf, x->i); return true;
+    case -KJ: *len = nj == x->j ? 0 : formatinteger(buf, x->j); return true;
+    case -KE: *len = formatfloat(buf, x->e, 7); return true;
+    case -KF: *len = formatfloat(buf, x->f, 15); return true;
+    case -KP: *len = formattimestamp(buf, x->j); return true;
+    case -KD: *len = formatdate(buf, x->i); return true;
+    case -KT: *len = formattime(buf, x->i); return true;
+    default: return false;
+    }
+}
+
+// the FIX text of x, false when it has no native encoding
+inline bool encodefield(K x, std::string& out)
+{
+    size_t len;
+    const char* text = textof(x, &len);
+    if (text) {
+        out.assign(text, len);
+        return true;
+    }
+
+    char buf[32];
+    if (!formatfield(x, buf, &len)) return false;
+    out.assign(buf, len);
+    return true;
+}
+
+/* encodecolumn:
+ *   The FIX text of every row of a table column. The column type is checked
+ *   once and the matching formatter applied to each element; general lists
+ *   (such as a column of strings) are encoded atom by atom. Returns false if
+ *   the column or one of its atoms has no native encoding.
+ */
+inline bool encodecolumn(K column, std::vector<std::string>& out)
+{
+    J n = column->n;
+    out.resize((size_t) n);
+
+    if (0 == column->t) {
+        for (J i = 0; i < n; i++) {
+            if (!encodefield(kK(column)[i], out[i])) return false;
+        }
+        return true;
+    }
+
+    if (KS == column->t) {
+        for (J i = 0; i < n; i++) out[i].assign(kS(column)[i]);
+        return true;
+    }
+
+    if (KC == column->t) {
+        for (J i = 0; i < n; i++) out[i].assign(1, (char) kC(column)[i]);
+        return true;
+    }
+
+    // the remaining vector types share the atom formatters through a
+    // scratch atom of the element type
+    size_t width;
+    switch (column->t) {
+    case KB: case KG: width = 1; break;
+    case KH: width = 2; break;
+    case KI: case KE: case KD: case KT: width = 4; break;
+    case KJ: case KF: case KP: width = 8; break;
+    default: return false;
+    }
+
+    struct k0 atom;
+    memset(&atom, 0, sizeof(atom));
+    atom.t = -column->t;
+
+    char buf[32];
+    size_t len;
+    for (J i = 0; i < n; i++) {
+        memcpy(&atom.g, kG(column) + i * width, width);
+        if (!formatfield(&atom, buf, &len)) return false;
+        out[i].assign(buf, len);
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef KDBFIX_FILTER_H
+#define KDBFIX_FILTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* TagFilter:
+ *   What to forward for one MsgType, either nothing at all or the fields
+ *   whose bit is set. MsgType (35) is always kept so that messages can still
+ *   be told apart once projected.
+ */
+struct TagFilter
+{
+    bool drop;
+    std::vector<uint64_t> bits;
+
+    TagFilter() : drop(false) {}
+
+    void add(int tag)
+    {
+        if (tag < 0) return;
+        if ((size_t) (tag >> 6) >= bits.size()) bits.resize((tag >> 6) + 1, 0);
+        bits[tag >> 6] |= 1ULL << (tag & 63);
+    }
+
+    bool has(int tag) const
+    {
+        return tag >= 0 && (size_t) (tag >> 6) < bits.size() && (bits[tag >> 6] >> (tag & 63)) & 1;
+    }
+};
+
+/* FilterSet:
+ *   The filters for every MsgType. Session threads read the active set
+ *   without locking, so .fix.filter builds a new set and publishes it with an
+ *   atomic swap. Replaced sets are retired rather than freed because a
+ *   session thread may still hold them; filters change rarely so the cost is
+ *   a few small allocations per call.
+ */
+class FilterSet
+{
+    public:
+    const TagFilter* find(const std::string& msgtype) const
+    {
+        auto found = filters.find(msgtype);
+        return found != filters.end() ? &found->second : nullptr;
+    }
+
+    static const FilterSet* active() { return current().load(std::memory_order_acquire); }
+
+    // replaces the filter for msgtype, an empty tag list drops the MsgType
+    static void set(const std::string& msgtype, const std::vector<int>& tags)
+    {
+        update([&](FilterSet& set) {
+            TagFilter filter;
+            filter.drop = tags.empty();
+            filter.add(35);
+            for (int tag : tags) filter.add(tag);
+            set.filters[msgtype] = filter;
+        });
+    }
+
+    // forwards every field of msgtype again
+    static void remove(const std::string& msgtype)
+    {
+        update([&](FilterSet& set) { set.filters.erase(msgtype); });
+    }
+
+    private:
+    static std::atomic<const FilterSet*>& current()
+    {
+        static std::atomic<const FilterSet*> set(nullptr);
+        return set;
+    }
+
+    template<typename F>
+    static void update(F change)
+    {
+        static std::mutex lock;
+        static std::vector<const FilterSet*> retired;
+        std::lock_guard<std::mutex> guard(lock);
+
+        const FilterSet* previous = active();
+        FilterSet* next = previous ? new FilterSet(*previous) : new FilterSet;
+        change(*next);
+
+        current().store(next->filters.empty() ? nullptr : next, std::memory_order_release);
+        if (previous) retired.push_back(previous);
+        if (next->filters.empty()) delete next;
+    }
+
+    std::unordered_map<std::string, TagFilter> filters;
+};
+
+#endif
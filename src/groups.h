@@ -0,0 +1,268 @@
+#ifndef KDBFIX_GROUPS_H
+#define KDBFIX_GROUPS_H
+
+#include <kx/k.h>
+
+#include "decoder.h"
+#include "columns.h"
+#include "filter.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* GroupLayout:
+ *   The fields of a repeating group as given in the spec, compiled once when
+ *   the spec is loaded. Each group decodes into a table with one column per
+ *   member field (in spec order) and one row per instance. A new instance
+ *   starts at the delimiter, the first field of the group. Nested groups are
+ *   general columns holding a table per row.
+ *
+ *   The layout of a message is a GroupLayout with no columns whose groups
+ *   are the top level repeating groups of that MsgType. Layouts never change
+ *   once loaded, so a group shared by several messages may share one.
+ */
+struct GroupLayout
+{
+    int delimiter = 0;
+    std::vector<int> tags;
+    std::vector<S> names;
+    std::vector<I> types;
+    std::unordered_map<int, size_t> columns;
+    std::unordered_map<int, std::shared_ptr<GroupLayout>> groups;
+
+    // the layout of the group counted by tag, nullptr if it is not a group
+    const GroupLayout* group(int tag) const
+    {
+        auto found = groups.find(tag);
+        return found != groups.end() ? found->second.get() : nullptr;
+    }
+
+    const size_t* column(int tag) const
+    {
+        auto found = columns.find(tag);
+        return found != columns.end() ? &found->second : nullptr;
+    }
+
+    void add(int tag, S name, I type)
+    {
+        if (columns.find(tag) != columns.end()) return;
+        if (tags.empty()) delimiter = tag;
+        columns[tag] = tags.size();
+        tags.push_back(tag);
+        names.push_back(name);
+        types.push_back(type);
+    }
+};
+
+/* GroupTable:
+ *   Message layouts by MsgType. Written while the spec is loaded on the q
+ *   thread and only read afterwards.
+ */
+class GroupTable
+{
+    public:
+    GroupLayout& message(const std::string& msgtype) { return messages[msgtype]; }
+
+    const GroupLayout* find(const std::string& msgtype) const
+    {
+        auto found = messages.find(msgtype);
+        return found != messages.end() ? &found->second : nullptr;
+    }
+
+    // marks tag as the count of a group in at least one message
+    void setcount(int tag)
+    {
+        if (tag < 0) return;
+        if ((size_t) tag >= counts.size()) counts.resize(tag + 1, false);
+        counts[tag] = true;
+    }
+
+    bool iscount(int tag) const { return (size_t) tag < counts.size() && counts[tag]; }
+
+    // passes each MsgType and its layout to f
+    template<typename F>
+    void each(F f) const
+    {
+        for (auto& message : messages) f(message.first, message.second);
+    }
+
+    template<typename F>
+    void each(F f)
+    {
+        for (auto& message : messages) f(message.first, message.second);
+    }
+
+    void clear() { messages.clear(); counts.clear(); }
+
+    private:
+    std::unordered_map<std::string, GroupLayout> messages;
+    std::vector<bool> counts;
+};
+
+/* MessageBuilder:
+ *   Builds the tag to value dictionary passed to q from fields given in wire
+ *   order, in one pass. The MsgType (35) selects the group layouts for the
+ *   rest of the message; the count field of a group is followed by its
+ *   instances, which are collected column by column and replace the count in
+ *   the dictionary with a table. A group ends at the first field that is not
+ *   one of its members. Filters apply to top level fields, a group is kept
+ *   or dropped with its count tag.
+ */
+class MessageBuilder
+{
+    public:
+    MessageBuilder(const TagTable& table, const GroupTable& groups, const TagFilter* filter)
+        : table(table), groups(groups), filter(filter), layout(nullptr),
+          keys(ktn(KJ, 0)), values(ktn(0, 0)) {}
+
+    MessageBuilder(const MessageBuilder&) = delete;
+    MessageBuilder& operator=(const MessageBuilder&) = delete;
+
+    ~MessageBuilder()
+    {
+        // only reached without finish() if decoding was abandoned
+        while (!frames.empty()) close(false);
+        if (keys) r0(keys);
+        if (values) r0(values);
+    }
+
+    void add(int tag, const char* value, size_t len)
+    {
+        while (!frames.empty()) {
+            Frame& frame = frames.back();
+            const size_t* column = frame.layout->column(tag);
+
+            if (tag == frame.layout->delimiter) {
+                newrow(frame);
+            } else if (!column || 0 == frame.rows) {
+                close(true);
+                continue;
+            }
+
+            set(frame, *column, tag, value, len);
+            return;
+        }
+
+        if (35 == tag) {
+            layout = groups.find(std::string(value, len));
+        }
+
+        bool keep = !filter || filter->has(tag);
+        const GroupLayout* group = layout ? layout->group(tag) : nullptr;
+
+        if (group) {
+            Frame frame(group, keep);
+            if (keep) {
+                J key = tag;
+                ja(&keys, &key);
+                jk(&values, ktn(0, 0));
+                frame.slot = values->n - 1;
+            }
+            frames.push_back(frame);
+        } else if (keep) {
+            J key = tag;
+            ja(&keys, &key);
+            jk(&values, table.decode(tag, value, len));
+        }
+    }
+
+    K finish()
+    {
+        while (!frames.empty()) close(true);
+
+        K x = xD(keys, values);
+        keys = values = (K) 0;
+        return x;
+    }
+
+    private:
+    // an open group, its table goes into the top level values at slot or,
+    // for a nested group, into row of column of the enclosing group
+    struct Frame
+    {
+        Frame(const GroupLayout* layout, bool keep)
+            : layout(layout), keep(keep), columns((K) 0), rows(0), slot(-1), parentcolumn(0), parentrow(0)
+        {
+            if (!keep) return;
+            columns = ktn(0, (J) layout->tags.size());
+            for (size_t c = 0; c < layout->tags.size(); c++) {
+                kK(columns)[c] = ktn(layout->types[c], 0);
+            }
+        }
+
+        const GroupLayout* layout;
+        bool keep;
+        K columns;
+        J rows;
+        J slot;
+        size_t parentcolumn;
+        J parentrow;
+    };
+
+    void newrow(Frame& frame)
+    {
+        frame.rows++;
+        if (!frame.keep) return;
+        for (size_t c = 0; c < frame.layout->tags.size(); c++) {
+            AppendColumnNull(&kK(frame.columns)[c], frame.layout->types[c]);
+        }
+    }
+
+    void set(Frame& frame, size_t column, int tag, const char* value, size_t len)
+    {
+        const GroupLayout* nested = frame.layout->group(tag);
+        if (nested) {
+            Frame child(nested, frame.keep);
+            child.parentcolumn = column;
+            child.parentrow = frame.rows - 1;
+            frames.push_back(child);
+            return;
+        }
+
+        if (!frame.keep) return;
+
+        K col = kK(frame.columns)[column];
+        I type = frame.layout->types[column];
+        K atom = table.decode(tag, value, len);
+        if (0 == type) r0(kK(col)[frame.rows - 1]);
+        SetColumnValue(col, type, frame.rows - 1, atom);
+        r0(atom);
+    }
+
+    // closes the innermost group, placing its table if it is kept
+    void close(bool place)
+    {
+        Frame frame = frames.back();
+        frames.pop_back();
+        if (!frame.keep) return;
+
+        K names = ktn(KS, (J) frame.layout->names.size());
+        for (size_t c = 0; c < frame.layout->names.size(); c++) {
+            kS(names)[c] = frame.layout->names[c];
+        }
+        K result = xT(xD(names, frame.columns));
+
+        if (!place) {
+            r0(result);
+        } else if (frame.slot >= 0) {
+            r0(kK(values)[frame.slot]);
+            kK(values)[frame.slot] = result;
+        } else {
+            K parent = kK(frames.back().columns)[frame.parentcolumn];
+            r0(kK(parent)[frame.parentrow]);
+            kK(parent)[frame.parentrow] = result;
+        }
+    }
+
+    const TagTable& table;
+    const GroupTable& groups;
+    const TagFilter* filter;
+    const GroupLayout* layout;
+    std::vector<Frame> frames;
+    K keys;
+    K values;
+};
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef KDBFIX_INTERN_H
+#define KDBFIX_INTERN_H
+
+#include <kx/k.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <vector>
+
+/* InternCache:
+ *   Symbols already interned by the decoding thread, in a small open
+ *   addressing table keyed by the raw bytes of the value. A hit hands back
+ *   the interned symbol without going to sn, which hashes into the global
+ *   sym pool under its lock; a miss interns with sn and remembers the
+ *   result. Each thread has its own cache, so with ThreadedSocket
+ *   connections each session has one, and no locking is needed. The table
+ *   does not grow: once it is three quarters full, or a probe finds no free
+ *   slot, a new value replaces the one in its home slot, so values seen
+ *   often stay cached whatever the cardinality of the rest.
+ */
+class InternCache
+{
+    public:
+    // the calling thread's cache
+    static InternCache& local()
+    {
+        static thread_local InternCache cache;
+        return cache;
+    }
+
+    S intern(const char* str, size_t len)
+    {
+        if (len > MAX_LENGTH) return miss(str, len);
+
+        uint32_t hash = hashof(str, len);
+        Slot* empty = nullptr;
+        for (size_t i = hash & MASK, probe = 0; probe < MAX_PROBE; i = (i + 1) & MASK, probe++) {
+            Slot& slot = slots[i];
+            if (!slot.symbol) {
+                empty = &slot;
+                break;
+            }
+            if (slot.hash == hash && slot.length == len && 0 == memcmp(slot.symbol, str, len)) {
+                bump(stats.hits);
+                return slot.symbol;
+            }
+        }
+
+        Slot* slot = empty;
+        if (!slot || entries >= SIZE / 4 * 3) {
+            slot = &slots[hash & MASK];
+            bump(stats.evictions);
+        } else {
+            stats.symbols.store(++entries, std::memory_order_relaxed);
+        }
+
+        slot->symbol = miss(str, len);
+        slot->hash = hash;
+        slot->length = (uint32_t) len;
+        return slot->symbol;
+    }
+
+    struct Stats
+    {
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::atomic<uint64_t> symbols{0};   // held in the table
+        std::atomic<uint64_t> evictions{0};
+    };
+
+    // passes the counters of every thread's cache to f, and those of
+    // threads that have exited summed as one
+    template<typename F>
+    static void each(F f)
+    {
+        std::lock_guard<std::mutex> guard(lock());
+        f(retired());
+        for (InternCache* cache : caches()) f(cache->stats);
+    }
+
+    private:
+    struct Slot
+    {
+        S symbol;
+        uint32_t hash;
+        uint32_t length;
+    };
+
+    static const size_t SIZE = 4096;
+    static const size_t MASK = SIZE - 1;
+    static const size_t MAX_PROBE = 16;
+    static const size_t MAX_LENGTH = 64;
+
+    InternCache() : slots(SIZE), entries(0)
+    {
+        std::lock_guard<std::mutex> guard(lock());
+        caches().insert(this);
+    }
+
+    ~InternCache()
+    {
+        std::lock_guard<std::mutex> guard(lock());
+        caches().erase(this);
+        Stats& total = retired();
+        total.hits += stats.hits.load();
+        total.misses += stats.misses.load();
+        total.evictions += stats.evictions.load();
+    }
+
+    // FNV-1a, the values are short
+    static uint32_t hashof(const char* str, size_t len)
+    {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < len; i++) hash = (hash ^ (unsigned char) str[i]) * 16777619u;
+        return hash;
+    }
+
+    // only this thread writes its counters, so no read-modify-write is needed
+    static void bump(std::atomic<uint64_t>& counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    S miss(const char* str, size_t len)
+    {
+        bump(stats.misses);
+        return sn((S) str, (I) len);
+    }
+
+    static std::mutex& lock()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::set<InternCache*>& caches()
+    {
+        static std::set<InternCache*> all;
+        return all;
+    }
+
+    static Stats& retired()
+    {
+        static Stats total;
+        return total;
+    }
+
+    std::vector<Slot> slots;
+    size_t entries;
+    Stats stats;
+};
+
+// the interned symbol for a value, through the calling thread's cache
+inline S internsymbol(const char* str, size_t len)
+{
+    return InternCache::local().intern(str, len);
+}
+
+#endif
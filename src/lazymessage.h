@@ -0,0 +1,144 @@
+#ifndef KDBFIX_LAZYMESSAGE_H
+#define KDBFIX_LAZYMESSAGE_H
+
+#include <kx/k.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "decoder.h"
+#include "rawdecoder.h"
+
+/* Lazy messages:
+ *   Delivered to q as a byte vector holding a compact index followed by the
+ *   raw message, so that only the fields a handler asks for are decoded.
+ *
+ *     LazyHeader                   magic, number of fields and spec id
+ *     LazyEntry[count]             tag, offset and length of each value
+ *     raw message bytes            offsets are relative to the first byte
+ *
+ *   Entries are in wire order and values are decoded from their offset and
+ *   length alone. q can slice or join the vector, so IsLazy checks that
+ *   every entry lies within the raw bytes before any is read.
+ */
+static const uint32_t LAZY_MAGIC = 0x5846514b;   // "KQFX"
+
+struct LazyHeader
+{
+    uint32_t magic;
+    uint32_t count;
+    uint32_t spec;
+};
+
+struct LazyEntry
+{
+    int32_t tag;
+    uint32_t offset;
+    uint32_t length;
+};
+
+// builds the lazy representation of a raw message, indexing only the fields
+// kept by the filter if one is given, (K) 0 if the message is malformed.
+// spec is recorded so the fields are later decoded as the session would.
+inline K IndexRaw(const char* msg, size_t len, const TagTable& table, uint32_t spec, const TagFilter* filter = nullptr)
+{
+    static thread_local std::vector<LazyEntry> entries;
+    entries.clear();
+
+    bool ok = TokeniseRaw(msg, len, table, [&](J tag, const char* value, size_t size) {
+        if (filter && !filter->has((int) tag)) return;
+        LazyEntry entry = { (int32_t) tag, (uint32_t) (value - msg), (uint32_t) size };
+        entries.push_back(entry);
+    });
+
+    if (!ok) return (K) 0;
+
+    size_t indexsize = sizeof(LazyHeader) + entries.size() * sizeof(LazyEntry);
+    K x = ktn(KG, (J) (indexsize + len));
+
+    LazyHeader header = { LAZY_MAGIC, (uint32_t) entries.size(), spec };
+    memcpy(kG(x), &header, sizeof(header));
+    memcpy(kG(x) + sizeof(header), entries.data(), entries.size() * sizeof(LazyEntry));
+    memcpy(kG(x) + indexsize, msg, len);
+
+    return x;
+}
+
+inline bool IsLazy(K x)
+{
+    if (KG != x->t || (size_t) x->n < sizeof(LazyHeader)) return false;
+
+    LazyHeader header;
+    memcpy(&header, kG(x), sizeof(header));
+    size_t indexsize = sizeof(LazyHeader) + (size_t) header.count * sizeof(LazyEntry);
+    if (LAZY_MAGIC != header.magic || (size_t) x->n < indexsize) return false;
+
+    uint64_t rawsize = (uint64_t) x->n - indexsize;
+    for (uint32_t i = 0; i < header.count; i++) {
+        LazyEntry entry;
+        memcpy(&entry, kG(x) + sizeof(LazyHeader) + i * sizeof(LazyEntry), sizeof(entry));
+        if ((uint64_t) entry.offset + entry.length > rawsize) return false;
+    }
+    return true;
+}
+
+inline uint32_t LazyCount(K x)
+{
+    LazyHeader header;
+    memcpy(&header, kG(x), sizeof(header));
+    return header.count;
+}
+
+inline uint32_t LazySpecId(K x)
+{
+    LazyHeader header;
+    memcpy(&header, kG(x), sizeof(header));
+    return header.spec;
+}
+
+inline LazyEntry LazyAt(K x, uint32_t i)
+{
+    LazyEntry entry;
+    memcpy(&entry, kG(x) + sizeof(LazyHeader) + i * sizeof(LazyEntry), sizeof(entry));
+    return entry;
+}
+
+inline const char* LazyRaw(K x)
+{
+    return (const char*) kG(x) + sizeof(LazyHeader) + LazyCount(x) * sizeof(LazyEntry);
+}
+
+// decodes the first occurrence of tag, (K) 0 when it is not present
+inline K LazyGet(K x, int tag, const TagTable& table)
+{
+    uint32_t count = LazyCount(x);
+    const char* raw = LazyRaw(x);
+
+    for (uint32_t i = 0; i < count; i++) {
+        LazyEntry entry = LazyAt(x, i);
+        if (entry.tag == tag) {
+            return table.decode(tag, raw + entry.offset, entry.length);
+        }
+    }
+
+    return (K) 0;
+}
+
+// decodes every field into the eager tag to value dictionary, including
+// repeating groups
+inline K LazyToDictionary(K x, const TagTable& table, const GroupTable& groups)
+{
+    uint32_t count = LazyCount(x);
+    const char* raw = LazyRaw(x);
+
+    MessageBuilder builder(table, groups, nullptr);
+    for (uint32_t i = 0; i < count; i++) {
+        LazyEntry entry = LazyAt(x, i);
+        builder.add(entry.tag, raw + entry.offset, entry.length);
+    }
+
+    return builder.finish();
+}
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef KDBFIX_LOGFORMAT_H
+#define KDBFIX_LOGFORMAT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+/* Binary session log format:
+ *   Written by AsyncLog and read back by logdump and .fix.readlog. A file
+ *   starts with the 8 byte magic and the session (a 32 bit length and the
+ *   text of the SessionID, empty for the global log). Each record follows as
+ *
+ *     uint8   type       LOG_INCOMING, LOG_OUTGOING or LOG_EVENT
+ *     uint32  length     bytes of text
+ *     int64   time       nanoseconds since 1970.01.01 UTC
+ *     char    text[length]
+ *
+ *   in host byte order, with no padding.
+ */
+static const char LOG_MAGIC[8] = { 'K', 'F', 'I', 'X', 'L', 'O', 'G', '1' };
+static const size_t LOG_RECORD_HEADER = 13;
+
+enum LogRecordType : uint8_t
+{
+    LOG_INCOMING = 1,
+    LOG_OUTGOING = 2,
+    LOG_EVENT = 3
+};
+
+// appends the framing for one record to out
+inline void writelogrecord(std::string& out, uint8_t type, int64_t time, const char* text, uint32_t length)
+{
+    char header[LOG_RECORD_HEADER];
+    header[0] = (char) type;
+    memcpy(header + 1, &length, sizeof(length));
+    memcpy(header + 5, &time, sizeof(time));
+    out.append(header, LOG_RECORD_HEADER);
+    out.append(text, length);
+}
+
+inline std::string logfileheader(const std::string& session)
+{
+    std::string header(LOG_MAGIC, sizeof(LOG_MAGIC));
+    uint32_t length = (uint32_t) session.size();
+    header.append((const char*) &length, sizeof(length));
+    header.append(session);
+    return header;
+}
+
+/* LogReader:
+ *   Reads a binary session log record by record. A record cut short at the
+ *   end of the file (the writer was stopped mid-batch) ends the log.
+ */
+class LogReader
+{
+    public:
+    explicit LogReader(const char* path) : file(fopen(path, "rb")), valid(false)
+    {
+        if (!file) return;
+
+        char magic[sizeof(LOG_MAGIC)];
+        uint32_t length;
+        if (1 != fread(magic, sizeof(magic), 1, file) || 0 != memcmp(magic, LOG_MAGIC, sizeof(magic))) return;
+        if (1 != fread(&length, sizeof(length), 1, file)) return;
+
+        session.resize(length);
+        valid = 0 == length || 1 == fread(&session[0], length, 1, file);
+    }
+
+    ~LogReader() { if (file) fclose(file); }
+
+    LogReader(const LogReader&) = delete;
+    LogReader& operator=(const LogReader&) = delete;
+
+    bool ok() const { return valid; }
+
+    bool next(uint8_t* type, int64_t* time, std::string& text)
+    {
+        if (!valid) return false;
+
+        char header[LOG_RECORD_HEADER];
+        uint32_t length;
+        if (1 != fread(header, LOG_RECORD_HEADER, 1, file)) return false;
+        *type = (uint8_t) header[0];
+        memcpy(&length, header + 1, sizeof(length));
+        memcpy(time, header + 5, sizeof(*time));
+
+        text.resize(length);
+        return 0 == length || 1 == fread(&text[0], length, 1, file);
+    }
+
+    std::string session;
+
+    private:
+    FILE* file;
+    bool valid;
+};
+
+#endif
@@ -0,0 +1,515 @@
+#ifndef KDBFIX_LOGLOADER_H
+#define KDBFIX_LOGLOADER_H
+
+#include <kx/k.h>
+
+#include "columns.h"
+#include "decoder.h"
+#include "groups.h"
+#include "logformat.h"
+#include "rawdecoder.h"
+#include "spec.h"
+#include "temporal.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* MappedLog:
+ *   A session log mapped read-only, either a FileLog messages file with one
+ *   "YYYYMMDD-HH:MM:SS.sss : message" line per message or a binary log
+ *   written with LogType=async. An empty file is a log with no messages.
+ */
+class MappedLog
+{
+    public:
+    explicit MappedLog(const std::string& path) : path(path), data(nullptr), size(0), opened(false)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (-1 == fd) return;
+
+        struct stat info;
+        opened = 0 == fstat(fd, &info);
+        if (opened && info.st_size > 0) {
+            void* p = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (MAP_FAILED == p) {
+                opened = false;
+            } else {
+                data = (const char*) p;
+                size = (size_t) info.st_size;
+                madvise(p, size, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+    }
+
+    ~MappedLog()
+    {
+        if (data) munmap((void*) data, size);
+    }
+
+    MappedLog(const MappedLog&) = delete;
+    MappedLog& operator=(const MappedLog&) = delete;
+
+    bool ok() const { return opened; }
+
+    bool binary() const
+    {
+        return size >= sizeof(LOG_MAGIC) && 0 == memcmp(data, LOG_MAGIC, sizeof(LOG_MAGIC));
+    }
+
+    // the first record of a binary log or the first line of a text log
+    const char* records() const
+    {
+        if (!binary()) return data;
+
+        uint32_t length;
+        const char* p = data + sizeof(LOG_MAGIC);
+        if ((size_t) (data + size - p) < sizeof(length)) return data + size;
+        memcpy(&length, p, sizeof(length));
+        p += sizeof(length);
+        return (size_t) (data + size - p) < length ? data + size : p + length;
+    }
+
+    const std::string path;
+    const char* data;
+    size_t size;
+
+    private:
+    bool opened;
+};
+
+/* LogChunk:
+ *   A range of one log starting and ending on a message boundary, decoded
+ *   by one worker with the spec of its log.
+ */
+struct LogChunk
+{
+    const char* begin;
+    const char* end;
+    bool binary;
+    const Spec* spec;
+};
+
+/* EachLoggedMessage:
+ *   Calls f(time, text, length) for each message in a chunk, with the time
+ *   it was logged as nanoseconds from 2000.01.01, until f returns false.
+ *   Lines of a text log that are not messages and the events of a binary
+ *   log are skipped.
+ */
+template<typename F>
+inline void EachLoggedMessage(const LogChunk& chunk, F f)
+{
+    const char* p = chunk.begin;
+
+    if (chunk.binary) {
+        while ((size_t) (chunk.end - p) >= LOG_RECORD_HEADER) {
+            uint32_t length;
+            int64_t time;
+            memcpy(&length, p + 1, sizeof(length));
+            memcpy(&time, p + 5, sizeof(time));
+
+            const char* text = p + LOG_RECORD_HEADER;
+            if ((size_t) (chunk.end - text) < length) return;
+
+            uint8_t type = (uint8_t) p[0];
+            p = text + length;
+            if (LOG_INCOMING != type && LOG_OUTGOING != type) continue;
+            if (!f(time - (J) KDB_EPOCH_DAYS * NANOS_PER_DAY, text, (size_t) length)) return;
+        }
+        return;
+    }
+
+    while (p < chunk.end) {
+        const char* eol = (const char*) memchr(p, '\n', (size_t) (chunk.end - p));
+        if (!eol) eol = chunk.end;
+
+        // the timestamp is followed by " : " and the message
+        const char* separator = p;
+        while (separator + 5 <= eol && !(' ' == separator[0] && ':' == separator[1] && ' ' == separator[2])) separator++;
+
+        const char* text = separator + 3;
+        if (text + 2 <= eol && '8' == text[0] && '=' == text[1]) {
+            const char* last = '\r' == eol[-1] ? eol - 1 : eol;
+            if (!f(parsetimestamp(p, (size_t) (separator - p)), text, (size_t) (last - text))) return;
+        }
+        p = eol + 1;
+    }
+}
+
+// the BeginString of the first message in a log, empty if it has none
+inline std::string LogBeginString(const MappedLog& log)
+{
+    std::string beginString;
+    LogChunk chunk = { log.records(), log.data + log.size, log.binary(), nullptr };
+
+    EachLoggedMessage(chunk, [&](J, const char* text, size_t length) {
+        if (length < 2 || '8' != text[0] || '=' != text[1]) return false;
+        const char* end = (const char*) memchr(text, SOH, length);
+        beginString.assign(text + 2, end ? (size_t) (end - text - 2) : length - 2);
+        return false;
+    });
+
+    return beginString;
+}
+
+/* SplitLog:
+ *   Appends chunks of about target bytes covering a log. Text logs are cut
+ *   at the first newline after each target offset. Binary records carry no
+ *   marker to resynchronise on, so their boundaries are found by walking
+ *   the record headers.
+ */
+inline void SplitLog(const MappedLog& log, const Spec* spec, size_t target, std::vector<LogChunk>& chunks)
+{
+    const char* begin = log.records();
+    const char* end = log.data + log.size;
+
+    if (log.binary()) {
+        const char* p = begin;
+        while ((size_t) (end - p) >= LOG_RECORD_HEADER) {
+            uint32_t length;
+            memcpy(&length, p + 1, sizeof(length));
+            if ((size_t) (end - p) - LOG_RECORD_HEADER < length) break;
+
+            p += LOG_RECORD_HEADER + length;
+            if ((size_t) (p - begin) >= target) {
+                chunks.push_back({ begin, p, true, spec });
+                begin = p;
+            }
+        }
+        if (p > begin) chunks.push_back({ begin, p, true, spec });
+        return;
+    }
+
+    while (begin < end) {
+        const char* cut = end;
+        if ((size_t) (end - begin) > target) {
+            const char* eol = (const char*) memchr(begin + target, '\n', (size_t) (end - begin - target));
+            if (eol) cut = eol + 1;
+        }
+        chunks.push_back({ begin, cut, false, spec });
+        begin = cut;
+    }
+}
+
+/* LoadTable:
+ *   The messages of one MsgType decoded from one chunk: a time column and a
+ *   column per tag in the order the tags were first seen, typed as in the
+ *   batched delivery tables. Every column is padded with nulls to one entry
+ *   per row.
+ */
+class LoadTable
+{
+    public:
+    LoadTable() : rows(0), times(ktn(KP, 0)) {}
+
+    ~LoadTable()
+    {
+        r0(times);
+        for (K column : columns) r0(column);
+    }
+
+    LoadTable(const LoadTable&) = delete;
+    LoadTable& operator=(const LoadTable&) = delete;
+
+    // the column of tag, -1 if it has not been seen
+    long find(int tag) const
+    {
+        if (tag >= 0 && (size_t) tag < slots.size()) return (long) slots[tag] - 1;
+        auto found = far.find(tag);
+        return found != far.end() ? (long) found->second : -1;
+    }
+
+    // the column of tag, added with a null for each earlier row if it is new
+    size_t column(int tag, const Spec& spec)
+    {
+        long found = find(tag);
+        if (found >= 0) return (size_t) found;
+
+        I type = ColumnType(spec, tag);
+        K column = ktn(type, rows);
+        for (J row = 0; row < rows; row++) SetColumnNull(column, type, row);
+
+        size_t c = columns.size();
+        tags.push_back(tag);
+        types.push_back(type);
+        columns.push_back(column);
+
+        // tags are dense below the user defined range, anything above is rare
+        if (tag >= 0 && tag < 65536) {
+            if ((size_t) tag >= slots.size()) slots.resize(tag + 1, 0);
+            slots[tag] = c + 1;
+        } else {
+            far[tag] = c;
+        }
+        return c;
+    }
+
+    void endrow(J time)
+    {
+        rows++;
+        ja(&times, &time);
+        for (size_t c = 0; c < columns.size(); c++) {
+            if (columns[c]->n < rows) AppendColumnNull(&columns[c], types[c]);
+        }
+    }
+
+    J rows;
+    K times;
+    std::vector<int> tags;
+    std::vector<I> types;
+    std::vector<K> columns;
+
+    private:
+    std::vector<size_t> slots;
+    std::unordered_map<int, size_t> far;
+};
+
+// the tables decoded from one chunk by MsgType, in the order first seen
+struct LoadResult
+{
+    std::vector<std::string> order;
+    std::unordered_map<std::string, std::unique_ptr<LoadTable>> tables;
+    size_t malformed = 0;
+
+    LoadTable& table(const std::string& msgtype)
+    {
+        auto& table = tables[msgtype];
+        if (!table) {
+            table.reset(new LoadTable);
+            order.push_back(msgtype);
+        }
+        return *table;
+    }
+};
+
+/* DecodeChunk:
+ *   Decodes every message of a chunk into the tables of result. Messages
+ *   without repeating groups are tokenised once and each field converted
+ *   straight into its column. Messages with a group go through the
+ *   MessageBuilder so the group arrives as a nested table, as it does in
+ *   .fix.onrecv. A tag repeated outside a group keeps its first value.
+ */
+inline void DecodeChunk(const LogChunk& chunk, const std::unordered_set<std::string>* msgtypes, LoadResult& result)
+{
+    struct Field
+    {
+        int tag;
+        const char* value;
+        size_t length;
+    };
+
+    const Spec& spec = *chunk.spec;
+    std::vector<Field> fields;
+    std::string msgtype;
+
+    EachLoggedMessage(chunk, [&](J time, const char* text, size_t length) {
+        fields.clear();
+        msgtype.clear();
+
+        bool ok = TokeniseRaw(text, length, spec.types, [&](J tag, const char* value, size_t size) {
+            if (35 == tag && msgtype.empty()) msgtype.assign(value, size);
+            fields.push_back({ (int) tag, value, size });
+        });
+        if (!ok || msgtype.empty()) {
+            result.malformed++;
+            return true;
+        }
+        if (msgtypes && !msgtypes->count(msgtype)) return true;
+
+        LoadTable& table = result.table(msgtype);
+        const GroupLayout* layout = spec.groups.find(msgtype);
+
+        bool grouped = false;
+        for (size_t i = 0; layout && !layout->groups.empty() && !grouped && i < fields.size(); i++) {
+            grouped = nullptr != layout->group(fields[i].tag);
+        }
+
+        if (!grouped) {
+            for (auto& field : fields) {
+                size_t c = table.column(field.tag, spec);
+                if (table.columns[c]->n > table.rows) continue;
+                AppendColumnField(&table.columns[c], table.types[c], spec.types, field.tag, field.value, field.length);
+            }
+        } else {
+            MessageBuilder builder(spec.types, spec.groups, nullptr);
+            for (auto& field : fields) builder.add(field.tag, field.value, field.length);
+
+            K message = builder.finish();
+            K keys = kK(message)[0];
+            K values = kK(message)[1];
+            for (J i = 0; i < keys->n; i++) {
+                size_t c = table.column((int) kJ(keys)[i], spec);
+                if (table.columns[c]->n > table.rows) continue;
+                AppendColumnAtom(&table.columns[c], table.types[c], kK(values)[i]);
+            }
+            r0(message);
+        }
+
+        table.endrow(time);
+        return true;
+    });
+}
+
+/* DecodeChunks:
+ *   Decodes the chunks on the calling thread and up to threads - 1 workers,
+ *   each taking the next undecoded chunk until none are left. Objects are
+ *   allocated on the workers and released on the q thread, so the caller
+ *   must have enabled that with setm(1). Results are in chunk order.
+ */
+inline void DecodeChunks(const std::vector<LogChunk>& chunks, const std::unordered_set<std::string>* msgtypes, int threads, std::vector<LoadResult>& results)
+{
+    results.clear();
+    results.resize(chunks.size());
+
+    std::atomic<size_t> next(0);
+    auto decode = [&] {
+        for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < chunks.size();) {
+            DecodeChunk(chunks[i], msgtypes, results[i]);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads && (size_t) t < chunks.size(); t++) {
+        workers.emplace_back([&] {
+            decode();
+            m9();
+        });
+    }
+
+    decode();
+    for (auto& worker : workers) worker.join();
+}
+
+// bytes per element of a column of type
+inline size_t ColumnWidth(I type)
+{
+    switch (type) {
+        case KI: case KD: case KT: return 4;
+        case KC: case KB: return 1;
+        default: return 8;
+    }
+}
+
+// the element at row of a typed column as an atom
+inline K ColumnAtom(K column, I type, J row)
+{
+    switch (type) {
+        case KF: return kf(kF(column)[row]);
+        case KI: return ki(kI(column)[row]);
+        case KD: return kd(kI(column)[row]);
+        case KT: return kt(kI(column)[row]);
+        case KC: return kc(kC(column)[row]);
+        case KB: return kb(kG(column)[row]);
+        case KP: return ktj(-KP, kJ(column)[row]);
+        case KJ: return kj(kJ(column)[row]);
+        case KS: return ks(kS(column)[row]);
+        default: return r1(kK(column)[row]);
+    }
+}
+
+/* MergeTables:
+ *   Joins the rows of each MsgType across the chunks, in chunk order, into
+ *   one table of time and every tag seen, named from the spec of the first
+ *   chunk holding that MsgType. A tag that two specs type differently
+ *   becomes a general column. Appends a table and its name (the message
+ *   name, as in .fix.onrecvbatch) per MsgType in the order first seen, and
+ *   releases the chunk tables.
+ */
+inline void MergeTables(std::vector<LoadResult>& results, const std::vector<LogChunk>& chunks, std::vector<S>& names, std::vector<K>& tables)
+{
+    std::vector<std::string> order;
+    std::unordered_map<std::string, std::vector<size_t>> parts;
+    for (size_t i = 0; i < results.size(); i++) {
+        for (auto& msgtype : results[i].order) {
+            auto& part = parts[msgtype];
+            if (part.empty()) order.push_back(msgtype);
+            part.push_back(i);
+        }
+    }
+
+    for (auto& msgtype : order) {
+        const std::vector<size_t>& part = parts[msgtype];
+        const Spec& spec = *chunks[part[0]].spec;
+
+        std::vector<int> tags;
+        std::vector<I> types;
+        std::unordered_map<int, size_t> index;
+        J total = 0;
+        for (size_t i : part) {
+            LoadTable& table = *results[i].tables[msgtype];
+            total += table.rows;
+            for (size_t c = 0; c < table.tags.size(); c++) {
+                auto found = index.find(table.tags[c]);
+                if (found == index.end()) {
+                    index[table.tags[c]] = tags.size();
+                    tags.push_back(table.tags[c]);
+                    types.push_back(table.types[c]);
+                } else if (types[found->second] != table.types[c]) {
+                    types[found->second] = 0;
+                }
+            }
+        }
+
+        K columnnames = ktn(KS, (J) tags.size() + 1);
+        K columns = ktn(0, (J) tags.size() + 1);
+
+        kS(columnnames)[0] = ss((S) "time");
+        kK(columns)[0] = ktn(KP, total);
+        J row = 0;
+        for (size_t i : part) {
+            LoadTable& table = *results[i].tables[msgtype];
+            memcpy(kJ(kK(columns)[0]) + row, kJ(table.times), (size_t) table.rows * sizeof(J));
+            row += table.rows;
+        }
+
+        for (size_t c = 0; c < tags.size(); c++) {
+            auto name = spec.tagnames.find(tags[c]);
+            std::string colname = name != spec.tagnames.end() ? name->second : "tag" + std::to_string(tags[c]);
+            kS(columnnames)[c + 1] = ss((S) colname.c_str());
+
+            I type = types[c];
+            K column = kK(columns)[c + 1] = ktn(type, total);
+            size_t width = ColumnWidth(type);
+
+            row = 0;
+            for (size_t i : part) {
+                LoadTable& table = *results[i].tables[msgtype];
+                long from = table.find(tags[c]);
+
+                if (from < 0) {
+                    for (J r = 0; r < table.rows; r++) SetColumnNull(column, type, row + r);
+                } else if (table.types[from] == type) {
+                    // general columns hand their items over rather than copying them
+                    K source = table.columns[from];
+                    memcpy(kG(column) + (size_t) row * width, kG(source), (size_t) table.rows * width);
+                    if (0 == type) source->n = 0;
+                } else {
+                    for (J r = 0; r < table.rows; r++) {
+                        kK(column)[row + r] = ColumnAtom(table.columns[from], table.types[from], r);
+                    }
+                }
+                row += table.rows;
+            }
+        }
+
+        auto name = spec.msgnames.find(msgtype);
+        names.push_back(ss((S) (name != spec.msgnames.end() ? name->second : msgtype).c_str()));
+        tables.push_back(xT(xD(columnnames, columns)));
+    }
+
+    results.clear();
+}
+
+#endif
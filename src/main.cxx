@@ -14,38 +14,150 @@
 #include <quickfix/SessionSettings.h>
 
 #include "socketpair.h"
+#include "channel.h"
+#include "decoder.h"
+#include "intern.h"
+#include "message.h"
+#include "rawdecoder.h"
+#include "capturelog.h"
+#include "decodepool.h"
+#include "lazymessage.h"
+#include "filter.h"
+#include "encoder.h"
+#include "template.h"
+#include "columns.h"
+#include "groups.h"
+#include "book.h"
+#include "orders.h"
+#include "stats.h"
+#include "spec.h"
+#ifndef WIN32
+#include "mmapstore.h"
+#include "asynclog.h"
+#include "logloader.h"
+#include "tickerplant.h"
+#endif
+#include "logformat.h"
 #include <kx/k.h>
 
 #include <config.h>
 #include <string.h>
-#include <pugixml.hpp>
 #include <unordered_map>
+#include <map>
 #include <string>
 #include <vector>
 #include <cstdlib>
 #include <cstring>
+#include <cctype>
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctime>
 #include <chrono>
 #include <iomanip>
 #include <algorithm>
+#include <memory>
+#include <thread>
+#include <unordered_set>
+#include <atomic>
+#include <set>
+
+#ifdef __linux__
+#include <sys/timerfd.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wdeprecated"
 
-std::string typeconvert(std::string s);
 std::string typedtostring(K x);
-void CreateTypeMap(void);
-K convertmsgtype(std::string field, std::string type);
-std::unordered_map<int,std::string> typemap;
 
+// specs by XML path, loaded on the q thread and kept for the life of the
+// process since session threads hold pointers to them
+static std::map<std::string, std::unique_ptr<Spec>> specs;
 
-int sockets[2];
+// loaded by LoadLibrary, used where no session is known (sending, tables)
+static const Spec* defaultSpec = nullptr;
+
+// every spec loaded, indexed by the id lazy messages carry
+static std::vector<const Spec*> specsById;
+
+// the spec of the session last created for each BeginString, used by
+// .fix.loadlog for logs given no spec
+static std::unordered_map<std::string, const Spec*> specsByVersion;
+
+// how decoded messages are handed to the q main thread
+enum Transport { TRANSPORT_SOCKET, TRANSPORT_RING };
+
+// messages delivered per wakeup of one session before the q thread moves on
+static const size_t DRAIN_LIMIT = 256;
+
+// batched delivery to .fix.onrecvbatch for the sessions of an engine with
+// BatchMode=Y, only used on the q thread. Latency is in microseconds.
+struct Batch
+{
+    size_t size = 1000;
+    long latency = 0;
+    int timer = -1;
+    std::vector<K> pending;
+    std::vector<S> sessions;
+    std::vector<const Spec*> specs;
+    std::chrono::steady_clock::time_point since;
+};
+
+// per session state, created in onCreate before the session threads start.
+// Each session has its own channel (ring) or socket pair (socket) registered
+// with sd1, so .fix.onrecv knows where a message came from.
+struct SessionContext
+{
+    S key = nullptr;
+    Channel* channel = nullptr;
+    int sockets[2] = { -1, -1 };
+    BookSet* books = nullptr;
+    SessionStats* stats = nullptr;
+    std::atomic<const Spec*> spec{nullptr};     // replaced by .fix.symbols
+    std::string specPath;
+    SpecOptions specOptions;
+    bool rawDecode = false;
+    bool lazyDecode = false;
+    bool trackOrders = false;
+    bool orderTransitions = false;
+    int conflateTag = 55;
+    std::set<std::string> conflateTypes{ "W", "X" };  // ConflateMsgTypes
+    int cpu = -1;                               // CpuAffinity
+    ReorderWindow* window = nullptr;            // DecodePool
+    bool conflate = false;                      // QueuePolicy=conflate
+    Batch* batch = nullptr;                     // the engine's, when BatchMode=Y
+};
+
+// sessions by the descriptor registered with sd1, only used on the q thread
+static std::unordered_map<int, SessionContext*> sessionsByFd;
+
+// sessions with BusyPoll=Y, drained by .fix.poll rather than sd1
+static std::vector<SessionContext*> polledSessions;
+
+// orders of every session with OrderCache=Y
+static OrderStore orderStore;
+
+// set once any session has Stats=Y, until then sends skip the clock reads
+static bool timedSends = false;
+
+// batches by their BatchLatency timer, only used on the q thread
+static std::unordered_map<int, Batch*> batchesByTimer;
+
+static void FlushBatch(Batch* batch, bool force);
+
+extern "C" K RecieveRing(I x);
+extern "C" K RecieveData(I x);
+extern "C" K BookTimerFired(I x);
+extern "C" K BatchTimerFired(I x);
 
 class FixEngineApplication : public FIX::Application
 {
     public:
+    explicit FixEngineApplication(const FIX::SessionSettings& settings) : settings(settings) {}
+    ~FixEngineApplication();
+
     void onCreate(const FIX::SessionID& sessionID);
     void onLogon(const FIX::SessionID& sessionID);
     void onLogout(const FIX::SessionID& sessionID);
@@ -55,183 +167,1789 @@ class FixEngineApplication : public FIX::Application
     void toApp(FIX::Message& message, const FIX::SessionID& sessionID) throw (FIX::DoNotSend);
     void fromApp(const FIX::Message& message, const FIX::SessionID& sessionID)
         throw (FIX::FieldNotFound, FIX::IncorrectDataFormat, FIX::IncorrectTagValue, FIX::UnsupportedMessageType);
+
+    SessionContext* find(const FIX::SessionID& sessionID) const;
+
+    Transport transport = TRANSPORT_SOCKET;
+    size_t ringSize = 65536;
+
+    // set when BatchMode=Y, shared by the engine's sessions
+    std::unique_ptr<Batch> batch;
+
+#ifndef WIN32
+    // set when TickerplantPort is, stopped after the sessions
+    std::unique_ptr<TickerplantPublisher> publisher;
+#endif
+
+    // set when DecodeThreads is, for the sessions with DecodePool=Y
+    std::unique_ptr<DecodePool> pool;
+
+    // written by onCreate while the engine is constructed on the q thread,
+    // read-only once the session threads start
+    std::map<FIX::SessionID, SessionContext*> sessions;
+
+    private:
+    const FIX::SessionSettings& settings;
 };
 
-static void FillFromIterators(FIX::FieldMap::Fields::const_iterator begin, FIX::FieldMap::Fields::const_iterator end, K* keys, K* values)
+// frames a message as its length, its trace and the serialised bytes
+static void WriteToSocket(K x, int fd, const Trace& trace)
+{
+    static thread_local std::vector<char> buffer;
+
+    K bytes = b9(-1, x);
+    r0(x);
+
+    buffer.resize(sizeof(J) + sizeof(Trace) + (size_t) bytes->n);
+    memcpy(buffer.data(), (char*) &bytes->n, sizeof(J));
+    memcpy(buffer.data() + sizeof(J), &trace, sizeof(Trace));
+    memcpy(buffer.data() + sizeof(J) + sizeof(Trace), kG(bytes), (size_t) bytes->n);
+ 
+    send(fd, buffer.data(), (int) buffer.size(), 0);
+    r0(bytes);
+}
+
+SessionContext* FixEngineApplication::find(const FIX::SessionID& sessionID) const
+{
+    auto found = sessions.find(sessionID);
+    return found != sessions.end() ? found->second : nullptr;
+}
+
+// MsgType and the value of the session's ConflateTag, empty if the MsgType
+// is not one of its ConflateMsgTypes or the tag is not set, so that the
+// message is never conflated
+static std::string ConflationKey(const FIX::Message* message, const SessionContext* context)
+{
+    if (!message || !message->getHeader().isSetField(35) || !message->isSetField(context->conflateTag)) {
+        return std::string();
+    }
+
+    const std::string& msgtype = message->getHeader().getField(35);
+    if (!context->conflateTypes.count(msgtype)) {
+        return std::string();
+    }
+
+    return msgtype + '\001' + message->getField(context->conflateTag);
+}
+
+// pins the calling session thread to the session's CpuAffinity core, the
+// first time the thread delivers a message of that session
+static void PinSessionThread(const SessionContext* context)
+{
+#ifdef __linux__
+    static thread_local int pinned = -1;
+    if (!context || context->cpu < 0 || pinned == context->cpu) return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(context->cpu, &set);
+    if (0 != pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+        std::cout << "unable to pin " << context->key << " to core " << context->cpu << std::endl;
+    }
+    pinned = context->cpu;
+#endif
+}
+
+// starts the trace of an inbound message on a session with Stats=Y
+static Trace BeginTrace(const FIX::Message& message, SessionContext* context)
+{
+    Trace trace;
+    if (!context || !context->stats) return trace;
+
+    trace.entered = monotonicnanos();
+    trace.arrived = CaptureLog::arrived();
+    CaptureLog::arrived() = 0;
+
+    const FIX::Header& header = message.getHeader();
+    if (header.isSetField(35)) trace.stats = context->stats->find(header.getField(35));
+
+    return trace;
+}
+
+// hands x to q, key() is the conflation key should the channel conflate
+template<typename F>
+static void Deliver(K x, SessionContext* context, Trace trace, F key)
+{
+    if (trace.stats) {
+        trace.enqueued = monotonicnanos();
+        if (trace.arrived) trace.stats->stages[STAGE_PARSE].record(trace.entered - trace.arrived);
+        trace.stats->stages[STAGE_DECODE].record(trace.enqueued - trace.entered);
+    }
+
+    if (!context) {
+        r0(x);
+    } else if (context->channel) {
+        context->channel->push(x, trace, key);
+    } else {
+        WriteToSocket(x, context->sockets[0], trace);
+    }
+}
+
+static void Deliver(K x, SessionContext* context, const FIX::Message* message = nullptr, Trace trace = Trace())
+{
+    Deliver(x, context, trace, [&] { return ConflationKey(message, context); });
+}
+
+// the filter configured with .fix.filter for this message, if any
+static const TagFilter* FindFilter(const FIX::Message& message)
+{
+    const FilterSet* filters = FilterSet::active();
+    const FIX::Header& header = message.getHeader();
+    if (!filters || !header.isSetField(35)) {
+        return nullptr;
+    }
+
+    return filters->find(header.getField(35));
+}
+
+// applies market data snapshots and incremental refreshes to the session's
+// books, false for any other message
+static bool ApplyToBooks(const FIX::Message& message, BookSet* books, const Spec& spec)
+{
+    const FIX::Header& header = message.getHeader();
+    if (!header.isSetField(35)) return false;
+
+    const std::string& msgtype = header.getField(35);
+    if ("W" != msgtype && "X" != msgtype) return false;
+
+    const GroupLayout* layout = spec.groups.find(msgtype);
+    const GroupLayout* entries = layout ? layout->group(268) : nullptr;
+    BookUpdate update("W" == msgtype, entries ? entries->delimiter : "W" == msgtype ? 269 : 279);
+
+    WalkFields(message, [&](int tag, const char* value, size_t len) { update.add(tag, value, len); });
+    books->apply(update);
+
+    return true;
+}
+
+// updates the order cache from an ExecutionReport, false if the report left
+// the OrdStatus unchanged and the session only forwards transitions
+static bool TrackReceived(const FIX::Message& message, SessionContext* context)
+{
+    const FIX::Header& header = message.getHeader();
+    if (!header.isSetField(35) || "8" != header.getField(35)) return true;
+
+    OrderEvent event;
+    WalkFields(message, [&](int tag, const char* value, size_t len) { event.add(tag, value, len); });
+
+    return orderStore.received(context->key, event) || !context->orderTransitions;
+}
+
+// decodes straight from the captured wire text when the session asks for it
+// and the capture is for this message, otherwise from the parsed message
+static K Decode(const FIX::Message& message, SessionContext* context, const TagFilter* filter)
+{
+    const Spec& spec = context ? *context->spec : *defaultSpec;
+    if (!context || !(context->rawDecode || context->lazyDecode)) {
+        return ConvertToDictionary(message, spec.types, spec.groups, filter);
+    }
+
+    std::string& raw = CaptureLog::incoming();
+    const FIX::Header& header = message.getHeader();
+    bool captured = !raw.empty() && header.isSetField(34) && RawSeqNum(raw) == atol(header.getField(34).c_str());
+
+    K x = (K) 0;
+    if (context->lazyDecode) {
+        if (!captured) raw = message.toString();
+        x = IndexRaw(raw.data(), raw.size(), spec.types, spec.id, filter);
+    } else if (captured) {
+        x = DecodeRaw(raw.data(), raw.size(), spec.types, spec.groups, filter);
+    }
+    raw.clear();
+
+    return x ? x : ConvertToDictionary(message, spec.types, spec.groups, filter);
+}
+
+// decodes a message of a session with DecodePool=Y on a pool worker, from
+// the wire text as RawDecode does
+static K DecodePooled(DecodeTask& task)
+{
+    const Spec& spec = *task.spec;
+    K x = task.lazy ? IndexRaw(task.raw.data(), task.raw.size(), spec.types, spec.id, task.filter)
+                    : DecodeRaw(task.raw.data(), task.raw.size(), spec.types, spec.groups, task.filter);
+    if (x) return x;
+
+    try {
+        FIX::Message message(task.raw, false);
+        return ConvertToDictionary(message, spec.types, spec.groups, task.filter);
+    } catch (std::exception&) {
+        return (K) 0;
+    }
+}
+
+// queues a message of a session with DecodePool=Y for the pool, numbered
+// in the order the session thread received it
+static void SubmitDecode(DecodePool& pool, const FIX::Message& message, SessionContext* context,
+    const TagFilter* filter, const Trace& trace)
+{
+    DecodeTask task;
+    std::string& raw = CaptureLog::incoming();
+    const FIX::Header& header = message.getHeader();
+    if (!raw.empty() && header.isSetField(34) && RawSeqNum(raw) == atol(header.getField(34).c_str())) {
+        task.raw.swap(raw);
+    } else {
+        message.toString(task.raw);
+    }
+    raw.clear();
+
+    task.window = context->window;
+    task.seq = context->window->issue();
+    task.spec = context->spec;
+    task.filter = filter;
+    task.lazy = context->lazyDecode;
+    task.trace = trace;
+    if (context->conflate) task.key = ConflationKey(&message, context);
+    pool.submit(task);
+}
+
+// the overflow selected with QueuePolicy, nullptr to block while the ring
+// is full
+static Overflow* CreateOverflow(const FIX::Dictionary& dict, const FIX::SessionID& sessionID)
+{
+    std::string policy = dict.has("QueuePolicy") ? dict.getString("QueuePolicy") : "block";
+
+    if ("conflate" == policy) {
+        return new ConflationQueue;
+    }
+
+    if ("spill" == policy) {
+#ifndef WIN32
+        std::string name = sessionID.toString();
+        std::replace_if(name.begin(), name.end(), [](char c) { return !isalnum((unsigned char) c) && '.' != c; }, '_');
+        std::string directory = dict.has("SpillPath") ? dict.getString("SpillPath") : ".";
+        return new SpillFile(directory + "/" + name + ".spill");
+#else
+        std::cout << "QueuePolicy=spill is not supported on Windows" << std::endl;
+        return nullptr;
+#endif
+    }
+
+    if ("block" != policy) {
+        std::cout << "unknown QueuePolicy " << policy << ", using block" << std::endl;
+    }
+
+    return nullptr;
+}
+
+// the spec at path, loaded from its cache on first use, nullptr if the XML
+// cannot be read. With options it is a copy with those changes, kept
+// alongside the plain spec.
+static const Spec* FindSpec(const std::string& path, const SpecOptions& options = SpecOptions())
+{
+    std::string key = path + options.key();
+    auto found = specs.find(key);
+    if (found != specs.end()) return found->second.get();
+
+    std::unique_ptr<Spec> spec(new Spec);
+    if (options.empty()) {
+        if (!LoadSpec(path, *spec)) return nullptr;
+    } else {
+        const Spec* plain = FindSpec(path);
+        if (!plain) return nullptr;
+        *spec = *plain;
+        ApplySpecOptions(*spec, options);
+    }
+
+    spec->id = (uint32_t) specsById.size();
+    specsById.push_back(spec.get());
+    return (specs[key] = std::move(spec)).get();
+}
+
+// spec/FIX44.xml for FIX.4.4, spec/FIX50SP2.xml for FIX.5.0SP2 or the
+// ApplVerID enumeration 9
+static std::string SpecFile(const std::string& version)
+{
+    static const char* applverids[] = { "FIX27", "FIX30", "FIX40", "FIX41", "FIX42", "FIX43", "FIX44", "FIX50", "FIX50SP1", "FIX50SP2" };
+
+    char* end;
+    long id = strtol(version.c_str(), &end, 10);
+    if (!version.empty() && '\0' == *end && id >= 0 && id < 10) {
+        return std::string("spec/") + applverids[id] + ".xml";
+    }
+
+    std::string name = version;
+    name.erase(std::remove(name.begin(), name.end(), '.'), name.end());
+    return "spec/" + name + ".xml";
+}
+
+// the symbol tags set with .fix.symbols, in place of each session's
+// SymbolTags while symbolOverride is set
+static bool symbolOverride = false;
+static std::set<int> symbolTags;
+
+// the spec at the session's path with its options, and .fix.symbols
+static const Spec* OptionsSpec(const SessionContext* context)
+{
+    if (!symbolOverride) return FindSpec(context->specPath, context->specOptions);
+
+    SpecOptions options = context->specOptions;
+    options.symbols = symbolTags;
+    return FindSpec(context->specPath, options);
+}
+
+/* SessionSpec:
+ *   The spec a session's messages are decoded with. That is its
+ *   DataDictionary, or AppDataDictionary for FIXT.1.1, when one is set, and
+ *   otherwise the spec in spec/ named after the BeginString or, for
+ *   FIXT.1.1, the DefaultApplVerID. Falls back to the spec loaded with the
+ *   library if that cannot be read. FixedPoint and SymbolTags are applied
+ *   to either.
+ */
+static const Spec* SessionSpec(const FIX::Dictionary& dict, const FIX::SessionID& sessionID, SessionContext* context)
+{
+    const std::string& beginString = sessionID.getBeginString().getString();
+    bool fixt = 0 == beginString.compare(0, 4, "FIXT");
+
+    std::string path;
+    if (!fixt && dict.has("DataDictionary")) {
+        path = dict.getString("DataDictionary");
+    } else if (fixt && dict.has("AppDataDictionary")) {
+        path = dict.getString("AppDataDictionary");
+    } else {
+        path = SpecFile(fixt && dict.has("DefaultApplVerID") ? dict.getString("DefaultApplVerID") : beginString);
+    }
+
+    SpecOptions& options = context->specOptions;
+    if (dict.has("FixedPoint") && !ParseScales(dict.getString("FixedPoint"), options.scales)) {
+        std::cout << "invalid FixedPoint for " << sessionID.toString() << ", expected tag:scale,..." << std::endl;
+        options.scales.clear();
+    }
+    if (dict.has("SymbolTags") && !ParseTags(dict.getString("SymbolTags"), options.symbols)) {
+        std::cout << "invalid SymbolTags for " << sessionID.toString() << ", expected tag,..." << std::endl;
+        options.symbols.clear();
+    }
+
+    context->specPath = path;
+    if (!FindSpec(path)) {
+        std::cout << "unable to load " << path << " for " << sessionID.toString() << ", using " << defaultSpec->path << std::endl;
+        context->specPath = defaultSpec->path;
+    }
+
+    const Spec* spec = OptionsSpec(context);
+    specsByVersion[beginString] = spec;
+    return spec;
+}
+
+void FixEngineApplication::onCreate(const FIX::SessionID& sessionID)
+{
+    // sessions are created on the q thread while the engine is constructed,
+    // so the session map is read-only by the time the session threads start
+    if (sessions.find(sessionID) != sessions.end()) {
+        return;
+    }
+
+    const FIX::Dictionary& dict = settings.get(sessionID);
+    Overflow* overflow = TRANSPORT_RING == transport ? CreateOverflow(dict, sessionID) : nullptr;
+    if (TRANSPORT_SOCKET == transport && dict.has("QueuePolicy") && "block" != dict.getString("QueuePolicy")) {
+        std::cout << "QueuePolicy requires TransportType=ring" << std::endl;
+    }
+
+    auto context = new SessionContext;
+    context->key = ss((S) sessionID.toString().c_str());
+    context->spec = SessionSpec(dict, sessionID, context);
+    context->rawDecode = dict.has("RawDecode") && dict.getBool("RawDecode");
+    context->lazyDecode = dict.has("LazyDecode") && dict.getBool("LazyDecode") && !batch;
+    context->batch = batch.get();
+    context->trackOrders = dict.has("OrderCache") && dict.getBool("OrderCache");
+    context->orderTransitions = context->trackOrders && dict.has("OrderTransitions") && dict.getBool("OrderTransitions");
+    if (dict.has("ConflateTag")) {
+        context->conflateTag = dict.getInt("ConflateTag");
+    }
+    if (dict.has("ConflateMsgTypes")) {
+        const std::string types = dict.getString("ConflateMsgTypes");
+        context->conflateTypes.clear();
+        for (size_t at = 0; at <= types.size(); ) {
+            size_t end = std::min(types.find(',', at), types.size());
+            if (end > at) context->conflateTypes.insert(types.substr(at, end - at));
+            at = end + 1;
+        }
+    }
+    if (dict.has("Stats") && dict.getBool("Stats")) {
+        context->stats = new SessionStats;
+        timedSends = true;
+    }
+    if (dict.has("CpuAffinity")) {
+#ifdef __linux__
+        int cpu = dict.getInt("CpuAffinity");
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            context->cpu = cpu;
+        } else {
+            std::cout << "invalid CpuAffinity for " << sessionID.toString() << std::endl;
+        }
+#else
+        std::cout << "CpuAffinity is only supported on Linux" << std::endl;
+#endif
+    }
+
+    context->conflate = overflow && overflow->keyed();
+    if (dict.has("DecodePool") && dict.getBool("DecodePool")) {
+        if (pool) {
+            context->window = new ReorderWindow([context](K x, Trace& trace, const std::string& key) {
+                Deliver(x, context, trace, [&] { return key; });
+            });
+        } else {
+            std::cout << "DecodePool requires DecodeThreads" << std::endl;
+        }
+    }
+
+    bool polled = dict.has("BusyPoll") && dict.getBool("BusyPoll");
+    if (polled && TRANSPORT_RING != transport) {
+        std::cout << "BusyPoll requires TransportType=ring" << std::endl;
+    }
+
+    if (TRANSPORT_RING == transport && polled) {
+        context->channel = new Channel(ringSize, overflow, true);
+        polledSessions.push_back(context);
+    } else if (TRANSPORT_RING == transport) {
+        context->channel = new Channel(ringSize, overflow);
+        sessionsByFd[context->channel->fd()] = context;
+        sd1(context->channel->fd(), RecieveRing);
+    } else {
+        dumb_socketpair(context->sockets, 0);
+        sessionsByFd[context->sockets[1]] = context;
+        sd1(context->sockets[1], RecieveData);
+    }
+
+    // market data is applied to books on the session thread when BookDepth is set
+    if (dict.has("BookDepth") && dict.getInt("BookDepth") > 0) {
+#ifdef __linux__
+        long interval = dict.has("BookInterval") ? dict.getInt("BookInterval") : 0;
+        context->books = new BookSet((size_t) dict.getInt("BookDepth"), interval);
+        sessionsByFd[context->books->fd()] = context;
+        sd1(context->books->fd(), BookTimerFired);
+#else
+        std::cout << "BookDepth is only supported on Linux" << std::endl;
+#endif
+    }
+
+    sessions[sessionID] = context;
+}
+
+// called on the q thread once the session threads have stopped, anything
+// still queued for q is discarded
+FixEngineApplication::~FixEngineApplication()
+{
+    // the workers deliver what they hold before the channels go
+    pool.reset();
+
+    // messages from the stopped sessions that are waiting for a batch
+    if (batch) {
+        FlushBatch(batch.get(), true);
+        if (-1 != batch->timer) {
+            batchesByTimer.erase(batch->timer);
+            sd0(batch->timer);
+        }
+    }
+
+    for (auto& session : sessions) {
+        SessionContext* context = session.second;
+
+        if (context->channel && context->channel->polled) {
+            polledSessions.erase(std::remove(polledSessions.begin(), polledSessions.end(), context), polledSessions.end());
+            context->channel->poll([](K x, const Trace&) { r0(x); }, SIZE_MAX);
+            delete context->channel;
+        } else if (context->channel) {
+            sessionsByFd.erase(context->channel->fd());
+            sd0(context->channel->fd());
+            context->channel->drain([](K x, const Trace&) { r0(x); });
+            delete context->channel;
+        } else {
+            sessionsByFd.erase(context->sockets[1]);
+            sd0(context->sockets[1]);
+            close(context->sockets[0]);
+        }
+
+        if (context->books) {
+            sessionsByFd.erase(context->books->fd());
+            sd0(context->books->fd());
+            delete context->books;
+        }
+
+        delete context->window;
+        delete context->stats;
+        delete context;
+    }
+}
+
+void FixEngineApplication::onLogon(const FIX::SessionID& sessionID)
+{
+
+}
+
+void FixEngineApplication::onLogout(const FIX::SessionID& sessionID)
+{
+
+}
+
+void FixEngineApplication::toAdmin(FIX::Message& message, const FIX::SessionID& sessionID)
+{
+
+}
+
+// the session a sendToTarget on this thread went to, for its send stats
+static SessionContext*& SendingContext()
+{
+    static thread_local SessionContext* context = nullptr;
+    return context;
+}
+
+// every outbound application message passes through here, whether it was
+// sent with .fix.send, .fix.sendt or .fix.sendbatch
+void FixEngineApplication::toApp(FIX::Message& message, const FIX::SessionID& sessionID) throw (FIX::DoNotSend)
 {
-    for (auto it = begin; it != end; it++) {
-        J tag = (J) it->getTag();
-        auto str = it->getString().c_str();
+    auto context = find(sessionID);
+    if (context && context->stats) SendingContext() = context;
+    if (!context || !context->trackOrders) return;
+
+    const FIX::Header& header = message.getHeader();
+    if (!header.isSetField(35)) return;
+
+    const std::string& msgtype = header.getField(35);
+    if ("D" != msgtype && "G" != msgtype && "F" != msgtype) return;
+
+    OrderEvent event;
+    WalkFields(message, [&](int tag, const char* value, size_t len) { event.add(tag, value, len); });
+    if (!event.possdup) orderStore.sent(context->key, msgtype[0], event);
+}
+
+void FixEngineApplication::fromAdmin(const FIX::Message& message, const FIX::SessionID& sessionID) throw (FIX::FieldNotFound, FIX::IncorrectDataFormat, FIX::IncorrectTagValue, FIX::RejectLogon)
+{
+    CaptureLog::incoming().clear();
+
+    auto context = find(sessionID);
+    PinSessionThread(context);
+    Trace trace = BeginTrace(message, context);
+
+    auto filter = FindFilter(message);
+    if (filter && filter->drop) return;
+
+    const Spec& spec = context ? *context->spec : *defaultSpec;
+    K x = ConvertToDictionary(message, spec.types, spec.groups, filter);
+
+    // in order with the application messages the pool is decoding
+    if (context && context->window) {
+        std::string key = context->conflate ? ConflationKey(&message, context) : std::string();
+        context->window->complete(context->window->issue(), x, trace, key);
+        return;
+    }
+
+    Deliver(x, context, &message, trace);
+}
+
+#ifndef WIN32
+// queues the fields of a MsgType set with .fix.publish for the tickerplant
+static void Publish(const FIX::Message& message, const SessionContext* context, TickerplantPublisher& publisher)
+{
+    const PublishSet* set = PublishSet::active();
+    const FIX::Header& header = message.getHeader();
+    if (!set || !header.isSetField(35)) return;
+
+    const PublishEntry* entry = set->find(header.getField(35));
+    if (!entry) return;
+
+    static thread_local std::vector<PublishField> fields;
+    fields.clear();
+    for (int tag : entry->tags) {
+        const FIX::FieldMap& map = header.isSetField(tag) ? (const FIX::FieldMap&) header : message;
+        if (map.isSetField(tag)) {
+            const std::string& value = map.getField(tag);
+            fields.push_back({ value.data(), (int32_t) value.size() });
+        } else {
+            fields.push_back({ nullptr, -1 });
+        }
+    }
+
+    publisher.push(entry, context ? context->spec.load(std::memory_order_acquire) : defaultSpec, fields);
+}
+#endif
+
+void FixEngineApplication::fromApp(const FIX::Message& message, const FIX::SessionID& sessionID) throw (FIX::FieldNotFound, FIX::IncorrectDataFormat, FIX::IncorrectTagValue, FIX::UnsupportedMessageType)
+{
+    auto context = find(sessionID);
+    PinSessionThread(context);
+    Trace trace = BeginTrace(message, context);
+
+#ifndef WIN32
+    if (publisher) Publish(message, context, *publisher);
+#endif
+
+    if (context && context->books && ApplyToBooks(message, context->books, *context->spec)) {
+        CaptureLog::incoming().clear();
+        return;
+    }
+
+    if (context && context->trackOrders && !TrackReceived(message, context)) {
+        CaptureLog::incoming().clear();
+        return;
+    }
+
+    auto filter = FindFilter(message);
+    if (filter && filter->drop) {
+        CaptureLog::incoming().clear();
+        return;
+    }
+
+    if (context && context->window) {
+        SubmitDecode(*pool, message, context, filter, trace);
+        return;
+    }
+
+    Deliver(Decode(message, context, filter), context, &message, trace);
+}
+
+#pragma GCC diagnostic pop
+
+// the tag for a table column named by field name, tagNNN or NNN, -1 if unknown
+static int ColumnTag(S name)
+{
+    const char* digits = 0 == strncmp(name, "tag", 3) ? name + 3 : name;
+    char* end;
+    long tag = strtol(digits, &end, 10);
+    if (end != digits && '\0' == *end) return (int) tag;
+
+    auto found = defaultSpec->tagnumbers.find(name);
+    return found != defaultSpec->tagnumbers.end() ? found->second : -1;
+}
+
+/* AddGroup:
+ *   Adds a repeating group given as a table to map, one instance per row in
+ *   column order so that the first column is the delimiter. Null values are
+ *   left out of their instance and general columns may hold nested groups
+ *   as tables. Returns false if a column cannot be encoded.
+ */
+static bool AddGroup(FIX::FieldMap& map, int tag, K table)
+{
+    K names = kK(table->k)[0];
+    K columns = kK(table->k)[1];
+    if (KS != names->t) return false;
+    if (0 == names->n) return true;
+
+    J rows = kK(columns)[0]->n;
+    std::vector<int> order((size_t) names->n + 1, 0);
+    std::vector<std::vector<std::string>> text((size_t) names->n);
+    std::vector<bool> nested((size_t) names->n, false);
+
+    for (J c = 0; c < names->n; c++) {
+        K column = kK(columns)[c];
+        order[c] = ColumnTag(kS(names)[c]);
+        if (order[c] < 0) return false;
+
+        nested[c] = 0 == column->t && rows > 0 && XT == kK(column)[0]->t;
+        if (!nested[c] && !encodecolumn(column, text[c])) return false;
+    }
+
+    for (J row = 0; row < rows; row++) {
+        FIX::Group group(tag, order[0], order.data());
+        for (J c = 0; c < names->n; c++) {
+            if (nested[c]) {
+                K cell = kK(kK(columns)[c])[row];
+                if (XT == cell->t && !AddGroup(group, order[c], cell)) return false;
+            } else if (!text[c][row].empty()) {
+                group.setField(order[c], text[c][row]);
+            }
+        }
+        map.addGroup(tag, group);
+    }
+
+    return true;
+}
+
+/* SendToTarget:
+ *   FIX::Session::sendToTarget, recording the encode stage (from start,
+ *   when the q call was made) and the send stage when the message went to a
+ *   session with Stats=Y.
+ */
+static bool SendToTarget(FIX::Message& message, int64_t start)
+{
+    if (!timedSends) {
+        return FIX::Session::sendToTarget(message);
+    }
+
+    int64_t encoded = monotonicnanos();
+    SendingContext() = nullptr;
+    bool sent = FIX::Session::sendToTarget(message);
+
+    SessionContext* context = SendingContext();
+    const FIX::Header& header = message.getHeader();
+    MessageStats* stats = context && header.isSetField(35) ? context->stats->find(header.getField(35)) : nullptr;
+    if (stats) {
+        stats->stages[STAGE_ENCODE].record(encoded - start);
+        stats->stages[STAGE_SEND].record(monotonicnanos() - encoded);
+    }
+
+    return sent;
+}
+
+extern "C"
+K SendMessageDict(K x)
+{
+    int64_t start = timedSends ? monotonicnanos() : 0;
+
+    if (x->t != 99 || kK(x)[0]->t != 7 || kK(x)[1]->t != 0)
+        return krr((S) "type");
+
+    K keys = kK(x)[0];
+    K values = kK(x)[1];
+
+    auto beginString = std::string("");
+    auto senderCompId = std::string("");
+    auto targetCompId = std::string("");
+    auto sessionQualifier = std::string("");
+ 
+    FIX::Message message;
+    FIX::Header &header = message.getHeader();
+
+    for (int i = 0; i < keys->n; i++) {
+        int tag = kJ(keys)[i];
+
+        // repeating groups are sent from tables with one row per instance
+        if (XT == kK(values)[i]->t) {
+            if (!AddGroup(message, tag, kK(values)[i])) return krr((S) "type");
+            continue;
+        }
+
+        auto rep = typedtostring(kK(values)[i]);
+	
+        if (IsHeaderTag(tag)) {
+            header.setField(tag, rep);
+        } else {
+            message.setField(tag, rep);
+        }
+	
+    }
+
+    try {
+        SendToTarget(message, start);
+    } catch(FIX::SessionNotFound& ex) {
+        std::cout << "unable to send message - session not found" << std::endl;
+    }
+    
+    return (K) 0;
+}
+
+// templates defined with .fix.template, only used from the q main thread
+static std::unordered_map<std::string, MessageTemplate*> templates;
+
+extern "C"
+K DefineTemplate(K x, K y, K z)
+{
+    if (-11 != x->t || 99 != y->t || KJ != kK(y)[0]->t || 0 != kK(y)[1]->t || (KJ != z->t && KI != z->t)) {
+        return krr((S) "type");
+    }
+
+    std::vector<int> variable;
+    for (J i = 0; i < z->n; i++) {
+        variable.push_back(KJ == z->t ? (int) kJ(z)[i] : kI(z)[i]);
+    }
+
+    auto compiled = new MessageTemplate(variable);
+    K keys = kK(y)[0];
+    K values = kK(y)[1];
+    for (J i = 0; i < keys->n; i++) {
+        compiled->set((int) kJ(keys)[i], typedtostring(kK(values)[i]));
+    }
+    compiled->prepare();
+
+    auto found = templates.find(x->s);
+    if (found != templates.end()) {
+        delete found->second;
+        found->second = compiled;
+    } else {
+        templates.insert({x->s, compiled});
+    }
+
+    return (K) 0;
+}
+
+extern "C"
+K SendTemplate(K x, K y)
+{
+    int64_t start = timedSends ? monotonicnanos() : 0;
+
+    if (-11 != x->t || 0 != y->t) {
+        return krr((S) "type");
+    }
+
+    auto found = templates.find(x->s);
+    if (found == templates.end()) {
+        return krr((S) "template");
+    }
+
+    MessageTemplate* compiled = found->second;
+    if ((size_t) y->n != compiled->size()) {
+        return krr((S) "length");
+    }
+
+    FIX::Message message;
+    if (compiled->fill(kK(y), (size_t) y->n, message) != (size_t) y->n) {
+        return krr((S) "type");
+    }
+
+    try {
+        return kb(SendToTarget(message, start));
+    } catch(FIX::SessionNotFound& ex) {
+        std::cout << "unable to send message - session not found" << std::endl;
+    }
+
+    return kb(0);
+}
+
+extern "C"
+K SendBatch(K x)
+{
+    if (98 != x->t || KS != kK(x->k)[0]->t) {
+        return krr((S) "type");
+    }
+
+    K names = kK(x->k)[0];
+    K columns = kK(x->k)[1];
+    J rows = 0 == names->n ? 0 : kK(columns)[0]->n;
+
+    std::vector<int> tags((size_t) names->n);
+    std::vector<std::vector<std::string>> text((size_t) names->n);
+    int begin = -1, sender = -1, target = -1;
+
+    for (J c = 0; c < names->n; c++) {
+        tags[c] = ColumnTag(kS(names)[c]);
+        if (tags[c] < 0 || !encodecolumn(kK(columns)[c], text[c])) {
+            return krr(kS(names)[c]);
+        }
+        if (8 == tags[c]) begin = (int) c;
+        if (49 == tags[c]) sender = (int) c;
+        if (56 == tags[c]) target = (int) c;
+    }
+
+    // rows for each session in the order they were first seen, so each
+    // session is looked up once and sends its rows in table order
+    std::map<FIX::SessionID, std::vector<J>> bysession;
+    std::vector<FIX::SessionID> order;
+    K result = ktn(KB, rows);
+    memset(kG(result), 0, (size_t) rows);
+
+    if (begin < 0 || sender < 0 || target < 0) {
+        return result;
+    }
+
+    for (J row = 0; row < rows; row++) {
+        FIX::SessionID id(text[begin][row], text[sender][row], text[target][row]);
+        auto found = bysession.find(id);
+        if (found == bysession.end()) {
+            order.push_back(id);
+            found = bysession.insert({id, std::vector<J>()}).first;
+        }
+        found->second.push_back(row);
+    }
+
+    for (auto& id : order) {
+        FIX::Session* session = FIX::Session::lookupSession(id);
+        if (!session) continue;
+
+        for (J row : bysession[id]) {
+            FIX::Message message;
+            for (size_t c = 0; c < tags.size(); c++) {
+                const std::string& value = text[c][row];
+                if (value.empty()) continue;
+
+                if (IsHeaderTag(tags[c])) {
+                    message.getHeader().setField(tags[c], value);
+                } else {
+                    message.setField(tags[c], value);
+                }
+            }
+
+            try {
+                kG(result)[row] = session->send(message);
+            } catch(FIX::Exception& ex) {
+                kG(result)[row] = 0;
+            }
+        }
+    }
+
+    return result;
+}
+
+// reads exactly numbytes, false if the socket was closed
+static bool ReadBytes(int fd, char* buf, J numbytes)
+{
+    J total = 0;
+    while (total < numbytes) {
+        int rc = recv(fd, buf + total, (int) (numbytes - total), 0);
+        if (rc <= 0) return false;
+        total += rc;
+    }
+    return true;
+}
+
+static std::string MessageType(K msg)
+{
+    K keys = kK(msg)[0];
+    K values = kK(msg)[1];
+
+    for (J i = 0; i < keys->n; i++) {
+        if (35 == kJ(keys)[i] && KC == kK(values)[i]->t) {
+            return std::string((char *) kC(kK(values)[i]), (size_t) kK(values)[i]->n);
+        }
+    }
+
+    return "";
+}
+
+// builds one table for messages sharing a MsgType, the first column is the
+// session and the others are the tags present in any of the messages in the
+// order they were first seen, named from the spec of the first message's
+// session. Sessions with different specs can type a tag differently, from
+// FixedPoint, SymbolTags or their FIX version, and such a tag becomes a
+// general column so that no session's values are lost.
+static K CreateTable(const std::vector<K>& msgs, const std::vector<S>& keys, const std::vector<const Spec*>& specs)
+{
+    const Spec& spec = *specs[0];
+
+    std::vector<int> tags;
+    std::unordered_map<int, size_t> index;
+
+    for (auto msg : msgs) {
+        K keys = kK(msg)[0];
+        for (J i = 0; i < keys->n; i++) {
+            int tag = (int) kJ(keys)[i];
+            if (index.find(tag) == index.end()) {
+                index[tag] = tags.size();
+                tags.push_back(tag);
+            }
+        }
+    }
+
+    J rows = (J) msgs.size();
+    K names = ktn(KS, (J) tags.size() + 1);
+    K columns = ktn(0, (J) tags.size() + 1);
+    std::vector<I> types(tags.size());
+
+    kS(names)[0] = ss((S) "session");
+    kK(columns)[0] = ktn(KS, rows);
+    for (J row = 0; row < rows; row++) {
+        kS(kK(columns)[0])[row] = keys[row];
+    }
+
+    for (size_t c = 0; c < tags.size(); c++) {
+        auto name = spec.tagnames.find(tags[c]);
+        std::string colname = name != spec.tagnames.end() ? name->second : "tag" + std::to_string(tags[c]);
+
+        types[c] = ColumnType(spec, tags[c]);
+        for (size_t s = 1; s < specs.size(); s++) {
+            if (ColumnType(*specs[s], tags[c]) != types[c]) types[c] = 0;
+        }
+        kS(names)[c + 1] = ss((S) colname.c_str());
+        kK(columns)[c + 1] = ktn(types[c], rows);
+        for (J row = 0; row < rows; row++) {
+            SetColumnNull(kK(columns)[c + 1], types[c], row);
+        }
+    }
+
+    for (J row = 0; row < rows; row++) {
+        K tagkeys = kK(msgs[row])[0];
+        K values = kK(msgs[row])[1];
+        for (J i = 0; i < tagkeys->n; i++) {
+            size_t c = index[(int) kJ(tagkeys)[i]];
+            K column = kK(columns)[c + 1];
+            if (0 == types[c]) r0(kK(column)[row]);
+            SetColumnValue(column, types[c], row, kK(values)[i]);
+        }
+    }
+
+    return xT(xD(names, columns));
+}
+
+// groups messages by MsgType into a dictionary of table name to table, the
+// names are taken from the spec and match those in fixtabletags.q
+static K CreateBatch(K* msgs, S* keys, const Spec** specs, size_t count)
+{
+    std::vector<std::string> order;
+    std::unordered_map<std::string, std::vector<K>> groups;
+    std::unordered_map<std::string, std::vector<S>> sessions;
+    std::unordered_map<std::string, std::vector<const Spec*>> groupspecs;
+
+    for (size_t i = 0; i < count; i++) {
+        auto msgtype = MessageType(msgs[i]);
+        auto& group = groups[msgtype];
+        if (group.empty()) order.push_back(msgtype);
+        group.push_back(msgs[i]);
+
+        auto& groupspec = groupspecs[msgtype];
+        if (std::find(groupspec.begin(), groupspec.end(), specs[i]) == groupspec.end()) {
+            groupspec.push_back(specs[i]);
+        }
+        sessions[msgtype].push_back(keys[i]);
+    }
+
+    K names = ktn(KS, (J) order.size());
+    K tables = ktn(0, (J) order.size());
+
+    for (size_t i = 0; i < order.size(); i++) {
+        const std::vector<const Spec*>& groupspec = groupspecs[order[i]];
+        auto name = groupspec[0]->msgnames.find(order[i]);
+        kS(names)[i] = ss((S) (name != groupspec[0]->msgnames.end() ? name->second : order[i]).c_str());
+        kK(tables)[i] = CreateTable(groups[order[i]], sessions[order[i]], groupspec);
+    }
+
+    return xD(names, tables);
+}
+
+static void ArmBatchTimer(int timer, long micros)
+{
+#ifdef __linux__
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = micros / 1000000;
+    spec.it_value.tv_nsec = (micros % 1000000) * 1000;
+    if (0 == spec.it_value.tv_sec && 0 == spec.it_value.tv_nsec) spec.it_value.tv_nsec = 1;
+    timerfd_settime(timer, 0, &spec, NULL);
+#endif
+}
+
+// delivers the pending messages in chunks of at most the batch size, unless
+// the batch is still below both the size and latency limits
+static void FlushBatch(Batch* batch, bool force)
+{
+    if (!batch || batch->pending.empty()) return;
+
+    std::vector<K>& pending = batch->pending;
+    if (!force && batch->timer != -1 && pending.size() < batch->size) {
+        auto age = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - batch->since).count();
+        if (age < batch->latency) {
+            ArmBatchTimer(batch->timer, batch->latency - age);
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < pending.size(); i += batch->size) {
+        size_t count = std::min(batch->size, pending.size() - i);
+        K tables = CreateBatch(&pending[i], &batch->sessions[i], &batch->specs[i], count);
+        for (size_t j = i; j < i + count; j++) r0(pending[j]);
+
+        K r = k(0, (char *)".fix.onrecvbatch", tables, (K) 0);
+        if (r != 0) { r0(r); }
+    }
+
+    pending.clear();
+    batch->sessions.clear();
+    batch->specs.clear();
+}
+
+// records the queue and wakeup stages of a message picked up on the q
+// thread by a callback or .fix.poll call that started at woke
+static void Dequeued(Trace& trace, int64_t woke)
+{
+    if (!trace.stats) return;
+
+    trace.dequeued = monotonicnanos();
+    trace.stats->stages[STAGE_QUEUE].record(trace.dequeued - trace.enqueued);
+    trace.stats->stages[STAGE_WAKEUP].record(woke - trace.enqueued);
+}
+
+// in batch mode the callback takes many messages so only the stages up to
+// the queue are recorded
+static void Receive(SessionContext* context, K msg, const Trace& trace)
+{
+    if (Batch* batch = context->batch) {
+        if (batch->pending.empty()) batch->since = std::chrono::steady_clock::now();
+        batch->pending.push_back(msg);
+        batch->sessions.push_back(context->key);
+        batch->specs.push_back(context->spec);
+        return;
+    }
+
+    int64_t called = trace.stats ? monotonicnanos() : 0;
+    K r = k(0, (char *)".fix.onrecv", ks(context->key), msg, (K) 0);
+    if (r != 0) { r0(r); }
+
+    if (trace.stats) {
+        int64_t returned = monotonicnanos();
+        trace.stats->stages[STAGE_CALLBACK].record(returned - called);
+        trace.stats->stages[STAGE_TOTAL].record(returned - (trace.arrived ? trace.arrived : trace.entered));
+    }
+}
+
+extern "C"
+K BatchTimerFired(I x)
+{
+    uint64_t expirations;
+    ssize_t rc = read(x, &expirations, sizeof(expirations));
+    (void) rc;
+
+    auto found = batchesByTimer.find(x);
+    if (found != batchesByTimer.end()) FlushBatch(found->second, true);
+    return (K) 0;
+}
+
+extern "C"
+K RecieveData(I x)
+{
+    auto found = sessionsByFd.find(x);
+    if (found == sessionsByFd.end()) {
+        return (K) 0;
+    }
+
+    SessionContext* context = found->second;
+    int64_t woke = context->stats ? monotonicnanos() : 0;
+    size_t count = 0;
+    J size = 0;
+    Trace trace;
+
+    // in batch mode keep reading while whole length prefixes are available,
+    // up to the drain limit so other sessions are not starved
+    do {
+        if (!ReadBytes(x, (char*) &size, sizeof(J))) break;
+        if (!ReadBytes(x, (char*) &trace, sizeof(Trace))) break;
+
+        K bytes = ktn(KG, size);
+        if (!ReadBytes(x, (char*) kG(bytes), size)) {
+            r0(bytes);
+            break;
+        }
+
+        Dequeued(trace, woke);
+        K msg = d9(bytes);
+        r0(bytes);
+        if (trace.stats) trace.stats->stages[STAGE_D9].record(monotonicnanos() - trace.dequeued);
+
+        Receive(context, msg, trace);
+    } while (context->batch && ++count < DRAIN_LIMIT && recv(x, (char*) &size, sizeof(J), MSG_PEEK | MSG_DONTWAIT) == (int) sizeof(J));
+
+    FlushBatch(context->batch, false);
+
+    return (K) 0;
+}
+
+extern "C"
+K BookTimerFired(I x)
+{
+    auto found = sessionsByFd.find(x);
+    if (found == sessionsByFd.end()) {
+        return (K) 0;
+    }
+
+    SessionContext* context = found->second;
+    context->books->publish([context](K snapshot) {
+        K r = k(0, (char *)".fix.onbook", ks(context->key), snapshot, (K) 0);
+        if (r != 0) { r0(r); }
+    });
+
+    return (K) 0;
+}
+
+extern "C"
+K RecieveRing(I x)
+{
+    auto found = sessionsByFd.find(x);
+    if (found == sessionsByFd.end()) {
+        return (K) 0;
+    }
+
+    SessionContext* context = found->second;
+    int64_t woke = context->stats ? monotonicnanos() : 0;
+    context->channel->drain([context, woke](K msg, Trace& trace) {
+        Dequeued(trace, woke);
+        Receive(context, msg, trace);
+    }, DRAIN_LIMIT);
+    FlushBatch(context->batch, false);
+
+    return (K) 0;
+}
+
+/* Poll:
+ *   .fix.poll[n] delivers up to n of the messages queued by sessions with
+ *   BusyPoll=Y and returns how many it delivered. Those sessions never
+ *   wake the q thread, so a q process dedicated to them calls this in a
+ *   loop instead of waiting for sd1. Each call starts from the next
+ *   session so that a busy one cannot starve the rest.
+ */
+extern "C"
+K Poll(K x)
+{
+    if (-KJ != x->t && -KI != x->t) {
+        return krr((S) "type");
+    }
+
+    static size_t first = 0;
+    J limit = -KJ == x->t ? x->j : x->i;
+    size_t n = polledSessions.size();
+    size_t delivered = 0;
+    for (size_t i = 0; i < n && limit > 0 && delivered < (size_t) limit; i++) {
+        SessionContext* context = polledSessions[(first + i) % n];
+        int64_t woke = context->stats ? monotonicnanos() : 0;
+        delivered += context->channel->poll([context, woke](K msg, Trace& trace) {
+            Dequeued(trace, woke);
+            Receive(context, msg, trace);
+        }, (size_t) limit - delivered);
+    }
+    if (n) first = (first + 1) % n;
+    for (SessionContext* context : polledSessions) FlushBatch(context->batch, false);
+
+    return kj((J) delivered);
+}
+
+// StoreType=mmap selects the memory mapped store, otherwise QuickFIX's FileStore
+static FIX::MessageStoreFactory* CreateStoreFactory(const FIX::SessionSettings& settings)
+{
+    const FIX::Dictionary& defaults = settings.get();
+    if (defaults.has("StoreType") && defaults.getString("StoreType") == "mmap") {
+#ifndef WIN32
+        return new MmapStoreFactory(settings);
+#else
+        std::cout << "StoreType=mmap is not supported on Windows, using file" << std::endl;
+#endif
+    }
+
+    return new FIX::FileStoreFactory(settings);
+}
+
+// LogType=async selects the binary log written by a background thread,
+// otherwise QuickFIX's FileLog
+static FIX::LogFactory* CreateLogFactory(const FIX::SessionSettings& settings)
+{
+    const FIX::Dictionary& defaults = settings.get();
+    if (defaults.has("LogType") && defaults.getString("LogType") == "async") {
+#ifndef WIN32
+        return new AsyncLogFactory(settings);
+#else
+        std::cout << "LogType=async is not supported on Windows, using file" << std::endl;
+#endif
+    }
+
+    return new FIX::FileLogFactory(settings);
+}
+
+// the transport and batching are chosen per engine
+static void ConfigureTransport(const FIX::Dictionary& defaults, FixEngineApplication& application)
+{
+    application.transport = TRANSPORT_SOCKET;
+    if (defaults.has("TransportType") && defaults.getString("TransportType") == "ring") {
+        application.transport = TRANSPORT_RING;
+    }
+
+    if (defaults.has("RingSize")) {
+        application.ringSize = (size_t) defaults.getInt("RingSize");
+    }
+
+    // messages are allocated on the session threads and released on the
+    // main thread once .fix.onrecv returns
+    if (TRANSPORT_RING == application.transport) {
+        setm(1);
+    }
+
+    if (!defaults.has("BatchMode") || !defaults.getBool("BatchMode")) return;
+
+    Batch* batch = new Batch;
+    application.batch.reset(batch);
+    if (defaults.has("BatchSize") && defaults.getInt("BatchSize") > 0) {
+        batch->size = (size_t) defaults.getInt("BatchSize");
+    }
+    if (defaults.has("BatchLatency")) {
+        batch->latency = defaults.getInt("BatchLatency");
+    }
+
+#ifdef __linux__
+    if (batch->latency > 0) {
+        batch->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        batchesByTimer[batch->timer] = batch;
+        sd1(batch->timer, BatchTimerFired);
+    }
+#endif
+}
+
+// DecodeThreads starts a pool of that many workers to decode the messages of
+// the engine's sessions with DecodePool=Y
+static void ConfigureDecodePool(const FIX::Dictionary& defaults, FixEngineApplication& application)
+{
+    if (!defaults.has("DecodeThreads") || defaults.getInt("DecodeThreads") <= 0) return;
+
+    // messages are allocated on the workers and released on the main thread
+    setm(1);
+    application.pool.reset(new DecodePool((size_t) defaults.getInt("DecodeThreads"), DecodePooled));
+}
+
+// TickerplantPort starts a publisher for the engine, see TickerplantPublisher
+static void ConfigurePublisher(const FIX::Dictionary& defaults, FixEngineApplication& application)
+{
+    if (!defaults.has("TickerplantPort")) return;
+
+#ifndef WIN32
+    TickerplantPublisher::Settings settings;
+    settings.port = defaults.getInt("TickerplantPort");
+    if (defaults.has("TickerplantHost")) settings.host = defaults.getString("TickerplantHost");
+    if (defaults.has("TickerplantUser")) settings.user = defaults.getString("TickerplantUser");
+    if (defaults.has("TickerplantFunction")) settings.function = defaults.getString("TickerplantFunction");
+    if (defaults.has("TickerplantBatchSize") && defaults.getInt("TickerplantBatchSize") > 0) {
+        settings.batch = (size_t) defaults.getInt("TickerplantBatchSize");
+    }
+    if (defaults.has("TickerplantFlushInterval") && defaults.getInt("TickerplantFlushInterval") > 0) {
+        settings.interval = defaults.getInt("TickerplantFlushInterval");
+    }
+    if (defaults.has("TickerplantBufferSize") && defaults.getInt("TickerplantBufferSize") > 0) {
+        settings.capacity = (size_t) defaults.getInt("TickerplantBufferSize");
+    }
+    if (defaults.has("TickerplantReconnectInterval") && defaults.getInt("TickerplantReconnectInterval") > 0) {
+        settings.reconnect = defaults.getInt("TickerplantReconnectInterval");
+    }
+
+    // columns are built on the publisher thread
+    setm(1);
+    application.publisher.reset(new TickerplantPublisher(settings));
+#else
+    std::cout << "TickerplantPort is not supported on Windows, not publishing" << std::endl;
+#endif
+}
+
+/* Engine:
+ *   Everything owned by one .fix.create call. The initiator or acceptor is
+ *   declared in the derived class so that it is destroyed before the
+ *   application, factories and settings it refers to.
+ */
+struct Engine
+{
+    virtual ~Engine() {}
+    virtual void stop() = 0;
+
+    std::unique_ptr<FIX::SessionSettings> settings;
+    std::unique_ptr<FixEngineApplication> application;
+    std::unique_ptr<FIX::MessageStoreFactory> store;
+    std::unique_ptr<FIX::LogFactory> fileLog;
+    std::unique_ptr<FIX::LogFactory> log;
+};
+
+template<typename T>
+struct ThreadedEngine : Engine
+{
+    void stop() { socket->stop(); }
+
+    std::unique_ptr<T> socket;
+};
+
+// running engines by the handle returned to q
+static std::map<J, Engine*> engines;
+static J nextEngine = 0;
+
+template<typename T>
+K CreateThreadedSocket(K x) {
+    if (x->t != -11) {
+        return krr((S) "type");
+    }
+
+    std::string settingsPath = "settings.ini";
 
-        std::unordered_map<int, std::string>::const_iterator found = typemap.find(tag);
-        ja(keys, &tag);
+    settingsPath = std::string(x->s);
+    settingsPath.erase(std::remove(settingsPath.begin(), settingsPath.end(), ':'), settingsPath.end());
 
-        if(55==tag){
-            jk(values, ks(const_cast<char *>(str)));
-	}
-	else{
-	    jk(values, convertmsgtype(str, found->second));
-	};
+    auto engine = new ThreadedEngine<T>;
+    try {
+        engine->settings.reset(new FIX::SessionSettings(settingsPath));
+        engine->application.reset(new FixEngineApplication(*engine->settings));
+        engine->store.reset(CreateStoreFactory(*engine->settings));
+        engine->fileLog.reset(CreateLogFactory(*engine->settings));
+        engine->log.reset(new CaptureLogFactory(*engine->fileLog, *engine->settings));
+
+        ConfigureTransport(engine->settings->get(), *engine->application);
+        ConfigurePublisher(engine->settings->get(), *engine->application);
+        ConfigureDecodePool(engine->settings->get(), *engine->application);
+
+        engine->socket.reset(new T(*engine->application, *engine->store, *engine->settings, *engine->log));
+        engine->socket->start();
+    } catch (std::exception& e) {
+        std::cout << "unable to create engine - " << e.what() << std::endl;
+        delete engine;
+        return krr((S) "config");
     }
+
+    engines[++nextEngine] = engine;
+    return kj(nextEngine);
 }
 
-static K ConvertToDictionary(const FIX::Message& message)
+extern "C"
+K Stop(K x)
 {
-    K keys = ktn(KJ, 0);
-    K values = ktn(0, 0);
+    if (-KJ != x->t && -KI != x->t) {
+        return krr((S) "type");
+    }
 
-    auto header = message.getHeader();
-    auto trailer = message.getTrailer();
+    auto found = engines.find(-KJ == x->t ? x->j : x->i);
+    if (found == engines.end()) {
+        return krr((S) "handle");
+    }
 
-    FillFromIterators(header.begin(), header.end(), &keys, &values);
-    FillFromIterators(message.begin(), message.end(), &keys, &values);
-    FillFromIterators(trailer.begin(), trailer.end(), &keys, &values);
-    
-    return xD(keys, values);
+    Engine* engine = found->second;
+    engines.erase(found);
+
+    engine->stop();
+    delete engine;
+
+    return (K) 0;
 }
 
-static void WriteToSocket(K x)
+/* Queues:
+ *   The delivery queue of every ring transport session as a table of session,
+ *   queued, capacity, highWater, stalls, overflowed, overflow (messages
+ *   waiting in the overflow) and conflated.
+ */
+extern "C"
+K Queues(K x)
 {
-    static char buffer[8192];
+    std::vector<SessionContext*> contexts;
+    for (auto& engine : engines) {
+        for (auto& session : engine.second->application->sessions) {
+            if (session.second->channel) contexts.push_back(session.second);
+        }
+    }
 
-    K bytes = b9(-1, x);
-    r0(x);
+    J n = (J) contexts.size();
+    K names = ktn(KS, 8);
+    K columns = ktn(0, 8);
+    const char* labels[] = { "session", "queued", "capacity", "highWater", "stalls", "overflowed", "overflow", "conflated" };
+    for (int c = 0; c < 8; c++) {
+        kS(names)[c] = ss((S) labels[c]);
+        kK(columns)[c] = ktn(0 == c ? KS : KJ, n);
+    }
 
-    memcpy(&buffer, (char*) &bytes->n, sizeof(J));
-    memcpy(&buffer[sizeof(J)], kG(bytes), (size_t) bytes->n);
- 
-    send(sockets[0], buffer, (int) sizeof(J) + bytes->n, 0);
-    r0(bytes);
+    for (J i = 0; i < n; i++) {
+        Channel* channel = contexts[i]->channel;
+        kS(kK(columns)[0])[i] = contexts[i]->key;
+        kJ(kK(columns)[1])[i] = (J) channel->size();
+        kJ(kK(columns)[2])[i] = (J) channel->capacity();
+        kJ(kK(columns)[3])[i] = (J) channel->stats.highWater.load();
+        kJ(kK(columns)[4])[i] = (J) channel->stats.stalls.load();
+        kJ(kK(columns)[5])[i] = (J) channel->stats.overflowed.load();
+        kJ(kK(columns)[6])[i] = (J) channel->overflowSize();
+        kJ(kK(columns)[7])[i] = (J) channel->conflated();
+    }
+
+    return xT(xD(names, columns));
 }
 
-void FixEngineApplication::onCreate(const FIX::SessionID& sessionID)
+/* Stats:
+ *   The latency histograms of every session with Stats=Y as a table of
+ *   session, msgtype, stage, count and the mean, p50, p90, p99, p999 and max
+ *   as timespans, one row for each stage a message of the type has passed.
+ */
+extern "C"
+K Stats(K x)
 {
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    const char* labels[] = { "session", "msgtype", "stage", "count", "mean", "p50", "p90", "p99", "p999", "max" };
+
+    K names = ktn(KS, 10);
+    K columns = ktn(0, 10);
+    for (int c = 0; c < 10; c++) {
+        kS(names)[c] = ss((S) labels[c]);
+        kK(columns)[c] = ktn(c < 3 ? KS : 3 == c ? KJ : KN, 0);
+    }
+
+    for (auto& engine : engines) {
+        for (auto& session : engine.second->application->sessions) {
+            SessionContext* context = session.second;
+            if (!context->stats) continue;
+
+            context->stats->each([&](const std::string& msgtype, MessageStats& stats) {
+                for (int stage = 0; stage < STAGE_COUNT; stage++) {
+                    const Histogram& histogram = stats.stages[stage];
+                    if (0 == histogram.count()) continue;
+
+                    uint64_t values[4];
+                    histogram.percentiles(quantiles, values, 4);
+                    J row[] = { (J) histogram.count(), (J) histogram.mean(), (J) values[0], (J) values[1], (J) values[2], (J) values[3], (J) histogram.max() };
+
+                    js(&kK(columns)[0], context->key);
+                    js(&kK(columns)[1], ss((S) msgtype.c_str()));
+                    js(&kK(columns)[2], ss((S) stagename(stage)));
+                    for (int c = 0; c < 7; c++) ja(&kK(columns)[c + 3], &row[c]);
+                }
+            });
+        }
+    }
 
+    return xT(xD(names, columns));
 }
 
-void FixEngineApplication::onLogon(const FIX::SessionID& sessionID)
+extern "C"
+K ResetStats(K x)
 {
+    for (auto& engine : engines) {
+        for (auto& session : engine.second->application->sessions) {
+            if (session.second->stats) session.second->stats->reset();
+        }
+    }
 
+    return (K) 0;
 }
 
-void FixEngineApplication::onLogout(const FIX::SessionID& sessionID)
+/* LogStats:
+ *   The binary logs of every engine with LogType=async as a table of
+ *   session, path, flushed and dropped bytes.
+ */
+extern "C"
+K LogStats(K x)
 {
+    K sessions = ktn(KS, 0);
+    K paths = ktn(0, 0);
+    K flushed = ktn(KJ, 0);
+    K dropped = ktn(KJ, 0);
+
+#ifndef WIN32
+    for (auto& engine : engines) {
+        AsyncLogFactory* factory = dynamic_cast<AsyncLogFactory*>(engine.second->fileLog.get());
+        if (!factory) continue;
+
+        factory->each([&](const AsyncLog& log) {
+            J written = (J) log.flushed.load();
+            J lost = (J) log.dropped.load();
+            js(&sessions, ss((S) log.session.c_str()));
+            jk(&paths, kp((S) log.path.c_str()));
+            ja(&flushed, &written);
+            ja(&dropped, &lost);
+        });
+    }
+#endif
 
+    K names = ktn(KS, 4);
+    kS(names)[0] = ss((S) "session");
+    kS(names)[1] = ss((S) "path");
+    kS(names)[2] = ss((S) "flushed");
+    kS(names)[3] = ss((S) "dropped");
+
+    return xT(xD(names, knk(4, sessions, paths, flushed, dropped)));
 }
 
-void FixEngineApplication::toAdmin(FIX::Message& message, const FIX::SessionID& sessionID)
+/* ReadLog:
+ *   A binary session log as a table of time, type (`incoming, `outgoing or
+ *   `event) and text.
+ */
+extern "C"
+K ReadLog(K x)
 {
+    if (-KS != x->t) {
+        return krr((S) "type");
+    }
 
-}
+    LogReader reader(':' == x->s[0] ? x->s + 1 : x->s);
+    if (!reader.ok()) {
+        return krr(x->s);
+    }
 
-void FixEngineApplication::toApp(FIX::Message& message, const FIX::SessionID& sessionID) throw (FIX::DoNotSend)
-{
+    K times = ktn(KP, 0);
+    K types = ktn(KS, 0);
+    K texts = ktn(0, 0);
+
+    uint8_t type;
+    int64_t time;
+    std::string text;
+    while (reader.next(&type, &time, text)) {
+        J nanos = time - (J) KDB_EPOCH_DAYS * NANOS_PER_DAY;
+        ja(&times, &nanos);
+        js(&types, ss((S) (LOG_INCOMING == type ? "incoming" : LOG_OUTGOING == type ? "outgoing" : "event")));
+        jk(&texts, kpn((S) text.data(), (J) text.size()));
+    }
 
+    K names = ktn(KS, 3);
+    kS(names)[0] = ss((S) "time");
+    kS(names)[1] = ss((S) "type");
+    kS(names)[2] = ss((S) "text");
+
+    return xT(xD(names, knk(3, times, types, texts)));
 }
 
-void FixEngineApplication::fromAdmin(const FIX::Message& message, const FIX::SessionID& sessionID) throw (FIX::FieldNotFound, FIX::IncorrectDataFormat, FIX::IncorrectTagValue, FIX::RejectLogon)
+#ifndef WIN32
+// finds name in an options dictionary with symbol keys, false if it is not
+// there (an empty list or :: has no options)
+static bool FindOption(K options, const char* name, K* values, J* index)
 {
-    WriteToSocket(ConvertToDictionary(message));
+    if (XD != options->t || KS != kK(options)[0]->t) return false;
+
+    K keys = kK(options)[0];
+    S key = ss((S) name);
+    for (J i = 0; i < keys->n; i++) {
+        if (kS(keys)[i] != key) continue;
+        *values = kK(options)[1];
+        *index = i;
+        return true;
+    }
+    return false;
 }
 
-void FixEngineApplication::fromApp(const FIX::Message& message, const FIX::SessionID& sessionID) throw (FIX::FieldNotFound, FIX::IncorrectDataFormat, FIX::IncorrectTagValue, FIX::UnsupportedMessageType)
+// an integer option, false if it is given with another type
+static bool IntOption(K options, const char* name, J* value)
 {
-    WriteToSocket(ConvertToDictionary(message));
+    K values;
+    J i;
+    if (!FindOption(options, name, &values, &i)) return true;
+
+    K atom = 0 == values->t ? kK(values)[i] : nullptr;
+    I type = atom ? atom->t : -values->t;
+    if (-KJ == type) *value = atom ? atom->j : kJ(values)[i];
+    else if (-KI == type) *value = atom ? atom->i : kI(values)[i];
+    else if (-KH == type) *value = atom ? atom->h : kH(values)[i];
+    else return false;
+    return true;
 }
 
-#pragma GCC diagnostic pop
-
-extern "C"
-K SendMessageDict(K x)
+// an int or long list option of tags, false if it is given with another type
+static bool TagsOption(K options, const char* name, std::set<int>& value)
 {
-    
-    if (x->t != 99 || kK(x)[0]->t != 7 || kK(x)[1]->t != 0)
-        return krr((S) "type");
-
-    K keys = kK(x)[0];
-    K values = kK(x)[1];
-
-    auto beginString = std::string("");
-    auto senderCompId = std::string("");
-    auto targetCompId = std::string("");
-    auto sessionQualifier = std::string("");
- 
-    FIX::Message message;
-    FIX::Header &header = message.getHeader();
+    K values;
+    J i;
+    if (!FindOption(options, name, &values, &i)) return true;
+
+    K x = 0 == values->t ? kK(values)[i] : nullptr;
+    if (!x) {
+        J tag;
+        if (!IntOption(options, name, &tag)) return false;
+        value.insert((int) tag);
+        return true;
+    }
+    if (KJ == x->t) for (J j = 0; j < x->n; j++) value.insert((int) kJ(x)[j]);
+    else if (KI == x->t) for (J j = 0; j < x->n; j++) value.insert(kI(x)[j]);
+    else if (-KJ == x->t) value.insert((int) x->j);
+    else if (-KI == x->t) value.insert(x->i);
+    else return false;
+    return true;
+}
 
-    for (int i = 0; i < keys->n; i++) {
-        int tag = kJ(keys)[i];
+// a symbol or symbol list option, false if it is given with another type
+static bool SymbolOption(K options, const char* name, std::vector<std::string>& value)
+{
+    K values;
+    J i;
+    if (!FindOption(options, name, &values, &i)) return true;
 
-        auto rep = typedtostring(kK(values)[i]);
-	
-        if (tag == 35 || tag == 8 || tag == 49 || tag == 56) {
-            header.setField(tag, rep);
-        } else {
-            message.setField(tag, rep);
-        }
-	
+    if (KS == values->t) {
+        value.push_back(kS(values)[i]);
+        return true;
     }
+    if (0 != values->t) return false;
 
-    try {
-        FIX::Session::sendToTarget(message);
-    } catch(FIX::SessionNotFound& ex) {
-        std::cout << "unable to send message - session not found" << std::endl;
-    }
-    
-    return (K) 0;
+    K x = kK(values)[i];
+    if (-KS == x->t) value.push_back(x->s);
+    else if (KS == x->t) for (J j = 0; j < x->n; j++) value.push_back(kS(x)[j]);
+    else return false;
+    return true;
 }
 
-static inline void ReadBytes(int numbytes, char (*buf)[4096])
+static std::string FilePath(S s) { return ':' == s[0] ? s + 1 : s; }
+
+// the spec for messages logged with beginString, that of the session last
+// created on that version if there is one, with that session's settings
+static const Spec* LogSpec(const std::string& beginString)
 {
-    int total = 0;
-    do { total += recv(sockets[1], &buf[total], (int) (numbytes - total), 0); } while (total < numbytes);
-}
+    auto found = specsByVersion.find(beginString);
+    if (found != specsByVersion.end()) return found->second;
 
+    const Spec* spec = beginString.empty() ? nullptr : FindSpec(SpecFile(beginString));
+    return spec ? spec : defaultSpec;
+}
+#endif
+
+/* LoadLog:
+ *   .fix.loadlog[files;options] decodes FileLog messages files or binary
+ *   logs into one table per MsgType, splitting the logs into chunks that
+ *   are decoded in parallel. Options is an empty list or a dictionary of
+ *
+ *     threads     workers to decode with, by default one per core
+ *     spec        the XML spec to decode with, by default chosen per log
+ *                 from its BeginString: the spec, FixedPoint and
+ *                 SymbolTags of the session last created on that
+ *                 BeginString, or spec/ as for a session if there is none
+ *     msgtypes    the MsgTypes to load, by default all of them
+ *     fixedpoint  tags to load as scaled longs, as in the FixedPoint
+ *                 setting
+ *     symbols     tags to load as symbols, as in SymbolTags
+ *     dest        a directory to write the tables to splayed, with symbols
+ *                 enumerated in its sym file and group columns left out
+ *
+ *   fixedpoint and symbols replace the FixedPoint and SymbolTags of the
+ *   sessions whose spec is used. Returns a dictionary of table name to
+ *   table, or to the rows written when dest is given.
+ */
 extern "C"
-K RecieveData(I x)
+K LoadLog(K x, K y)
 {
-    static char buf[4096];
-    J size = 0;
-
-    ReadBytes(sizeof(J), &buf);
-    memcpy(&size, buf, sizeof(J));
-   
-    K bytes = ktn(KG, size);
+#ifndef WIN32
+    if ((-KS != x->t && KS != x->t) || (XD != y->t && 0 != y->t && 101 != y->t)) {
+        return krr((S) "type");
+    }
 
-    ReadBytes(size, &buf);
-    memcpy(kG(bytes), &buf, (size_t) size);
-    K r = k(0, (char *)".fix.onrecv", d9(bytes), (K) 0);
-    r0(bytes);
+    J threads = (J) std::thread::hardware_concurrency();
+    std::vector<std::string> specpath, msgtypes, dest, fixedpoint;
+    SpecOptions options;
+    if (!IntOption(y, "threads", &threads) || !SymbolOption(y, "spec", specpath) ||
+        !SymbolOption(y, "msgtypes", msgtypes) || !SymbolOption(y, "dest", dest) ||
+        !SymbolOption(y, "fixedpoint", fixedpoint) || !TagsOption(y, "symbols", options.symbols) ||
+        specpath.size() > 1 || dest.size() > 1 || fixedpoint.size() > 1 ||
+        (!fixedpoint.empty() && !ParseScales(fixedpoint[0], options.scales))) {
+        return krr((S) "options");
+    }
+    if (threads < 1) threads = 1;
 
-    if (r != 0) { r0(r); }
+    const Spec* spec = nullptr;
+    if (!specpath.empty() && !(spec = FindSpec(FilePath((S) specpath[0].c_str()), options))) {
+        return krr((S) specpath[0].c_str());
+    }
 
-    return (K) 0;
-}
+    std::vector<std::unique_ptr<MappedLog>> logs;
+    size_t total = 0;
+    for (J i = 0; i < (-KS == x->t ? 1 : x->n); i++) {
+        S path = -KS == x->t ? x->s : kS(x)[i];
+        logs.emplace_back(new MappedLog(FilePath(path)));
+        if (!logs.back()->ok()) return krr(path);
+        total += logs.back()->size;
+    }
 
-template<typename T>
-K CreateThreadedSocket(K x) {
-    if (x->t != -11) {
-        return krr((S) "type");
+    // enough chunks per worker to even out logs of different sizes
+    size_t target = std::max(total / (size_t) (threads * 8), (size_t) 1 << 20);
+    std::vector<LogChunk> chunks;
+    for (auto& log : logs) {
+        const Spec* logspec = spec ? spec : LogSpec(LogBeginString(*log));
+        if (!options.empty()) logspec = FindSpec(logspec->path, options);
+        SplitLog(*log, logspec, target, chunks);
     }
 
-    std::string settingsPath = "settings.ini";
+    std::unordered_set<std::string> wanted(msgtypes.begin(), msgtypes.end());
+    std::vector<LoadResult> results;
+    std::vector<S> names;
+    std::vector<K> tables;
 
-    settingsPath = std::string(x->s);
-    settingsPath.erase(std::remove(settingsPath.begin(), settingsPath.end(), ':'), settingsPath.end());
+    setm(1);
+    DecodeChunks(chunks, msgtypes.empty() ? nullptr : &wanted, (int) threads, results);
+    MergeTables(results, chunks, names, tables);
 
-    auto settings = new FIX::SessionSettings(settingsPath);
-    auto application = new FixEngineApplication;
-    auto store = new FIX::FileStoreFactory(*settings);
-    auto log = new FIX::FileLogFactory(*settings);
-    
-    dumb_socketpair(sockets, 0);
-    sd1(sockets[1], RecieveData);
+    K keys = ktn(KS, (J) names.size());
+    for (size_t i = 0; i < names.size(); i++) kS(keys)[i] = names[i];
+
+    if (dest.empty()) {
+        K values = ktn(0, (J) tables.size());
+        for (size_t i = 0; i < tables.size(); i++) kK(values)[i] = tables[i];
+        return xD(keys, values);
+    }
 
-    T *socket = nullptr;
-    socket = new T(*application, *store, *settings, *log);
-    socket->start();
+    K rows = ktn(KJ, (J) tables.size());
+    for (size_t i = 0; i < tables.size(); i++) {
+        kJ(rows)[i] = kK(kK(tables[i]->k)[1])[0]->n;
+    }
 
-    return (K) 0;
+    // nested tables cannot be splayed so the group columns are dropped
+    S save = (S) "{[d;n;t] g:c where 98h=type each first each t c:cols t; .Q.dd[hsym d;n,`] set .Q.en[hsym d;$[count g;![t;();0b;g];t]]}";
+    for (size_t i = 0; i < tables.size(); i++) {
+        K r = k(0, save, ks((S) dest[0].c_str()), ks(names[i]), tables[i], (K) 0);
+        if (r && -128 == r->t) {
+            S error = r->s;
+            r0(r);
+            for (size_t j = i + 1; j < tables.size(); j++) r0(tables[j]);
+            r0(keys);
+            r0(rows);
+            return krr(error);
+        }
+        if (r) r0(r);
+    }
+
+    return xD(keys, rows);
+#else
+    return krr((S) "nyi");
+#endif
 }
 
 extern "C"
@@ -280,7 +1998,264 @@ K Create(K x, K y) {
 }
 
 extern "C"
-K OnRecv(K x) { return (K) 0; }
+K OnRecv(K x, K y) { return (K) 0; }
+
+// the spec the lazy message was indexed with, so its fields decode with the
+// FixedPoint and SymbolTags of the session that received it
+static const Spec& LazySpec(K x)
+{
+    uint32_t id = LazySpecId(x);
+    return id < specsById.size() ? *specsById[id] : *defaultSpec;
+}
+
+static bool IsTag(K x) { return -KJ == x->t || -KI == x->t || -KH == x->t; }
+static int TagValue(K x) { return -KJ == x->t ? (int) x->j : -KI == x->t ? x->i : x->h; }
+
+extern "C"
+K GetField(K x, K y)
+{
+    if (!IsLazy(x) || !IsTag(y)) {
+        return krr((S) "type");
+    }
+
+    return LazyGet(x, TagValue(y), LazySpec(x).types);
+}
+
+extern "C"
+K GetFields(K x, K y)
+{
+    if (!IsLazy(x) || (KJ != y->t && KI != y->t)) {
+        return krr((S) "type");
+    }
+
+    const Spec& spec = LazySpec(x);
+    K values = ktn(0, y->n);
+    for (J i = 0; i < y->n; i++) {
+        int tag = KJ == y->t ? (int) kJ(y)[i] : kI(y)[i];
+        K value = LazyGet(x, tag, spec.types);
+        if (!value) {
+            value = ka(101);
+            value->g = 0;
+        }
+        kK(values)[i] = value;
+    }
+
+    return values;
+}
+
+extern "C"
+K SetFilter(K x, K y)
+{
+    if (-11 != x->t) {
+        return krr((S) "type");
+    }
+
+    if (101 == y->t) {
+        FilterSet::remove(x->s);
+        return (K) 0;
+    }
+
+    if (KJ != y->t && KI != y->t && !(0 == y->t && 0 == y->n)) {
+        return krr((S) "type");
+    }
+
+    std::vector<int> tags;
+    for (J i = 0; i < y->n; i++) {
+        tags.push_back(KJ == y->t ? (int) kJ(y)[i] : kI(y)[i]);
+    }
+    FilterSet::set(x->s, tags);
+
+    return (K) 0;
+}
+
+/* SetSymbols:
+ *   .fix.symbols[tags] decodes tags as symbols in every session in place
+ *   of its SymbolTags setting, and .fix.symbols[::] goes back to the
+ *   settings. Each session moves to a copy of its spec with the tags
+ *   retyped, which its thread picks up from the next message; specs are
+ *   never freed, so a message being decoded keeps the one it started with.
+ */
+extern "C"
+K SetSymbols(K x)
+{
+    if (101 != x->t && KJ != x->t && KI != x->t && !(0 == x->t && 0 == x->n)) {
+        return krr((S) "type");
+    }
+
+    symbolOverride = 101 != x->t;
+    symbolTags.clear();
+    for (J i = 0; symbolOverride && i < x->n; i++) {
+        symbolTags.insert(KJ == x->t ? (int) kJ(x)[i] : kI(x)[i]);
+    }
+
+    for (auto& engine : engines) {
+        for (auto& session : engine.second->application->sessions) {
+            const Spec* spec = OptionsSpec(session.second);
+            session.second->spec.store(spec, std::memory_order_release);
+            specsByVersion[session.first.getBeginString().getString()] = spec;
+        }
+    }
+
+    return (K) 0;
+}
+
+/* SymbolStats:
+ *   The intern caches of every decoding thread as a dictionary of hits,
+ *   misses (values interned with sn), symbols held and evictions (values
+ *   that replaced another in a full cache), summed over the threads.
+ */
+extern "C"
+K SymbolStats(K x)
+{
+    J totals[4] = { 0, 0, 0, 0 };
+    InternCache::each([&](const InternCache::Stats& stats) {
+        totals[0] += (J) stats.hits.load(std::memory_order_relaxed);
+        totals[1] += (J) stats.misses.load(std::memory_order_relaxed);
+        totals[2] += (J) stats.symbols.load(std::memory_order_relaxed);
+        totals[3] += (J) stats.evictions.load(std::memory_order_relaxed);
+    });
+
+    const char* labels[] = { "hits", "misses", "symbols", "evictions" };
+    K keys = ktn(KS, 4);
+    K values = ktn(KJ, 4);
+    for (int i = 0; i < 4; i++) {
+        kS(keys)[i] = ss((S) labels[i]);
+        kJ(values)[i] = totals[i];
+    }
+
+    return xD(keys, values);
+}
+
+/* SetPublish:
+ *   .fix.publish[msgtype;table;tags] sends the given top level tags of every
+ *   inbound msgtype message to the tickerplant of each engine with
+ *   TickerplantPort set, as rows of table. A null table uses the message
+ *   name from the default spec, and tags of (::) stops publishing msgtype.
+ *   Publishing does not change delivery to .fix.onrecv, which
+ *   .fix.filter[msgtype;()] turns off.
+ */
+extern "C"
+K SetPublish(K x, K y, K z)
+{
+#ifndef WIN32
+    if (-KS != x->t || -KS != y->t) {
+        return krr((S) "type");
+    }
+
+    if (101 == z->t) {
+        PublishSet::remove(x->s);
+        return (K) 0;
+    }
+
+    if (KJ != z->t && KI != z->t) {
+        return krr((S) "type");
+    }
+
+    std::string table = y->s;
+    if (table.empty()) {
+        auto name = defaultSpec->msgnames.find(x->s);
+        table = name != defaultSpec->msgnames.end() ? name->second : std::string(x->s);
+    }
+
+    std::vector<int> tags;
+    for (J i = 0; i < z->n; i++) {
+        tags.push_back(KJ == z->t ? (int) kJ(z)[i] : kI(z)[i]);
+    }
+    PublishSet::set(x->s, table, tags);
+
+    return (K) 0;
+#else
+    return krr((S) "nyi");
+#endif
+}
+
+/* PublishStats:
+ *   The tickerplant publisher of every engine as a table of engine (the
+ *   handle from .fix.create), host, port, connected, rows (written to the
+ *   tickerplant), batches (.u.upd calls written), dropped (rows lost to a
+ *   full buffer), buffered (bytes waiting to be written) and connects.
+ */
+extern "C"
+K PublishStats(K x)
+{
+    K handles = ktn(KJ, 0);
+    K hosts = ktn(KS, 0);
+    K ports = ktn(KJ, 0);
+    K connected = ktn(KB, 0);
+    K rows = ktn(KJ, 0);
+    K batches = ktn(KJ, 0);
+    K dropped = ktn(KJ, 0);
+    K buffered = ktn(KJ, 0);
+    K connects = ktn(KJ, 0);
+
+#ifndef WIN32
+    for (auto& engine : engines) {
+        TickerplantPublisher* publisher = engine.second->application->publisher.get();
+        if (!publisher) continue;
+
+        J values[6] = {
+            (J) publisher->settings.port,
+            (J) publisher->published.load(std::memory_order_relaxed),
+            (J) publisher->batches.load(std::memory_order_relaxed),
+            (J) publisher->dropped.load(std::memory_order_relaxed),
+            (J) publisher->buffered.load(std::memory_order_relaxed),
+            (J) publisher->connects.load(std::memory_order_relaxed),
+        };
+        G up = publisher->connected.load(std::memory_order_relaxed);
+        ja(&handles, (V*) &engine.first);
+        js(&hosts, ss((S) publisher->settings.host.c_str()));
+        ja(&ports, &values[0]);
+        ja(&connected, &up);
+        ja(&rows, &values[1]);
+        ja(&batches, &values[2]);
+        ja(&dropped, &values[3]);
+        ja(&buffered, &values[4]);
+        ja(&connects, &values[5]);
+    }
+#endif
+
+    const char* labels[] = { "engine", "host", "port", "connected", "rows", "batches", "dropped", "buffered", "connects" };
+    K names = ktn(KS, 9);
+    for (int i = 0; i < 9; i++) kS(names)[i] = ss((S) labels[i]);
+
+    return xT(xD(names, knk(9, handles, hosts, ports, connected, rows, batches, dropped, buffered, connects)));
+}
+
+extern "C"
+K Orders(K x)
+{
+    return orderStore.table();
+}
+
+extern "C"
+K Order(K x, K y)
+{
+    if (-KS != x->t || (KC != y->t && -KS != y->t)) {
+        return krr((S) "type");
+    }
+
+    K state = KC == y->t ? orderStore.order(x->s, (const char*) kC(y), (size_t) y->n) : orderStore.order(x->s, y->s, strlen(y->s));
+    if (!state) {
+        state = ka(101);
+        state->g = 0;
+    }
+
+    return state;
+}
+
+extern "C"
+K ToDictionary(K x)
+{
+    if (XD == x->t) {
+        return r1(x);
+    }
+    if (!IsLazy(x)) {
+        return krr((S) "type");
+    }
+
+    const Spec& spec = LazySpec(x);
+    return LazyToDictionary(x, spec.types, spec.groups);
+}
 
 extern "C"
 K Version(K x){ 
@@ -315,8 +2290,8 @@ K LoadLibrary(K x)
     printf(" compiler flags » %-5s                              \n", BUILD_COMPILER_FLAGS);
     printf("████████████████████████████████████████████████████\n");
 
-    K keys = ktn(KS, 6);
-    K values = ktn(0, 6);
+    K keys = ktn(KS, 27);
+    K values = ktn(0, 27);
 
     kS(keys)[0] = ss((S) "initiator");
     kS(keys)[1] = ss((S) "acceptor");
@@ -324,244 +2299,72 @@ K LoadLibrary(K x)
     kS(keys)[3] = ss((S) "onrecv");
     kS(keys)[4] = ss((S) "create");
     kS(keys)[5] = ss((S) "version");
-
+    kS(keys)[6] = ss((S) "get");
+    kS(keys)[7] = ss((S) "getmany");
+    kS(keys)[8] = ss((S) "todict");
+    kS(keys)[9] = ss((S) "filter");
+    kS(keys)[10] = ss((S) "template");
+    kS(keys)[11] = ss((S) "sendt");
+    kS(keys)[12] = ss((S) "sendbatch");
+    kS(keys)[13] = ss((S) "stop");
+    kS(keys)[14] = ss((S) "orders");
+    kS(keys)[15] = ss((S) "order");
+    kS(keys)[16] = ss((S) "queues");
+    kS(keys)[17] = ss((S) "logstats");
+    kS(keys)[18] = ss((S) "readlog");
+    kS(keys)[19] = ss((S) "stats");
+    kS(keys)[20] = ss((S) "resetstats");
+    kS(keys)[21] = ss((S) "loadlog");
+    kS(keys)[22] = ss((S) "symbols");
+    kS(keys)[23] = ss((S) "symstats");
+    kS(keys)[24] = ss((S) "publish");
+    kS(keys)[25] = ss((S) "pubstats");
+    kS(keys)[26] = ss((S) "poll");
 
     kK(values)[0] = dl((void *) CreateInitiator, 1);
     kK(values)[1] = dl((void *) CreateAcceptor, 1);
     kK(values)[2] = dl((void *) SendMessageDict, 1);
-    kK(values)[3] = dl((void *) OnRecv, 1);
+    kK(values)[3] = dl((void *) OnRecv, 2);
     kK(values)[4] = dl((void *) Create, 2);
     kK(values)[5] = dl((void *) Version, 1);
-
-    CreateTypeMap();
+    kK(values)[6] = dl((void *) GetField, 2);
+    kK(values)[7] = dl((void *) GetFields, 2);
+    kK(values)[8] = dl((void *) ToDictionary, 1);
+    kK(values)[9] = dl((void *) SetFilter, 2);
+    kK(values)[10] = dl((void *) DefineTemplate, 3);
+    kK(values)[11] = dl((void *) SendTemplate, 2);
+    kK(values)[12] = dl((void *) SendBatch, 1);
+    kK(values)[13] = dl((void *) Stop, 1);
+    kK(values)[14] = dl((void *) Orders, 1);
+    kK(values)[15] = dl((void *) Order, 2);
+    kK(values)[16] = dl((void *) Queues, 1);
+    kK(values)[17] = dl((void *) LogStats, 1);
+    kK(values)[18] = dl((void *) ReadLog, 1);
+    kK(values)[19] = dl((void *) Stats, 1);
+    kK(values)[20] = dl((void *) ResetStats, 1);
+    kK(values)[21] = dl((void *) LoadLog, 2);
+    kK(values)[22] = dl((void *) SetSymbols, 1);
+    kK(values)[23] = dl((void *) SymbolStats, 1);
+    kK(values)[24] = dl((void *) SetPublish, 3);
+    kK(values)[25] = dl((void *) PublishStats, 1);
+    kK(values)[26] = dl((void *) Poll, 1);
+
+    defaultSpec = FindSpec("spec/FIX42.xml");
+    if (!defaultSpec) throw std::runtime_error("XML could not be loaded");
 
     return xD(keys, values);
 }
 
-void CreateTypeMap(void)
-{  
-    pugi::xml_document doc;
-    if(!doc.load_file("./spec/FIX42.xml")) throw std::runtime_error("XML could not be loaded");
-    pugi::xml_node fields = doc.child("fix").child("fields");
-    
-    for(pugi::xml_node field = fields.child("field"); field; field = field.next_sibling("field"))
-    {
-        int value = field.attribute("number").as_int();		
-        std::string fieldattr = typeconvert(field.attribute("type").value());
-        typemap.insert({value, fieldattr});
-    }   
-}
-
-std::string typeconvert(std::string s)
-{
-    std::unordered_map<std::string,std::string> typemapconvert = {
-        {"STRING","STRING"},
-        {"MULTIPLEVALUESTRING","STRING"},
-        {"PRICE","FLOAT"},
-        {"CHAR","CHAR"},
-        {"INT","INT"},
-        {"AMT","FLOAT"},
-        {"CURRENCY","FLOAT"},
-        {"QTY","FLOAT"},
-        {"EXCHANGE","SYM"},
-        {"UTCTIMESTAMP","TIMESTAMP"},
-        {"BOOLEAN","BOOLEAN"},
-        {"LOCALMKTDATE","DATE"},
-        {"DATA","STRING"},
-        {"LENGTH","FLOAT"},
-        {"FLOAT","FLOAT"},
-        {"PRICEOFFSET","FLOAT"},
-        {"MONTHYEAR","STRING"},
-        {"DAYOFMONTH","STRING"},
-        {"UTCDATE","DATE"},
-        {"UTCTIMEONLY","TIME"},
-        {"COUNTRY","STRING"},
-        {"DATE", "STRING"},
-        {"EXCHANGE", "SYM"},
-        {"LANGUAGE", "STRING"},
-        {"MULTIPLECHARVALUE", "STRING"},
-        {"MULTIPLESTRINGVALUE", "STRING"},
-        {"NUMINGROUP", "INT"},
-        {"PERCENTAGE", "FLOAT"},
-        {"PRICEOFFSET", "FLOAT"},
-        {"SEQNUM", "INT"},
-        {"TIME", "STRING"},
-        {"UTCDATE", "DATE"},
-        {"UTCTIMEONLY", "STRING"},
-    };
-
-    std::unordered_map<std::string,std::string>::const_iterator found = typemapconvert.find(s);
-    
-    if(found != typemapconvert.end() ){
-	    return found->second;
-    }
-    else{
-	    return "STRING";
-    }
-}
-
-
-
-struct Tm : std::tm {
-	  int tm_usecs;
-
-    Tm(const int year, const int month, const int mday, const int hour,
-       const int min, const int sec, const int usecs, const int isDST = -1)
-          : tm_usecs{usecs} {
-	      tm_year = year - 1900;
-     	      tm_mon = month - 1;
-	      tm_mday = mday;
-              tm_hour = hour;
-	      tm_min = min;
-              tm_sec = sec;
-	      tm_isdst = isDST;
-            }
-
-    template <typename Clock_t = std::chrono::high_resolution_clock> 
-    auto to_time_point() -> typename Clock_t::time_point {
-        auto time_c = mktime(this);
-        return Clock_t::from_time_t(time_c);
-    }
-};
-
-K pu(I x){
-    return k(0, (S) "`timestamp$", kz(x/8.64e4 - 10957), (K)0);
-};
-
-K strtotemporal(std::string datestring){
-
-    int year, month, day, hour, minute, second, ms;
-
-    sscanf(datestring.c_str(), 
-        "%4d%2d%2d-%2d:%2d:%2d.%3d", 
-        &year, 
-        &month, 
-        &day,
-        &hour,
-        &minute,
-        &second,
-        &ms);
-
-    auto tp_micro = Tm(year, month, day, hour, minute, second, ms).to_time_point(); 
-    K tp = pu(std::chrono::high_resolution_clock::to_time_t(tp_micro)); // ms from Unix epoch 
-    auto time = tp->j + ms*1e6;
-
-    return kj(time);
-}   
-
-int strtodate(std::string date){
-    int year, month, day;
-    sscanf(date.c_str(),
-        "%4d%2d%2d",
-	&year,
-	&month,
-	&day);
-    struct std::tm a = {0,0,0,day,month-1,year-1900};
-    struct std::tm b = {0,0,0,1,0,100};
-    std::time_t x = std::mktime(&a);
-    std::time_t y = std::mktime(&b);
-    int difference = std::difftime(x,y) / (60*60*24);
-    return difference;
-}
-
-int strtotime(std::string time){
-
-    int hour, minute, second;
-    sscanf(time.c_str(),
-	"%2d:%2d:%2d",
-	&hour,
-	&minute,
-	&second);
-    struct std::tm a = {second,minute,hour,1,0,0};
-    struct std::tm b = {0,0,0,1,0,0};
-    std::time_t x = std::mktime(&a);
-    std::time_t y = std::mktime(&b);
-    int difference = std::difftime(x,y) *1e3;
-    return difference;
-}
-
-K convertmsgtype(std::string field, std::string type)
-{
-
-    if("FLOAT"==type){
-        return kf(std::stof(field));
-    }
-    else if("STRING"==type){
-	return kp(const_cast<char *>(field.c_str()));
-    }
-    else if("INT"==type){
-        return ki(std::stoi(field));
-    }
-    else if("CHAR"==type){
-	char *c = &field[0u];
-	int d = c[0];
-	return kc(d);
-    }
-    else if("BOOLEAN"==type){
-        if("Y"==field){
-            return kb(1);
-        }
-	else{
-            return kb(0);
-	}	 
-    }
-    else if("TIMESTAMP"==type){
-	auto ts = strtotemporal(field);
-	return ktj(-KP,ts->j);
-    }
-    else if("DATE"==type){
-	auto date = strtodate(field);    
-        return kd(date);
-    }
-    else if("TIME"==type){
-	auto time = strtotime(field);
-        return kt(time);
-    }
-    else {
-	return kp(const_cast<char *>(field.c_str()));
-    }
-
-}
-
 std::string typedtostring(K x){
-     
-    if(-1==x->t){
-        if(1==x->g){
-            x = kp(const_cast<char *>("Y"));
-	}
-	else{
-            x = kp(const_cast<char *>("N"));
-	}
-    }
-    else if(x->t <= -2 && x->t >=-11){
-	x=k(0, (S) "string ", r1(x), (K)0);
-    }
-    else if(-12==x->t){
-        long kdbtime = x->j;
-        long unixtime = (kdbtime/8.64e13+10957)*8.64e4;
-        time_t seconds(unixtime);
-        tm *p = gmtime(&seconds);
-
-        char buffer[80]; // make a power of 2
-        strftime(buffer, 80, "%Y%m%d-%T.000", p);  
-
-        std::string timestr = std::to_string(kdbtime);
-			   
-        buffer[18] = timestr[9];
-        buffer[19] = timestr[10];
-        buffer[20] = timestr[11];
-	x = kp(buffer);
-    }
-    else if(-14==x->t){
-	x = k(0, (S) "{ssr[string x;\".\";\"\"]}", x, (K)0);
-    }
-
-    std::string rep("");
-   
-    for (int i = 0; i < x->n; i++) {
-        rep += kC(x)[i];
+    std::string rep;
+    if (encodefield(x, rep)) return rep;
+
+    // remaining atom types (month, minute, guid, ...) use q's own formatting
+    if (x->t < 0) {
+        K str = k(0, (S) "string ", r1(x), (K) 0);
+        if (str && KC == str->t) rep.assign((const char*) kC(str), (size_t) str->n);
+        if (str) r0(str);
     }
 
     return rep;
 }
-
@@ -0,0 +1,53 @@
+#ifndef KDBFIX_MESSAGE_H
+#define KDBFIX_MESSAGE_H
+
+#include <quickfix/Message.h>
+#include <quickfix/FieldMap.h>
+
+#include <kx/k.h>
+
+#include "decoder.h"
+#include "filter.h"
+#include "groups.h"
+
+/* WalkFields:
+ *   Passes every field of map to field(tag, value, length) in wire order.
+ *   When the session parsed repeating groups with its data dictionary, the
+ *   instances of each group follow their count field; otherwise the group
+ *   fields are already in place in the body.
+ */
+template<typename F>
+static void WalkFields(const FIX::FieldMap& map, F field)
+{
+    for (auto it = map.begin(); it != map.end(); it++) {
+        const std::string& str = it->getString();
+        field(it->getTag(), str.c_str(), str.size());
+
+        for (auto group = map.g_begin(); group != map.g_end(); group++) {
+            if (group->first != it->getTag()) continue;
+            for (auto instance : group->second) {
+                WalkFields(*instance, field);
+            }
+        }
+    }
+}
+
+template<typename F>
+static void WalkFields(const FIX::Message& message, F field)
+{
+    WalkFields(message.getHeader(), field);
+    WalkFields((const FIX::FieldMap&) message, field);
+    WalkFields(message.getTrailer(), field);
+}
+
+/* Conversions from a parsed FIX::Message into the tag to value dictionary
+ * passed to .fix.onrecv, with header, body and trailer fields in that order.
+ */
+static K ConvertToDictionary(const FIX::Message& message, const TagTable& table, const GroupTable& groups, const TagFilter* filter = nullptr)
+{
+    MessageBuilder builder(table, groups, filter);
+    WalkFields(message, [&](int tag, const char* value, size_t len) { builder.add(tag, value, len); });
+    return builder.finish();
+}
+
+#endif
@@ -0,0 +1,433 @@
+#ifndef KDBFIX_MMAPSTORE_H
+#define KDBFIX_MMAPSTORE_H
+
+#include <quickfix/Exceptions.h>
+#include <quickfix/MessageStore.h>
+#include <quickfix/SessionSettings.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* MmapStore:
+ *   A QuickFIX message store kept in memory mapped files. Outbound messages
+ *   are appended to pre-allocated segment files as a small header (length
+ *   and MsgSeqNum) followed by the message, and the sequence numbers and
+ *   creation time live in a mapped state page, so storing a message or
+ *   bumping a sequence number is a memcpy with no system call. The position
+ *   of every message is indexed by MsgSeqNum in memory, so a resend copies
+ *   the messages straight out of the mapping.
+ *
+ *   Segments are scanned to rebuild the index when the store is opened. A
+ *   zero length header ends the valid data, one is written after every
+ *   message so that a reset store never picks up older messages.
+ *
+ *   The files are only flushed to disk by the kernel unless StoreSync asks
+ *   for it: message syncs each message and sequence number change before
+ *   returning, batch syncs whatever changed every StoreSyncInterval ms.
+ */
+enum StoreSync
+{
+    STORE_SYNC_NONE,
+    STORE_SYNC_MESSAGE,
+    STORE_SYNC_BATCH
+};
+
+// the MessageStore interface is declared with exception specifications
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated"
+
+class MmapStore : public FIX::MessageStore
+{
+    public:
+    MmapStore(const std::string& prefix, size_t segmentSize, StoreSync sync)
+        : prefix(prefix), segmentSize(segmentSize), sync(sync), state(nullptr), written(0), dirty(false)
+    {
+        statefd = open((prefix + ".state").c_str(), O_RDWR | O_CREAT, 0644);
+        if (-1 == statefd || 0 != ftruncate(statefd, STATE_SIZE)) {
+            throw FIX::ConfigError("unable to open store " + prefix + ".state");
+        }
+
+        void* p = mmap(nullptr, STATE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, statefd, 0);
+        if (MAP_FAILED == p) {
+            close(statefd);
+            throw FIX::ConfigError("unable to map store " + prefix + ".state");
+        }
+        state = (State*) p;
+
+        if (STATE_MAGIC != state->magic) {
+            initialise();
+        }
+        load();
+    }
+
+    ~MmapStore()
+    {
+        for (Segment& segment : segments) unmap(segment);
+        munmap(state, STATE_SIZE);
+        close(statefd);
+    }
+
+    bool set(int seqnum, const std::string& message) throw (FIX::IOException)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        size_t needed = align(sizeof(Record) + message.size()) + sizeof(Record);
+        if (segments.empty() || written + needed > segments.back().size) {
+            extend(needed);
+        }
+
+        Segment& segment = segments.back();
+        size_t offset = written;
+        Record record = { (uint32_t) message.size(), seqnum };
+        memcpy(segment.data + offset + sizeof(Record), message.data(), message.size());
+        memset(segment.data + offset + align(sizeof(Record) + message.size()), 0, sizeof(Record));
+        memcpy(segment.data + offset, &record, sizeof(Record));
+        written = offset + align(sizeof(Record) + message.size());
+
+        index(seqnum, Location{ (uint32_t) (segments.size() - 1), (uint32_t) offset, record.length });
+        changed(segment, offset, needed);
+
+        return true;
+    }
+
+    void get(int begin, int end, std::vector<std::string>& messages) const throw (FIX::IOException)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        messages.clear();
+        for (int seqnum = std::max(begin, 1); seqnum <= end && (size_t) seqnum < locations.size(); seqnum++) {
+            const Location& location = locations[seqnum];
+            if (!location.length) continue;
+
+            const char* data = segments[location.segment].data + location.offset + sizeof(Record);
+            messages.push_back(std::string(data, location.length));
+        }
+    }
+
+    int getNextSenderMsgSeqNum() const throw (FIX::IOException) { return state->nextSender; }
+    int getNextTargetMsgSeqNum() const throw (FIX::IOException) { return state->nextTarget; }
+
+    void setNextSenderMsgSeqNum(int value) throw (FIX::IOException) { update(&State::nextSender, value); }
+    void setNextTargetMsgSeqNum(int value) throw (FIX::IOException) { update(&State::nextTarget, value); }
+    void incrNextSenderMsgSeqNum() throw (FIX::IOException) { update(&State::nextSender, state->nextSender + 1); }
+    void incrNextTargetMsgSeqNum() throw (FIX::IOException) { update(&State::nextTarget, state->nextTarget + 1); }
+
+    FIX::UtcTimeStamp getCreationTime() const throw (FIX::IOException) { return FIX::UtcTimeStamp((time_t) state->creation); }
+
+    void reset() throw (FIX::IOException)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        for (size_t n = segments.size(); n-- > 1;) {
+            unmap(segments[n]);
+            unlink(segmentPath(n).c_str());
+        }
+        segments.resize(std::min<size_t>(segments.size(), 1));
+        if (!segments.empty()) {
+            memset(segments[0].data, 0, sizeof(Record));
+            changed(segments[0], 0, sizeof(Record));
+        }
+
+        initialise();
+        written = 0;
+        locations.clear();
+    }
+
+    void refresh() throw (FIX::IOException)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        for (Segment& segment : segments) unmap(segment);
+        segments.clear();
+        locations.clear();
+        load();
+    }
+
+    // writes back whatever changed since the last flush, for StoreSync=batch
+    void flush()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!dirty) return;
+
+        for (Segment& segment : segments) {
+            if (segment.dirtyEnd > segment.dirtyBegin) {
+                msyncrange(segment.data, segment.dirtyBegin, segment.dirtyEnd);
+                segment.dirtyBegin = segment.dirtyEnd = 0;
+            }
+        }
+        msync(state, STATE_SIZE, MS_SYNC);
+        dirty = false;
+    }
+
+    private:
+    static const size_t STATE_SIZE = 4096;
+    static const uint64_t STATE_MAGIC = 0x315453504d4d4651ULL;   // "QFMMPST1"
+
+    struct State
+    {
+        uint64_t magic;
+        int64_t creation;
+        int32_t nextSender;
+        int32_t nextTarget;
+    };
+
+    struct Record
+    {
+        uint32_t length;
+        int32_t seqnum;
+    };
+
+    struct Location
+    {
+        uint32_t segment;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct Segment
+    {
+        char* data;
+        size_t size;
+        int fd;
+        size_t dirtyBegin;
+        size_t dirtyEnd;
+    };
+
+    static size_t align(size_t n) { return (n + 7) & ~(size_t) 7; }
+
+    std::string segmentPath(size_t n) const { return prefix + "." + std::to_string(n); }
+
+    void initialise()
+    {
+        state->creation = (int64_t) time(nullptr);
+        state->nextSender = 1;
+        state->nextTarget = 1;
+        state->magic = STATE_MAGIC;
+        if (STORE_SYNC_MESSAGE == sync) {
+            msync(state, STATE_SIZE, MS_SYNC);
+        }
+        dirty = true;
+    }
+
+    // maps the existing segments and indexes the messages in them
+    void load()
+    {
+        written = 0;
+        for (size_t n = 0;; n++) {
+            int fd = open(segmentPath(n).c_str(), O_RDWR);
+            if (-1 == fd) break;
+
+            struct stat info;
+            if (0 != fstat(fd, &info) || (size_t) info.st_size < sizeof(Record)) {
+                close(fd);
+                break;
+            }
+            segments.push_back(map(fd, (size_t) info.st_size));
+
+            Segment& segment = segments.back();
+            size_t offset = 0;
+            for (;;) {
+                Record record;
+                if (offset + sizeof(Record) > segment.size) break;
+                memcpy(&record, segment.data + offset, sizeof(Record));
+                if (!record.length || offset + sizeof(Record) + record.length > segment.size) break;
+
+                index(record.seqnum, Location{ (uint32_t) n, (uint32_t) offset, record.length });
+                offset += align(sizeof(Record) + record.length);
+            }
+            written = offset;
+        }
+    }
+
+    // starts a new segment large enough for needed bytes
+    void extend(size_t needed)
+    {
+        size_t n = segments.size();
+        size_t size = std::max(segmentSize, needed);
+
+        int fd = open(segmentPath(n).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (-1 == fd || 0 != ftruncate(fd, (off_t) size)) {
+            if (-1 != fd) close(fd);
+            throw FIX::IOException("unable to create store segment " + segmentPath(n));
+        }
+
+        segments.push_back(map(fd, size));
+        written = 0;
+    }
+
+    Segment map(int fd, size_t size)
+    {
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (MAP_FAILED == p) {
+            close(fd);
+            throw FIX::IOException("unable to map store segment");
+        }
+        return Segment{ (char*) p, size, fd, 0, 0 };
+    }
+
+    static void unmap(Segment& segment)
+    {
+        munmap(segment.data, segment.size);
+        close(segment.fd);
+    }
+
+    void index(int seqnum, const Location& location)
+    {
+        if (seqnum < 1) return;
+        if ((size_t) seqnum >= locations.size()) {
+            locations.resize(std::max((size_t) seqnum + 1, locations.size() * 2), Location{ 0, 0, 0 });
+        }
+        locations[seqnum] = location;
+    }
+
+    void update(int32_t State::*field, int value)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        state->*field = value;
+        if (STORE_SYNC_MESSAGE == sync) {
+            msync(state, STATE_SIZE, MS_SYNC);
+        }
+        dirty = true;
+    }
+
+    void changed(Segment& segment, size_t offset, size_t length)
+    {
+        if (STORE_SYNC_MESSAGE == sync) {
+            msyncrange(segment.data, offset, offset + length);
+            return;
+        }
+
+        if (segment.dirtyEnd == segment.dirtyBegin) {
+            segment.dirtyBegin = offset;
+        }
+        segment.dirtyBegin = std::min(segment.dirtyBegin, offset);
+        segment.dirtyEnd = std::max(segment.dirtyEnd, offset + length);
+        dirty = true;
+    }
+
+    static void msyncrange(char* data, size_t begin, size_t end)
+    {
+        static const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        size_t first = begin & ~(page - 1);
+        msync(data + first, end - first, MS_SYNC);
+    }
+
+    std::string prefix;
+    size_t segmentSize;
+    StoreSync sync;
+
+    int statefd;
+    State* state;
+    std::vector<Segment> segments;
+    std::vector<Location> locations;
+    size_t written;
+    bool dirty;
+    mutable std::mutex lock;
+};
+
+#pragma GCC diagnostic pop
+
+/* MmapStoreFactory:
+ *   Creates an MmapStore for each session in its FileStorePath, named like
+ *   the files of FIX::FileStore. SegmentSize (default 64MB) sets the size of
+ *   each pre-allocated segment. Stores with StoreSync=batch are flushed by a
+ *   thread owned by the factory.
+ */
+class MmapStoreFactory : public FIX::MessageStoreFactory
+{
+    public:
+    explicit MmapStoreFactory(const FIX::SessionSettings& settings)
+        : settings(settings), interval(100), stopping(false)
+    {
+        const FIX::Dictionary& defaults = settings.get();
+        if (defaults.has("StoreSyncInterval") && defaults.getInt("StoreSyncInterval") > 0) {
+            interval = defaults.getInt("StoreSyncInterval");
+        }
+    }
+
+    ~MmapStoreFactory()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        if (flusher.joinable()) flusher.join();
+    }
+
+    FIX::MessageStore* create(const FIX::SessionID& sessionID)
+    {
+        const FIX::Dictionary& dict = settings.get(sessionID);
+
+        std::string path = dict.has("FileStorePath") ? dict.getString("FileStorePath") : ".";
+        mkdir(path.c_str(), 0755);
+
+        std::string prefix = path + "/" + sessionID.getBeginString().getString() + "-" + sessionID.getSenderCompID().getString() + "-" + sessionID.getTargetCompID().getString();
+        if (!sessionID.getSessionQualifier().empty()) {
+            prefix += "-" + sessionID.getSessionQualifier();
+        }
+
+        size_t segmentSize = 64 << 20;
+        if (dict.has("SegmentSize") && dict.getInt("SegmentSize") > 0) {
+            segmentSize = (size_t) dict.getInt("SegmentSize");
+        }
+
+        StoreSync sync = STORE_SYNC_NONE;
+        std::string policy = dict.has("StoreSync") ? dict.getString("StoreSync") : "none";
+        if ("message" == policy) sync = STORE_SYNC_MESSAGE;
+        else if ("batch" == policy) sync = STORE_SYNC_BATCH;
+
+        auto store = new MmapStore(prefix + ".mmap", segmentSize, sync);
+        if (STORE_SYNC_BATCH == sync) {
+            std::lock_guard<std::mutex> guard(lock);
+            batched.insert(store);
+            if (!flusher.joinable()) flusher = std::thread([this] { run(); });
+        }
+
+        return store;
+    }
+
+    void destroy(FIX::MessageStore* store)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            batched.erase((MmapStore*) store);
+        }
+        delete store;
+    }
+
+    private:
+    void run()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        while (!stopping) {
+            wakeup.wait_for(guard, std::chrono::milliseconds(interval));
+            for (MmapStore* store : batched) store->flush();
+        }
+    }
+
+    const FIX::SessionSettings& settings;
+    int interval;
+    bool stopping;
+    std::set<MmapStore*> batched;
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::thread flusher;
+};
+
+#endif
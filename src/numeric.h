@@ -0,0 +1,267 @@
+#ifndef KDBFIX_NUMERIC_H
+#define KDBFIX_NUMERIC_H
+
+#include <kx/k.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <locale.h>
+#include <string>
+
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
+
+/* Numbers:
+ *   FIX numbers are an optional sign, digits and an optional decimal point,
+ *   with no exponent, grouping or locale. These parse them in one pass over
+ *   a pointer and a length without throwing, and format them back without
+ *   printf, which are the two costs of strtof and snprintf on the hot path.
+ */
+static const double exactpowers[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// the digits of a decimal, value = mantissa * 10^exponent
+struct DecimalDigits
+{
+    uint64_t mantissa;      // the first 19 significant digits
+    int exponent;
+    bool negative;
+    bool truncated;         // a non-zero digit past the first 19 was dropped
+};
+
+// splits str into its digits, false if it is not a FIX decimal
+inline bool scandecimal(const char* str, size_t len, DecimalDigits* d)
+{
+    const char* p = str;
+    const char* end = str + len;
+    d->mantissa = 0;
+    d->exponent = 0;
+    d->negative = false;
+    d->truncated = false;
+
+    if (p < end && ('-' == *p || '+' == *p)) d->negative = '-' == *p++;
+
+    int significant = 0;
+    bool digits = false, point = false;
+    for (; p < end; p++) {
+        unsigned digit = (unsigned) (*p - '0');
+        if (digit < 10) {
+            digits = true;
+            if (!d->mantissa && !digit) {
+                if (point) d->exponent--;
+            } else if (significant < 19) {
+                d->mantissa = d->mantissa * 10 + digit;
+                significant++;
+                if (point) d->exponent--;
+            } else {
+                d->truncated |= 0 != digit;
+                if (!point) d->exponent++;
+            }
+        } else if ('.' == *p && !point) {
+            point = true;
+        } else {
+            return false;
+        }
+    }
+    return digits;
+}
+
+// strtod in the C locale, for the decimals parsedecimal cannot do exactly
+inline double parsedecimalslow(const char* str, size_t len)
+{
+    char buffer[64];
+    std::string copy;
+    const char* text = buffer;
+    if (len < sizeof buffer) {
+        memcpy(buffer, str, len);
+        buffer[len] = '\0';
+    } else {
+        copy.assign(str, len);
+        text = copy.c_str();
+    }
+
+#ifdef WIN32
+    static _locale_t c = _create_locale(LC_ALL, "C");
+    return _strtod_l(text, NULL, c);
+#else
+    static locale_t c = newlocale(LC_ALL_MASK, "C", (locale_t) 0);
+    return strtod_l(text, NULL, c);
+#endif
+}
+
+/* parsedecimal:
+ *   The double nearest to a FIX decimal, the same value strtod gives, or a
+ *   null float if str is not a decimal. When the significant digits fit in
+ *   a double's mantissa and there are at most 22 decimal places both the
+ *   digits and the power of ten are exact, so one multiply or divide rounds
+ *   correctly. That covers prices and quantities; longer numbers go to
+ *   strtod.
+ */
+inline F parsedecimal(const char* str, size_t len)
+{
+    DecimalDigits d;
+    if (!scandecimal(str, len, &d)) return nf;
+
+    if (d.truncated || d.mantissa > ((uint64_t) 1 << 53) || d.exponent < -22 || d.exponent > 22) {
+        return parsedecimalslow(str, len);
+    }
+
+    double v = (double) d.mantissa;
+    v = d.exponent < 0 ? v / exactpowers[-d.exponent] : v * exactpowers[d.exponent];
+    return d.negative ? -v : v;
+}
+
+/* parsefixed:
+ *   A FIX decimal times 10^scale as a long, rounding half away from zero
+ *   at the first dropped digit, so that sums of prices and amounts are
+ *   exact in q. A null long if str is not a decimal or does not fit.
+ */
+inline J parsefixed(const char* str, size_t len, int scale)
+{
+    const char* p = str;
+    const char* end = str + len;
+    bool negative = false;
+    if (p < end && ('-' == *p || '+' == *p)) negative = '-' == *p++;
+
+    const uint64_t limit = (uint64_t) INT64_MAX;
+    uint64_t v = 0;
+    int decimals = -1;          // decimal places kept, -1 before the point
+    bool digits = false, roundup = false, rounded = false;
+    for (; p < end; p++) {
+        unsigned digit = (unsigned) (*p - '0');
+        if (digit < 10) {
+            digits = true;
+            if (decimals >= scale) {
+                if (!rounded) roundup = digit >= 5;
+                rounded = true;
+                continue;
+            }
+            if (v > (limit - digit) / 10) return nj;
+            v = v * 10 + digit;
+            if (decimals >= 0) decimals++;
+        } else if ('.' == *p && decimals < 0) {
+            decimals = 0;
+        } else {
+            return nj;
+        }
+    }
+    if (!digits) return nj;
+
+    for (int i = decimals < 0 ? 0 : decimals; i < scale; i++) {
+        if (v > limit / 10) return nj;
+        v *= 10;
+    }
+    if (roundup && ++v > limit) return nj;
+    return negative ? -(J) v : (J) v;
+}
+
+// a FIX int, a null int if str is not an integer or does not fit
+inline I parseint(const char* str, size_t len)
+{
+    const char* p = str;
+    const char* end = str + len;
+    bool negative = false;
+    if (p < end && ('-' == *p || '+' == *p)) negative = '-' == *p++;
+    if (p == end) return ni;
+
+    int64_t v = 0;
+    for (; p < end; p++) {
+        unsigned digit = (unsigned) (*p - '0');
+        if (digit >= 10) return ni;
+        v = v * 10 + digit;
+        if (v > 2147483647) return ni;
+    }
+    return (I) (negative ? -v : v);
+}
+
+// the integer nearest a * scale, or a / scale, judged on the exact result
+// with ties to even as printf rounds. fma gives the error of the rounded
+// product or quotient, which only matters when that looks like a tie.
+inline uint64_t roundscaled(double a, double scale, bool divide)
+{
+    double x = divide ? a / scale : a * scale;
+    uint64_t m = (uint64_t) (x + 0.5);
+    if ((double) m - x == 0.5) {
+        double error = divide ? std::fma(-x, scale, a) : std::fma(a, scale, -x);
+        if (error < 0 || (0 == error && (m & 1))) m--;
+    }
+    return m;
+}
+
+/* formatdecimal:
+ *   Writes v to buffer in plain decimal notation, as FIX has no exponents,
+ *   and returns the length. It uses the fewest decimal places that read
+ *   back as v within precision significant digits, and otherwise v rounded
+ *   to precision significant digits, so the text is what %.*g prints
+ *   whenever that is not an exponent, except that -0 is written as 0.
+ *   Magnitudes outside 1e-7 to 1e15 are left to snprintf. The buffer needs
+ *   32 bytes and precision is at most 15.
+ */
+inline size_t formatdecimal(char* buffer, double v, int precision)
+{
+    double a = v < 0 ? -v : v;
+    if (0 == a) {
+        buffer[0] = '0';
+        return 1;
+    }
+    if (!(a >= 1e-7 && a < 1e15)) {
+        int n = snprintf(buffer, 32, "%.*g", precision, v);
+        return n < 0 ? 0 : (size_t) n;
+    }
+
+    // the decimal exponent of the leading digit
+    int e = 0;
+    if (a >= 1) {
+        while (a >= exactpowers[e + 1]) e++;
+    } else {
+        while (a * exactpowers[-e] < 1) e--;
+    }
+
+    // m stays below 10^precision so it and m / 10^places are exact
+    int most = precision - 1 - e;
+    int places = 0, zeros = 0;
+    uint64_t m;
+    if (most < 0) {
+        zeros = -most;
+        m = roundscaled(a, exactpowers[zeros], true);
+    } else {
+        m = roundscaled(a, 1, false);
+        while ((double) m / exactpowers[places] != a && places < most) {
+            places++;
+            m = roundscaled(a, exactpowers[places], false);
+        }
+    }
+    while (places > 0 && 0 == m % 10) {
+        m /= 10;
+        places--;
+    }
+
+    char digits[24];
+    int count = 0;
+    do {
+        digits[count++] = (char) ('0' + m % 10);
+        m /= 10;
+    } while (m);
+
+    char* p = buffer;
+    if (v < 0) *p++ = '-';
+    if (count <= places) {
+        *p++ = '0';
+        *p++ = '.';
+        for (int i = count; i < places; i++) *p++ = '0';
+    }
+    for (int i = count - 1; i >= 0; i--) {
+        *p++ = digits[i];
+        if (i == places && i > 0) *p++ = '.';
+    }
+    for (int i = 0; i < zeros; i++) *p++ = '0';
+    return (size_t) (p - buffer);
+}
+
+#endif
@@ -0,0 +1,355 @@
+#ifndef KDBFIX_ORDERS_H
+#define KDBFIX_ORDERS_H
+
+#include <kx/k.h>
+
+#include "columns.h"
+#include "numeric.h"
+#include "temporal.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+/* Order state:
+ *   The latest state of every order seen by sessions with OrderCache=Y, so
+ *   that q can look orders up without keeping a keyed table of execution
+ *   reports itself. An order is created by the NewOrderSingle sent for it or
+ *   by the first ExecutionReport received for it, and is kept for the life
+ *   of the process.
+ */
+
+// a string held in the arena of an OrderStore
+struct ArenaString
+{
+    uint32_t offset = 0;
+    uint32_t length = 0;
+};
+
+struct OrderState
+{
+    S session = nullptr;
+    ArenaString clordid;
+    ArenaString orderid;
+    ArenaString symbol;
+    char side = ' ';
+    char status = ' ';
+    double orderqty = nf;
+    double cumqty = nf;
+    double leavesqty = nf;
+    double avgpx = nf;
+    double lastqty = nf;
+    double lastpx = nf;
+    J transacttime = nj;
+    J created = nj;
+    J updated = nj;
+};
+
+/* OrderEvent:
+ *   The order fields of one message, collected in wire order. Values point
+ *   into the message and are only valid while it is.
+ */
+struct OrderEvent
+{
+    struct Value
+    {
+        const char* data = nullptr;
+        size_t length = 0;
+
+        void set(const char* value, size_t len) { if (!data) { data = value; length = len; } }
+        double number() const { return parsedecimal(data, length); }
+        explicit operator bool() const { return data && length; }
+    };
+
+    Value clordid, origclordid, orderid, symbol, side, status;
+    Value orderqty, cumqty, leavesqty, avgpx, lastqty, lastpx, transacttime;
+    bool possdup = false;
+
+    void add(int tag, const char* value, size_t len)
+    {
+        switch (tag) {
+            case 11: clordid.set(value, len); break;
+            case 41: origclordid.set(value, len); break;
+            case 37: orderid.set(value, len); break;
+            case 55: symbol.set(value, len); break;
+            case 54: side.set(value, len); break;
+            case 39: status.set(value, len); break;
+            case 38: orderqty.set(value, len); break;
+            case 14: cumqty.set(value, len); break;
+            case 151: leavesqty.set(value, len); break;
+            case 6: avgpx.set(value, len); break;
+            case 32: lastqty.set(value, len); break;
+            case 31: lastpx.set(value, len); break;
+            case 60: transacttime.set(value, len); break;
+            case 43: possdup = 1 == len && 'Y' == value[0]; break;
+        }
+    }
+};
+
+/* OrderStore:
+ *   Orders in insertion order with their strings in one arena, indexed by
+ *   session and ClOrdID and by session and OrderID with open addressing
+ *   (linear probing over a power of two table holding the position of the
+ *   order plus one), so sessions that reuse an ID never share an order.
+ *   Sessions are interned symbols and compared by address. Session
+ *   threads update it from execution reports and the q thread from the
+ *   orders it sends, so every call takes the lock.
+ */
+class OrderStore
+{
+    public:
+    OrderStore() : byclordid(1024, 0), byorderid(1024, 0) {}
+
+    OrderStore(const OrderStore&) = delete;
+    OrderStore& operator=(const OrderStore&) = delete;
+
+    /* received:
+     *   Applies an ExecutionReport received on session. A report for an
+     *   unknown ClOrdID that names an OrigClOrdID starts a new order from the
+     *   state of the original (cancel/replace). Returns true if the report
+     *   created the order or changed its OrdStatus.
+     */
+    bool received(S session, const OrderEvent& event)
+    {
+        if (!event.clordid && !event.orderid) return false;
+
+        std::lock_guard<std::mutex> guard(lock);
+
+        OrderState* order = event.clordid ? find(byclordid, &OrderState::clordid, session, event.clordid) : nullptr;
+        if (!order && event.clordid && event.origclordid) {
+            OrderState* original = find(byclordid, &OrderState::clordid, session, event.origclordid);
+            if (original) {
+                OrderState copy = *original;
+                order = create(session, event.clordid);
+                copy.clordid = order->clordid;
+                copy.created = order->created;
+                *order = copy;
+                if (order->orderid.length) index(byorderid, &OrderState::orderid, *order);
+            }
+        }
+        if (!order && !event.clordid) {
+            order = find(byorderid, &OrderState::orderid, session, event.orderid);
+        }
+        if (!order) {
+            order = create(session, event.clordid);
+        }
+
+        char previous = order->status;
+        update(*order, event);
+        if (event.status) order->status = event.status.data[0];
+        if (event.cumqty) order->cumqty = event.cumqty.number();
+        if (event.leavesqty) order->leavesqty = event.leavesqty.number();
+        if (event.avgpx) order->avgpx = event.avgpx.number();
+        if (event.lastqty) order->lastqty = event.lastqty.number();
+        if (event.lastpx) order->lastpx = event.lastpx.number();
+        if (event.transacttime) order->transacttime = parsetimestamp(event.transacttime.data, event.transacttime.length);
+
+        return order->status != previous;
+    }
+
+    /* sent:
+     *   Applies an order message sent on session. NewOrderSingle (D) creates
+     *   the order as pending new, OrderCancelReplaceRequest (G) and
+     *   OrderCancelRequest (F) mark the original order pending replace or
+     *   pending cancel until the counterparty reports on it.
+     */
+    void sent(S session, char msgtype, const OrderEvent& event)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if ('D' == msgtype && event.clordid) {
+            OrderState* order = find(byclordid, &OrderState::clordid, session, event.clordid);
+            if (order) return;
+
+            order = create(session, event.clordid);
+            update(*order, event);
+            order->status = 'A';
+            order->cumqty = 0;
+            order->leavesqty = order->orderqty;
+        } else if (('G' == msgtype || 'F' == msgtype) && event.origclordid) {
+            OrderState* order = find(byclordid, &OrderState::clordid, session, event.origclordid);
+            if (!order) return;
+
+            order->status = 'G' == msgtype ? 'E' : '6';
+            order->updated = currenttimestamp();
+        }
+    }
+
+    // every order as a table, in the order they were first seen
+    K table()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        K columns = ktn(0, COLUMN_COUNT);
+        for (int c = 0; c < COLUMN_COUNT; c++) {
+            K column = ktn(type(c), (J) orders.size());
+            for (size_t row = 0; row < orders.size(); row++) {
+                K atom = value(orders[row], c);
+                SetColumnValue(column, type(c), (J) row, atom);
+                r0(atom);
+            }
+            kK(columns)[c] = column;
+        }
+
+        return xT(xD(names(), columns));
+    }
+
+    // the state of the order of session with ClOrdID key as a dictionary, or
+    // 0 if unknown
+    K order(S session, const char* key, size_t len)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        OrderEvent::Value id;
+        id.set(key, len);
+        OrderState* found = find(byclordid, &OrderState::clordid, session, id);
+        if (!found) return (K) 0;
+
+        K values = ktn(0, COLUMN_COUNT);
+        for (int c = 0; c < COLUMN_COUNT; c++) {
+            kK(values)[c] = value(*found, c);
+        }
+
+        return xD(names(), values);
+    }
+
+    private:
+    static const int COLUMN_COUNT = 15;
+
+    static K names()
+    {
+        static const char* columnnames[COLUMN_COUNT] = {
+            "session", "clOrdID", "orderID", "symbol", "side", "status", "orderQty", "cumQty",
+            "leavesQty", "avgPx", "lastQty", "lastPx", "transactTime", "created", "updated"
+        };
+
+        K x = ktn(KS, COLUMN_COUNT);
+        for (int c = 0; c < COLUMN_COUNT; c++) kS(x)[c] = ss((S) columnnames[c]);
+        return x;
+    }
+
+    static I type(int column)
+    {
+        static const I columntypes[COLUMN_COUNT] = { KS, 0, 0, KS, KC, KC, KF, KF, KF, KF, KF, KF, KP, KP, KP };
+        return columntypes[column];
+    }
+
+    K value(const OrderState& order, int column) const
+    {
+        switch (column) {
+            case 0: return ks(order.session ? order.session : (S) "");
+            case 1: return text(order.clordid);
+            case 2: return text(order.orderid);
+            case 3: return ks(sn((S) (arena.data() + order.symbol.offset), (I) order.symbol.length));
+            case 4: return kc(order.side);
+            case 5: return kc(order.status);
+            case 6: return kf(order.orderqty);
+            case 7: return kf(order.cumqty);
+            case 8: return kf(order.leavesqty);
+            case 9: return kf(order.avgpx);
+            case 10: return kf(order.lastqty);
+            case 11: return kf(order.lastpx);
+            case 12: return ktj(-KP, order.transacttime);
+            case 13: return ktj(-KP, order.created);
+            default: return ktj(-KP, order.updated);
+        }
+    }
+
+    K text(const ArenaString& s) const { return kpn((S) (arena.data() + s.offset), (J) s.length); }
+
+    // fields common to sent and received messages
+    void update(OrderState& order, const OrderEvent& event)
+    {
+        if (event.orderid && !equals(order.orderid, event.orderid)) {
+            order.orderid = intern(event.orderid);
+            index(byorderid, &OrderState::orderid, order);
+        }
+        if (event.symbol && !equals(order.symbol, event.symbol)) order.symbol = intern(event.symbol);
+        if (event.side) order.side = event.side.data[0];
+        if (event.orderqty) order.orderqty = event.orderqty.number();
+        order.updated = currenttimestamp();
+    }
+
+    OrderState* create(S session, const OrderEvent::Value& clordid)
+    {
+        if (2 * (orders.size() + 1) > byclordid.size()) grow();
+
+        orders.push_back(OrderState());
+        OrderState& order = orders.back();
+        order.session = session;
+        order.created = currenttimestamp();
+        if (clordid) {
+            order.clordid = intern(clordid);
+            index(byclordid, &OrderState::clordid, order);
+        }
+        return &order;
+    }
+
+    ArenaString intern(const OrderEvent::Value& value)
+    {
+        ArenaString s;
+        s.offset = (uint32_t) arena.size();
+        s.length = (uint32_t) value.length;
+        arena.insert(arena.end(), value.data, value.data + value.length);
+        return s;
+    }
+
+    bool equals(const ArenaString& s, const OrderEvent::Value& value) const
+    {
+        return s.length == value.length && 0 == memcmp(arena.data() + s.offset, value.data, value.length);
+    }
+
+    static size_t hash(S session, const char* data, size_t len)
+    {
+        uint64_t h = 14695981039346656037ULL ^ (uint64_t) (uintptr_t) session;
+        for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char) data[i]) * 1099511628211ULL;
+        return (size_t) h;
+    }
+
+    // the slot holding session's key, or the empty slot where it would go
+    size_t probe(const std::vector<uint32_t>& slots, ArenaString OrderState::*field, S session, const char* key, size_t len) const
+    {
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash(session, key, len) & mask;; i = (i + 1) & mask) {
+            if (!slots[i]) return i;
+
+            const OrderState& order = orders[slots[i] - 1];
+            const ArenaString& s = order.*field;
+            if (order.session == session && s.length == len && 0 == memcmp(arena.data() + s.offset, key, len)) return i;
+        }
+    }
+
+    OrderState* find(const std::vector<uint32_t>& slots, ArenaString OrderState::*field, S session, const OrderEvent::Value& key)
+    {
+        uint32_t slot = slots[probe(slots, field, session, key.data, key.length)];
+        return slot ? &orders[slot - 1] : nullptr;
+    }
+
+    // points the order's session and key at it, replacing an older order
+    // with the same ones
+    void index(std::vector<uint32_t>& slots, ArenaString OrderState::*field, const OrderState& order)
+    {
+        const ArenaString& s = order.*field;
+        slots[probe(slots, field, order.session, arena.data() + s.offset, s.length)] = (uint32_t) (&order - orders.data()) + 1;
+    }
+
+    void grow()
+    {
+        byclordid.assign(byclordid.size() * 2, 0);
+        byorderid.assign(byorderid.size() * 2, 0);
+        for (const OrderState& order : orders) {
+            if (order.clordid.length) index(byclordid, &OrderState::clordid, order);
+            if (order.orderid.length) index(byorderid, &OrderState::orderid, order);
+        }
+    }
+
+    std::mutex lock;
+    std::vector<OrderState> orders;
+    std::vector<char> arena;
+    std::vector<uint32_t> byclordid;
+    std::vector<uint32_t> byorderid;
+};
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef KDBFIX_OVERFLOW_H
+#define KDBFIX_OVERFLOW_H
+
+#include <kx/k.h>
+
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#ifndef WIN32
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+
+/* Overflow:
+ *   Where a Channel puts messages once its ring is full, selected per session
+ *   with QueuePolicy. Messages stay in the overflow until the q thread has
+ *   drained the ring and then the overflow, so delivery order is kept. Both
+ *   sides call it with the channel lock held.
+ */
+enum OverflowPolicy
+{
+    OVERFLOW_BLOCK,
+    OVERFLOW_SPILL,
+    OVERFLOW_CONFLATE
+};
+
+class Overflow
+{
+    public:
+    virtual ~Overflow() {}
+
+    // whether push needs the conflation key of the message
+    virtual bool keyed() const = 0;
+
+    // false if the message could not be taken, it is then still owned by
+    // the caller
+    virtual bool push(K x, const std::string& key) = 0;
+    virtual bool pop(K& x) = 0;
+    virtual size_t size() const = 0;
+
+    // messages replaced by a newer one with the same key
+    virtual size_t conflated() const { return 0; }
+};
+
+#ifndef WIN32
+/* SpillFile:
+ *   Serialised messages appended to a memory mapped file as a length
+ *   followed by the b9 bytes. The file grows by doubling and is rewound
+ *   once the q thread has read everything in it, so it only ever holds the
+ *   current backlog. It is removed when the session goes away.
+ */
+class SpillFile : public Overflow
+{
+    public:
+    explicit SpillFile(const std::string& path)
+        : path(path), data(nullptr), capacity(1 << 20), written(0), read(0), count(0)
+    {
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (-1 == fd || !map(capacity, &data)) {
+            if (-1 != fd) close(fd);
+            throw std::runtime_error("unable to create spill file " + path);
+        }
+    }
+
+    ~SpillFile()
+    {
+        munmap(data, capacity);
+        close(fd);
+        unlink(path.c_str());
+    }
+
+    bool keyed() const { return false; }
+
+    bool push(K x, const std::string& key)
+    {
+        K bytes = b9(-1, x);
+        if (!bytes) return false;
+
+        size_t needed = written + sizeof(J) + (size_t) bytes->n;
+        if (needed > capacity) {
+            size_t grown = capacity;
+            while (grown < needed) grown *= 2;
+
+            // the old mapping stays valid until the larger one is in place
+            char* larger;
+            if (!map(grown, &larger)) {
+                r0(bytes);
+                return false;
+            }
+            munmap(data, capacity);
+            data = larger;
+            capacity = grown;
+        }
+
+        memcpy(data + written, &bytes->n, sizeof(J));
+        memcpy(data + written + sizeof(J), kG(bytes), (size_t) bytes->n);
+        written = needed;
+        count++;
+        r0(bytes);
+        r0(x);
+        return true;
+    }
+
+    bool pop(K& x)
+    {
+        if (read == written) {
+            read = written = 0;
+            return false;
+        }
+
+        J n;
+        memcpy(&n, data + read, sizeof(J));
+        K bytes = ktn(KG, n);
+        memcpy(kG(bytes), data + read + sizeof(J), (size_t) n);
+        read += sizeof(J) + (size_t) n;
+        count--;
+
+        x = d9(bytes);
+        r0(bytes);
+        return true;
+    }
+
+    size_t size() const { return count; }
+
+    private:
+    bool map(size_t size, char** mapped)
+    {
+        if (0 != ftruncate(fd, (off_t) size)) return false;
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (MAP_FAILED == p) return false;
+        *mapped = (char*) p;
+        return true;
+    }
+
+    std::string path;
+    int fd;
+    char* data;
+    size_t capacity;
+    size_t written;
+    size_t read;
+    size_t count;
+};
+#endif
+
+/* ConflationQueue:
+ *   Overflowed messages in arrival order, except that a message whose key
+ *   (MsgType and the value of ConflateTag) is already waiting replaces the
+ *   waiting one in place. Messages without a key are never conflated, so
+ *   the queue holds at most one message per key plus the unkeyed ones.
+ */
+class ConflationQueue : public Overflow
+{
+    public:
+    ConflationQueue() : popped(0), replaced(0) {}
+
+    ~ConflationQueue()
+    {
+        for (Entry& entry : entries) r0(entry.x);
+    }
+
+    bool keyed() const { return true; }
+
+    bool push(K x, const std::string& key)
+    {
+        if (!key.empty()) {
+            auto found = positions.find(key);
+            if (found != positions.end()) {
+                Entry& entry = entries[found->second - popped];
+                r0(entry.x);
+                entry.x = x;
+                replaced++;
+                return true;
+            }
+            positions[key] = popped + entries.size();
+        }
+
+        entries.push_back(Entry{ x, key });
+        return true;
+    }
+
+    bool pop(K& x)
+    {
+        if (entries.empty()) return false;
+
+        Entry& entry = entries.front();
+        x = entry.x;
+        if (!entry.key.empty()) positions.erase(entry.key);
+        entries.pop_front();
+        popped++;
+        return true;
+    }
+
+    size_t size() const { return entries.size(); }
+    size_t conflated() const { return replaced; }
+
+    private:
+    struct Entry
+    {
+        K x;
+        std::string key;
+    };
+
+    std::deque<Entry> entries;
+    std::unordered_map<std::string, size_t> positions;
+    size_t popped;
+    size_t replaced;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef KDBFIX_RAWDECODER_H
+#define KDBFIX_RAWDECODER_H
+
+#include <kx/k.h>
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "decoder.h"
+#include "filter.h"
+#include "groups.h"
+
+static const char SOH = '\001';
+
+// first SOH in [p, end), or end if there is none
+inline const char* findsoh(const char* p, const char* end)
+{
+#ifdef __SSE2__
+    const __m128i delimiter = _mm_set1_epi8(SOH);
+    while (p + 16 <= end) {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) p), delimiter));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && SOH != *p) p++;
+    return p;
+}
+
+// MsgSeqNum of a raw message, -1 if it is not present
+inline J RawSeqNum(const std::string& msg)
+{
+    size_t at = msg.find("\00134=");
+    return at == std::string::npos ? -1 : strtol(msg.c_str() + at + 4, NULL, 10);
+}
+
+/* TokeniseRaw:
+ *   Splits a tag=value<SOH> message in one pass, calling field(tag, value,
+ *   size) for each field in wire order. The tag digits are accumulated up to
+ *   the '=' and the value is delimited by a 16 byte wide SOH scan, except for
+ *   DATA fields which are taken by the length given in the preceding LENGTH
+ *   field. Returns false if the message is malformed.
+ */
+template<typename F>
+inline bool TokeniseRaw(const char* msg, size_t len, const TagTable& table, F field)
+{
+    const char* p = msg;
+    const char* end = msg + len;
+    J datalength = -1;
+
+    while (p < end) {
+        J tag = 0;
+        const char* start = p;
+        while (p < end && (unsigned) (*p - '0') < 10) tag = tag * 10 + (*p++ - '0');
+
+        if (p == start || p >= end || '=' != *p) {
+            return false;
+        }
+
+        const char* value = ++p;
+        if (datalength >= 0 && table.hasflag((int) tag, TAG_DATA) && datalength <= end - value) {
+            p = value + datalength;
+        } else {
+            p = findsoh(value, end);
+        }
+
+        datalength = table.hasflag((int) tag, TAG_LENGTH) ? strtol(value, NULL, 10) : -1;
+        field(tag, value, (size_t) (p - value));
+
+        p++;
+    }
+
+    return true;
+}
+
+/* DecodeRaw:
+ *   Decodes every field of a raw message with the spec type from the table,
+ *   producing the same tag to value dictionary as ConvertToDictionary with
+ *   the keys in wire order and repeating groups as nested tables. When a
+ *   filter is given only the fields it keeps are decoded. Returns (K) 0 if
+ *   the message is malformed.
+ */
+inline K DecodeRaw(const char* msg, size_t len, const TagTable& table, const GroupTable& groups, const TagFilter* filter = nullptr)
+{
+    MessageBuilder builder(table, groups, filter);
+
+    bool ok = TokeniseRaw(msg, len, table, [&](J tag, const char* value, size_t size) {
+        builder.add((int) tag, value, size);
+    });
+
+    return ok ? builder.finish() : (K) 0;
+}
+
+#endif
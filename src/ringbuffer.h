@@ -0,0 +1,86 @@
+#ifndef KDBFIX_RINGBUFFER_H
+#define KDBFIX_RINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/* CacheLine:
+ *   Pads a value out to 64 bytes. Used instead of alignas() since operator
+ *   new does not honour extended alignment before C++17.
+ */
+template<typename V>
+struct CacheLine
+{
+    V value;
+    char pad[64 - sizeof(V)];
+};
+
+/* SpscRing:
+ *   Bounded lock-free queue with exactly one producer thread and one consumer
+ *   thread. The capacity is rounded up to a power of two so that slot indices
+ *   can be computed with a mask. The head and tail counters live on separate
+ *   cache lines and each side keeps a cached copy of the other side's counter
+ *   so that the shared lines are only touched when the ring looks full/empty.
+ */
+template<typename T>
+class SpscRing
+{
+    public:
+    explicit SpscRing(size_t capacity)
+    {
+        head.value.store(0);
+        tail.value.store(0);
+        cachedHead.value = 0;
+        cachedTail.value = 0;
+
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // producer side
+    bool push(const T& item)
+    {
+        const size_t t = tail.value.load(std::memory_order_relaxed);
+        if (t - cachedHead.value > mask) {
+            cachedHead.value = head.value.load(std::memory_order_acquire);
+            if (t - cachedHead.value > mask) return false;
+        }
+        slots[t & mask] = item;
+        tail.value.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side
+    bool pop(T& item)
+    {
+        const size_t h = head.value.load(std::memory_order_relaxed);
+        if (h == cachedTail.value) {
+            cachedTail.value = tail.value.load(std::memory_order_acquire);
+            if (h == cachedTail.value) return false;
+        }
+        item = slots[h & mask];
+        head.value.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const { return size() == 0; }
+    size_t size() const { return tail.value.load(std::memory_order_acquire) - head.value.load(std::memory_order_acquire); }
+    size_t capacity() const { return mask + 1; }
+
+    private:
+    CacheLine<std::atomic<size_t>> head;   // written by the consumer
+    CacheLine<size_t> cachedTail;          // consumer's view of tail
+    CacheLine<std::atomic<size_t>> tail;   // written by the producer
+    CacheLine<size_t> cachedHead;          // producer's view of head
+
+    std::vector<T> slots;
+    size_t mask;
+};
+
+#endif
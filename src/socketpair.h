@@ -48,6 +48,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *   add argument make_overlapped
  */
 
+#ifndef SOCKETPAIR_H
+#define SOCKETPAIR_H
+
 #include <string.h>
 
 #ifdef WIN32
@@ -150,3 +153,5 @@ int dumb_socketpair(int socks[2], int dummy)
     return dummy;
 }
 #endif
+
+#endif /* SOCKETPAIR_H */
@@ -0,0 +1,477 @@
+#ifndef KDBFIX_SPEC_H
+#define KDBFIX_SPEC_H
+
+#include <kx/k.h>
+
+#include "decoder.h"
+#include "columns.h"
+#include "groups.h"
+
+#include <pugixml.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+/* Spec:
+ *   Everything the library takes from one FIX XML spec: field types and
+ *   names by tag, message names, and the repeating group layouts of each
+ *   MsgType. Loaded on the q thread and only read once sessions start.
+ */
+struct Spec
+{
+    std::string path;
+    TagTable types;
+    GroupTable groups;
+    std::unordered_map<int, std::string> tagnames;
+    std::unordered_map<std::string, std::string> msgnames;
+    std::unordered_map<std::string, int> tagnumbers;
+    uint32_t id = 0;                // carried by lazy messages decoded with it
+};
+
+// the column type of tag in tables of messages decoded with spec, repeating
+// groups are delivered as tables so their count tags are general
+inline I ColumnType(const Spec& spec, int tag)
+{
+    return spec.groups.iscount(tag) ? 0 : columntype(spec.types.type(tag));
+}
+
+// adds the fields and repeating groups under node (a message, group or
+// component) to layout, expanding components in place. Only the groups are
+// kept for the top level of a message.
+inline void CompileGroups(Spec& spec, pugi::xml_node node, pugi::xml_node components, GroupLayout& layout, bool top)
+{
+    for(pugi::xml_node child = node.first_child(); child; child = child.next_sibling())
+    {
+        std::string kind = child.name();
+        const char* name = child.attribute("name").value();
+
+        if ("component" == kind) {
+            CompileGroups(spec, components.find_child_by_attribute("component", "name", name), components, layout, top);
+            continue;
+        }
+
+        auto found = spec.tagnumbers.find(name);
+        if (found == spec.tagnumbers.end()) continue;
+        int tag = found->second;
+
+        if ("group" == kind) {
+            auto group = new GroupLayout;
+            CompileGroups(spec, child, components, *group, false);
+            layout.groups[tag].reset(group);
+            spec.groups.setcount(tag);
+            if (!top) layout.add(tag, ss((S) name), 0);
+        } else if ("field" == kind && !top) {
+            layout.add(tag, ss((S) name), columntype(spec.types.type(tag)));
+        }
+    }
+}
+
+// reads the XML spec at path, false if it cannot be loaded
+inline bool CompileSpec(const std::string& path, Spec& spec)
+{
+    pugi::xml_document doc;
+    if (!doc.load_file(path.c_str())) return false;
+
+    pugi::xml_node fields = doc.child("fix").child("fields");
+    for(pugi::xml_node field = fields.child("field"); field; field = field.next_sibling("field"))
+    {
+        int value = field.attribute("number").as_int();
+        std::string type = field.attribute("type").value();
+        spec.types.set(value, typeconvert(type));
+        if ("LENGTH" == type) spec.types.setflags(value, TAG_LENGTH);
+        if ("DATA" == type) spec.types.setflags(value, TAG_DATA);
+        spec.tagnames.insert({value, field.attribute("name").value()});
+        spec.tagnumbers.insert({field.attribute("name").value(), value});
+    }
+
+    // Symbol has always been delivered as a kdb+ symbol
+    spec.types.set(55, FIELD_SYMBOL);
+
+    pugi::xml_node header = doc.child("fix").child("header");
+    pugi::xml_node trailer = doc.child("fix").child("trailer");
+    pugi::xml_node components = doc.child("fix").child("components");
+    pugi::xml_node messages = doc.child("fix").child("messages");
+    for(pugi::xml_node message = messages.child("message"); message; message = message.next_sibling("message"))
+    {
+        spec.msgnames.insert({message.attribute("msgtype").value(), message.attribute("name").value()});
+
+        GroupLayout& layout = spec.groups.message(message.attribute("msgtype").value());
+        CompileGroups(spec, header, components, layout, true);
+        CompileGroups(spec, message, components, layout, true);
+        CompileGroups(spec, trailer, components, layout, true);
+    }
+
+    spec.path = path;
+    return true;
+}
+
+/* Spec cache:
+ *   The compiled form of a spec, written next to the XML (FIX42.xml becomes
+ *   FIX42.bin) the first time it is loaded so later loads skip pugixml and
+ *   the component expansion. The file is one flat buffer in host byte order:
+ *
+ *     char    magic[8]          SPEC_MAGIC
+ *     int64   size, mtime       of the XML when it was compiled
+ *     uint32  fields            then per field: int32 tag, uint8 type,
+ *                               uint8 flags, string name (may be empty)
+ *     uint32  layouts           then per layout: uint32 columns, per column
+ *                               int32 tag, int32 type, string name, then
+ *                               uint32 groups, per group int32 tag and the
+ *                               uint32 index of an earlier layout
+ *     uint32  messages          then per MsgType: string msgtype,
+ *                               string name, uint32 layout index
+ *
+ *   where a string is a uint16 length and the text. Components repeat the
+ *   same groups across most messages, so each distinct layout is stored and
+ *   loaded once and shared by everything that uses it. A cache whose size
+ *   and mtime no longer match the XML is rebuilt.
+ */
+static const char SPEC_MAGIC[8] = { 'K', 'F', 'I', 'X', 'S', 'P', 'C', '2' };
+
+class SpecWriter
+{
+    public:
+    template<typename T>
+    void put(T value) { out.append((const char*) &value, sizeof(value)); }
+
+    void text(const std::string& value)
+    {
+        put((uint16_t) value.size());
+        out.append(value);
+    }
+
+    // adds layout and its groups to the layout table unless an identical one
+    // is already there, returns its index
+    uint32_t layout(const GroupLayout& layout)
+    {
+        std::map<int, uint32_t> children;
+        for (auto& group : layout.groups) children[group.first] = this->layout(*group.second);
+
+        SpecWriter entry;
+        entry.put((uint32_t) layout.tags.size());
+        for (size_t c = 0; c < layout.tags.size(); c++) {
+            entry.put((int32_t) layout.tags[c]);
+            entry.put((int32_t) layout.types[c]);
+            entry.text(layout.names[c]);
+        }
+        entry.put((uint32_t) children.size());
+        for (auto& child : children) {
+            entry.put((int32_t) child.first);
+            entry.put(child.second);
+        }
+
+        auto found = indices.find(entry.out);
+        if (found != indices.end()) return found->second;
+
+        uint32_t index = (uint32_t) indices.size();
+        indices.insert({entry.out, index});
+        layouts.append(entry.out);
+        return index;
+    }
+
+    std::string out;
+    std::string layouts;
+    std::unordered_map<std::string, uint32_t> indices;
+};
+
+class SpecReader
+{
+    public:
+    SpecReader(const char* data, size_t size) : at(data), end(data + size), ok(true) {}
+
+    template<typename T>
+    T get()
+    {
+        T value = T();
+        if ((size_t) (end - at) < sizeof(T)) {
+            ok = false;
+            return value;
+        }
+        memcpy(&value, at, sizeof(T));
+        at += sizeof(T);
+        return value;
+    }
+
+    std::string text()
+    {
+        uint16_t length = get<uint16_t>();
+        if ((size_t) (end - at) < length) {
+            ok = false;
+            return std::string();
+        }
+        at += length;
+        return std::string(at - length, length);
+    }
+
+    // reads the layout table, groups may only refer to layouts before them
+    bool layouts(Spec& spec, std::vector<std::shared_ptr<GroupLayout>>& table)
+    {
+        uint32_t count = get<uint32_t>();
+        for (uint32_t i = 0; i < count && ok; i++) {
+            std::shared_ptr<GroupLayout> layout(new GroupLayout);
+
+            uint32_t columns = get<uint32_t>();
+            for (uint32_t c = 0; c < columns && ok; c++) {
+                int tag = get<int32_t>();
+                I type = get<int32_t>();
+                layout->add(tag, ss((S) text().c_str()), type);
+            }
+
+            uint32_t groups = get<uint32_t>();
+            for (uint32_t g = 0; g < groups && ok; g++) {
+                int tag = get<int32_t>();
+                uint32_t index = get<uint32_t>();
+                if (index >= table.size()) ok = false;
+                if (!ok) break;
+                layout->groups[tag] = table[index];
+                spec.groups.setcount(tag);
+            }
+
+            table.push_back(layout);
+        }
+        return ok;
+    }
+
+    const char* at;
+    const char* end;
+    bool ok;
+};
+
+// the size and modification time of the XML, zero if it cannot be read
+inline void SpecSource(const std::string& path, int64_t* size, int64_t* mtime)
+{
+    struct stat info;
+    *size = *mtime = 0;
+    if (0 == stat(path.c_str(), &info)) {
+        *size = (int64_t) info.st_size;
+        *mtime = (int64_t) info.st_mtime;
+    }
+}
+
+inline std::string SpecCachePath(const std::string& path)
+{
+    size_t dot = path.rfind('.');
+    size_t slash = path.find_last_of("/\\");
+    bool extension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+    return (extension ? path.substr(0, dot) : path) + ".bin";
+}
+
+// writes the cache through a temporary file so a concurrent load never sees
+// a partial one, failures only cost the next load a recompile
+inline void WriteSpecCache(const std::string& path, const Spec& spec)
+{
+    int64_t size, mtime;
+    SpecSource(path, &size, &mtime);
+
+    SpecWriter writer;
+    writer.out.append(SPEC_MAGIC, sizeof(SPEC_MAGIC));
+    writer.put(size);
+    writer.put(mtime);
+
+    // in tag order, so a name used twice resolves as it does in the XML, and
+    // including types set without a field in the spec (Symbol in FIXT.1.1)
+    std::map<int, std::string> fields(spec.tagnames.begin(), spec.tagnames.end());
+    for (size_t tag = 0; tag < spec.types.size(); tag++) {
+        if (FIELD_STRING != spec.types.type((int) tag) || spec.types.flagsof((int) tag)) fields.insert({(int) tag, ""});
+    }
+    writer.put((uint32_t) fields.size());
+    for (auto& field : fields) {
+        writer.put((int32_t) field.first);
+        writer.put((uint8_t) spec.types.type(field.first));
+        writer.put((uint8_t) spec.types.flagsof(field.first));
+        writer.text(field.second);
+    }
+
+    SpecWriter messages;
+    uint32_t count = 0;
+    spec.groups.each([&](const std::string& msgtype, const GroupLayout& layout) {
+        auto name = spec.msgnames.find(msgtype);
+        messages.text(msgtype);
+        messages.text(name != spec.msgnames.end() ? name->second : std::string());
+        messages.put(messages.layout(layout));
+        count++;
+    });
+    writer.put((uint32_t) messages.indices.size());
+    writer.out.append(messages.layouts);
+    writer.put(count);
+    writer.out.append(messages.out);
+
+    std::string cache = SpecCachePath(path);
+    std::string temporary = cache + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file) return;
+
+    bool written = 1 == fwrite(writer.out.data(), writer.out.size(), 1, file);
+    if (0 != fclose(file) || !written || 0 != rename(temporary.c_str(), cache.c_str())) {
+        remove(temporary.c_str());
+    }
+}
+
+// loads the cache of the XML at path, false if there is none or it is stale
+inline bool ReadSpecCache(const std::string& path, Spec& spec)
+{
+    FILE* file = fopen(SpecCachePath(path).c_str(), "rb");
+    if (!file) return false;
+
+    std::vector<char> data;
+    char block[65536];
+    for (size_t n; (n = fread(block, 1, sizeof(block), file)) > 0;) data.insert(data.end(), block, block + n);
+    fclose(file);
+
+    int64_t size, mtime;
+    SpecSource(path, &size, &mtime);
+
+    SpecReader reader(data.data(), data.size());
+    if (data.size() < sizeof(SPEC_MAGIC) || 0 != memcmp(data.data(), SPEC_MAGIC, sizeof(SPEC_MAGIC))) return false;
+    reader.at += sizeof(SPEC_MAGIC);
+    if (reader.get<int64_t>() != size || reader.get<int64_t>() != mtime || 0 == size) return false;
+
+    uint32_t fields = reader.get<uint32_t>();
+    for (uint32_t i = 0; i < fields && reader.ok; i++) {
+        int tag = reader.get<int32_t>();
+        FieldType type = (FieldType) reader.get<uint8_t>();
+        unsigned char flags = reader.get<uint8_t>();
+        std::string name = reader.text();
+        spec.types.set(tag, type < FIELD_TYPE_COUNT ? type : FIELD_STRING);
+        if (flags) spec.types.setflags(tag, flags);
+        if (name.empty()) continue;
+        spec.tagnames.insert({tag, name});
+        spec.tagnumbers.insert({name, tag});
+    }
+
+    std::vector<std::shared_ptr<GroupLayout>> layouts;
+    reader.layouts(spec, layouts);
+
+    uint32_t messages = reader.get<uint32_t>();
+    for (uint32_t i = 0; i < messages && reader.ok; i++) {
+        std::string msgtype = reader.text();
+        std::string name = reader.text();
+        uint32_t index = reader.get<uint32_t>();
+        if (index >= layouts.size()) reader.ok = false;
+        if (!reader.ok) break;
+        if (!name.empty()) spec.msgnames.insert({msgtype, name});
+        spec.groups.message(msgtype) = *layouts[index];
+    }
+
+    if (!reader.ok) {
+        spec = Spec();
+        return false;
+    }
+
+    spec.path = path;
+    return true;
+}
+
+// the spec at path from its cache, compiling and caching the XML if needed
+inline bool LoadSpec(const std::string& path, Spec& spec)
+{
+    if (ReadSpecCache(path, spec)) return true;
+    if (!CompileSpec(path, spec)) return false;
+
+    WriteSpecCache(path, spec);
+    return true;
+}
+
+/* SpecOptions:
+ *   Per session changes to a loaded spec. FixedPoint=44:4,31:4,6:6 decodes
+ *   each tag listed as a long of its value times 10^scale rather than a
+ *   float, so prices and amounts add up exactly in q; scales run from 0 to
+ *   18. SymbolTags=49,56,1,15 decodes each tag listed as a symbol rather
+ *   than a string, interned through the decoding thread's InternCache, for
+ *   low cardinality values such as CompIDs, Account and Currency.
+ */
+struct SpecOptions
+{
+    std::map<int, int> scales;
+    std::set<int> symbols;
+
+    bool empty() const { return scales.empty() && symbols.empty(); }
+
+    // tells specs loaded from one file with different options apart
+    std::string key() const
+    {
+        std::string text;
+        for (auto& scale : scales) text += " " + std::to_string(scale.first) + ":" + std::to_string(scale.second);
+        for (int tag : symbols) text += " s" + std::to_string(tag);
+        return text;
+    }
+};
+
+inline bool ParseScales(const std::string& text, std::map<int, int>& scales)
+{
+    size_t at = 0;
+    while (at < text.size()) {
+        size_t end = text.find(',', at);
+        if (std::string::npos == end) end = text.size();
+        std::string item = text.substr(at, end - at);
+        at = end + 1;
+
+        char* rest;
+        long tag = strtol(item.c_str(), &rest, 10);
+        if (rest == item.c_str() || ':' != *rest || tag <= 0) return false;
+        const char* digits = rest + 1;
+        long scale = strtol(digits, &rest, 10);
+        if (rest == digits || *rest || scale < 0 || scale > 18) return false;
+        scales[(int) tag] = (int) scale;
+    }
+    return true;
+}
+
+inline bool ParseTags(const std::string& text, std::set<int>& tags)
+{
+    size_t at = 0;
+    while (at < text.size()) {
+        size_t end = text.find(',', at);
+        if (std::string::npos == end) end = text.size();
+        std::string item = text.substr(at, end - at);
+        at = end + 1;
+
+        char* rest;
+        long tag = strtol(item.c_str(), &rest, 10);
+        if (rest == item.c_str() || *rest || tag <= 0) return false;
+        tags.insert((int) tag);
+    }
+    return true;
+}
+
+// a copy of layout with its columns typed from types. Layouts shared in the
+// original are shared in the copy
+inline std::shared_ptr<GroupLayout> RetypeLayout(const GroupLayout& layout, const TagTable& types,
+    std::unordered_map<const GroupLayout*, std::shared_ptr<GroupLayout>>& copies)
+{
+    std::shared_ptr<GroupLayout>& copy = copies[&layout];
+    if (copy) return copy;
+
+    copy = std::make_shared<GroupLayout>(layout);
+    for (size_t c = 0; c < copy->tags.size(); c++) {
+        if (!copy->group(copy->tags[c])) copy->types[c] = columntype(types.type(copy->tags[c]));
+    }
+    for (auto& group : copy->groups) group.second = RetypeLayout(*group.second, types, copies);
+    return copy;
+}
+
+// applies options to a copy of a loaded spec, leaving the layouts it shares
+// with the original untouched
+inline void ApplySpecOptions(Spec& spec, const SpecOptions& options)
+{
+    if (options.empty()) return;
+    for (int tag : options.symbols) spec.types.set(tag, FIELD_SYMBOL);
+    for (auto& scale : options.scales) spec.types.setscale(scale.first, scale.second);
+
+    std::unordered_map<const GroupLayout*, std::shared_ptr<GroupLayout>> copies;
+    spec.groups.each([&](const std::string&, GroupLayout& layout) {
+        for (auto& group : layout.groups) group.second = RetypeLayout(*group.second, spec.types, copies);
+    });
+}
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef KDBFIX_STATS_H
+#define KDBFIX_STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+
+/* Latency stages:
+ *   Where a message spends its time between the wire and .fix.onrecv, and
+ *   between .fix.send and the wire. Inbound messages are timed from the
+ *   moment the session's log sees the text to the return of the callback:
+ *
+ *     parse     log text to fromAdmin/fromApp (QuickFIX's parse and checks)
+ *     decode    fromApp to the decoded message being handed to q
+ *     queue     handed to q to picked up on the q thread
+ *     wakeup    handed to q to the start of the sd1 callback or .fix.poll
+ *               call that picked it up, the part of queue spent waiting
+ *               for the q thread rather than behind other messages
+ *     d9        deserialising the message (socket transport only)
+ *     callback  .fix.onrecv
+ *     total     log text (or fromApp) to the return of .fix.onrecv
+ *
+ *   and outbound messages from the .fix.send/.fix.sendt call:
+ *
+ *     encode    building the FIX::Message from the q arguments
+ *     send      sendToTarget, which includes the store, log and socket write
+ */
+enum Stage
+{
+    STAGE_PARSE,
+    STAGE_DECODE,
+    STAGE_QUEUE,
+    STAGE_WAKEUP,
+    STAGE_D9,
+    STAGE_CALLBACK,
+    STAGE_TOTAL,
+    STAGE_ENCODE,
+    STAGE_SEND,
+    STAGE_COUNT
+};
+
+inline const char* stagename(int stage)
+{
+    static const char* names[STAGE_COUNT] = { "parse", "decode", "queue", "wakeup", "d9", "callback", "total", "encode", "send" };
+    return names[stage];
+}
+
+// nanoseconds on the monotonic clock, clock_gettime through the vDSO on Linux
+inline int64_t monotonicnanos()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+/* Histogram:
+ *   Log-linear buckets in the style of HdrHistogram: values below 16 have a
+ *   bucket each and every power of two above that is split into 16 buckets,
+ *   so a bucket is never wider than 1/16th of its lowest value and any
+ *   nanosecond count fits in 976 counters. Recording is a handful of
+ *   relaxed atomic adds and never blocks, so any thread may record while
+ *   the q thread reads or resets.
+ */
+class Histogram
+{
+    public:
+    static const int SUB_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int BUCKETS = (64 - SUB_BITS) * SUB_BUCKETS + SUB_BUCKETS;
+
+    Histogram() { reset(); }
+
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    void record(int64_t nanos)
+    {
+        uint64_t value = nanos > 0 ? (uint64_t) nanos : 0;
+        counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+
+        uint64_t seen = maximum.load(std::memory_order_relaxed);
+        while (value > seen && !maximum.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+    }
+
+    void reset()
+    {
+        for (int i = 0; i < BUCKETS; i++) counts[i].store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        maximum.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t max() const { return maximum.load(std::memory_order_relaxed); }
+
+    uint64_t mean() const
+    {
+        uint64_t n = count();
+        return n ? sum.load(std::memory_order_relaxed) / n : 0;
+    }
+
+    /* percentiles:
+     *   Fills values with the highest value of the bucket holding each of the
+     *   n quantiles (ascending, between 0 and 1), capped at the maximum. The
+     *   counts are read once so the results are consistent with each other.
+     */
+    void percentiles(const double* quantiles, uint64_t* values, int n) const
+    {
+        uint64_t snapshot[BUCKETS];
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            snapshot[i] = counts[i].load(std::memory_order_relaxed);
+            seen += snapshot[i];
+        }
+
+        uint64_t cumulative = 0, largest = max();
+        int bucket = 0;
+        for (int q = 0; q < n; q++) {
+            uint64_t rank = (uint64_t) (quantiles[q] * seen + 0.5);
+            if (rank < 1) rank = 1;
+            while (bucket < BUCKETS && cumulative + snapshot[bucket] < rank) {
+                cumulative += snapshot[bucket++];
+            }
+            values[q] = 0 == seen ? 0 : std::min(highest(std::min(bucket, BUCKETS - 1)), largest);
+        }
+    }
+
+    private:
+    static int bucket(uint64_t value)
+    {
+        if (value < (uint64_t) SUB_BUCKETS) return (int) value;
+        int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + (int) ((value >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t highest(int bucket)
+    {
+        if (bucket < SUB_BUCKETS) return (uint64_t) bucket;
+        int shift = bucket / SUB_BUCKETS - 1;
+        uint64_t low = (uint64_t) (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+        return low + ((uint64_t) 1 << shift) - 1;
+    }
+
+    std::atomic<uint64_t> counts[BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> maximum;
+};
+
+struct MessageStats
+{
+    Histogram stages[STAGE_COUNT];
+};
+
+/* SessionStats:
+ *   The histograms of one session by MsgType. MsgTypes are packed into a
+ *   32 bit key (they are at most 3 characters) and found in a fixed size
+ *   open addressed table without locking: the first thread to see a new
+ *   MsgType claims a slot by setting its key and then publishes the
+ *   histograms, which are never moved or freed while the session exists.
+ */
+class SessionStats
+{
+    public:
+    SessionStats()
+    {
+        for (size_t i = 0; i < SLOTS; i++) {
+            keys[i].store(0, std::memory_order_relaxed);
+            entries[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~SessionStats()
+    {
+        for (size_t i = 0; i < SLOTS; i++) delete entries[i].load();
+    }
+
+    SessionStats(const SessionStats&) = delete;
+    SessionStats& operator=(const SessionStats&) = delete;
+
+    // the histograms for msgtype, nullptr if it is empty or the table is full
+    MessageStats* find(const char* msgtype, size_t length)
+    {
+        uint32_t key = pack(msgtype, length);
+        if (!key) return nullptr;
+
+        size_t slot = (key * 2654435761u) & (SLOTS - 1);
+        for (size_t probes = 0; probes < SLOTS; probes++, slot = (slot + 1) & (SLOTS - 1)) {
+            uint32_t found = keys[slot].load(std::memory_order_acquire);
+            if (0 == found) {
+                if (keys[slot].compare_exchange_strong(found, key, std::memory_order_acq_rel)) {
+                    auto stats = new MessageStats;
+                    entries[slot].store(stats, std::memory_order_release);
+                    return stats;
+                }
+            }
+            if (found == key) {
+                MessageStats* stats;
+                while (!(stats = entries[slot].load(std::memory_order_acquire))) std::this_thread::yield();
+                return stats;
+            }
+        }
+
+        return nullptr;
+    }
+
+    MessageStats* find(const std::string& msgtype) { return find(msgtype.data(), msgtype.size()); }
+
+    // passes each MsgType seen so far and its histograms to f
+    template<typename F>
+    void each(F f)
+    {
+        for (size_t i = 0; i < SLOTS; i++) {
+            MessageStats* stats = entries[i].load(std::memory_order_acquire);
+            if (!stats) continue;
+
+            uint32_t key = keys[i].load(std::memory_order_relaxed);
+            char msgtype[sizeof(key)];
+            memcpy(msgtype, &key, sizeof(key));
+            f(std::string(msgtype, strnlen(msgtype, sizeof(msgtype))), *stats);
+        }
+    }
+
+    void reset()
+    {
+        each([](const std::string&, MessageStats& stats) {
+            for (int stage = 0; stage < STAGE_COUNT; stage++) stats.stages[stage].reset();
+        });
+    }
+
+    private:
+    static const size_t SLOTS = 256;
+
+    static uint32_t pack(const char* msgtype, size_t length)
+    {
+        uint32_t key = 0;
+        memcpy(&key, msgtype, std::min(length, sizeof(key)));
+        return key;
+    }
+
+    std::atomic<uint32_t> keys[SLOTS];
+    std::atomic<MessageStats*> entries[SLOTS];
+};
+
+/* Trace:
+ *   The timestamps an inbound message carries from its session thread to
+ *   the q thread. stats is only set for sessions with Stats=Y, and a zero
+ *   timestamp is one that was not taken.
+ */
+struct Trace
+{
+    MessageStats* stats = nullptr;
+    int64_t arrived = 0;
+    int64_t entered = 0;
+    int64_t enqueued = 0;
+    int64_t dequeued = 0;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef KDBFIX_TEMPLATE_H
+#define KDBFIX_TEMPLATE_H
+
+#include <quickfix/Message.h>
+
+#include <kx/k.h>
+
+#include "encoder.h"
+
+#include <string>
+#include <vector>
+
+// tags SendMessageDict and templates place in the standard header
+inline bool IsHeaderTag(int tag)
+{
+    return 8 == tag || 35 == tag || 49 == tag || 56 == tag;
+}
+
+/* MessageTemplate:
+ *   An outbound message with its static fields (BeginString, CompIDs,
+ *   HandlInst, OrdType, ...) set once and serialised once. QuickFIX caches
+ *   the rendered bytes, length and checksum contribution of every field, so
+ *   copies of the prototype carry them along and BodyLength and CheckSum only
+ *   have to be computed for the variable fields of each order. Values for
+ *   the variable fields are formatted natively in the order the tags were
+ *   given.
+ */
+class MessageTemplate
+{
+    public:
+    explicit MessageTemplate(const std::vector<int>& variable) : variable(variable) {}
+
+    void set(int tag, const std::string& value)
+    {
+        if (IsHeaderTag(tag)) {
+            prototype.getHeader().setField(tag, value);
+        } else {
+            prototype.setField(tag, value);
+        }
+    }
+
+    // renders the static fields so that their cached bytes are copied with
+    // the prototype
+    void prepare()
+    {
+        std::string rendered;
+        prototype.toString(rendered);
+    }
+
+    size_t size() const { return variable.size(); }
+
+    /* fill:
+     *   Copies the prototype into message and sets the variable fields from
+     *   the n atoms at values, returning the position of the first value that
+     *   has no native encoding or n on success.
+     */
+    size_t fill(K* values, size_t n, FIX::Message& message) const
+    {
+        message = prototype;
+
+        std::string rep;
+        for (size_t i = 0; i < n; i++) {
+            if (!encodefield(values[i], rep)) return i;
+
+            int tag = variable[i];
+            if (IsHeaderTag(tag)) {
+                message.getHeader().setField(tag, rep);
+            } else {
+                message.setField(tag, rep);
+            }
+        }
+
+        return n;
+    }
+
+    private:
+    FIX::Message prototype;
+    std::vector<int> variable;
+};
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef KDBFIX_TEMPORAL_H
+#define KDBFIX_TEMPORAL_H
+
+#include <kx/k.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/* Fixed width conversions between the FIX UTC temporal types and kdb+:
+ *
+ *   UTCTimestamp  YYYYMMDD-HH:MM:SS[.sss[sss[sss]]]  timestamp, ns from 2000.01.01
+ *   UTCDate       YYYYMMDD                           date, days from 2000.01.01
+ *   UTCTimeOnly   HH:MM:SS[.sss]                     time, ms from midnight
+ *
+ * Everything is integer arithmetic on the digits, there are no calls into
+ * libc time functions (so no timezone lock or local time adjustment) and no
+ * allocation. Malformed input produces the kdb+ null for the type.
+ */
+
+static const J NANOS_PER_SECOND = 1000000000LL;
+static const J NANOS_PER_DAY = 86400LL * NANOS_PER_SECOND;
+
+// days between 1970.01.01 and 2000.01.01
+static const I KDB_EPOCH_DAYS = 10957;
+
+// days since 1970.01.01 for a proleptic Gregorian date
+inline I daysfromcivil(I y, unsigned m, unsigned d)
+{
+    y -= m <= 2;
+    const I era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = (unsigned) (y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (I) doe - 719468;
+}
+
+// inverse of daysfromcivil
+inline void civilfromdays(I z, I* y, unsigned* m, unsigned* d)
+{
+    z += 719468;
+    const I era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = (unsigned) (z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (I) yoe + era * 400 + (*m <= 2);
+}
+
+inline bool isdigit2(const char* s)
+{
+    return (unsigned) (s[0] - '0') < 10 && (unsigned) (s[1] - '0') < 10;
+}
+
+inline unsigned parse2(const char* s)
+{
+    return (unsigned) (s[0] - '0') * 10 + (unsigned) (s[1] - '0');
+}
+
+/* parse8:
+ *   Converts eight ASCII digits to an integer. On little-endian targets the
+ *   digits are loaded into one 64 bit word, validated together and combined
+ *   pairwise with three multiplies (SIMD within a register) rather than
+ *   eight dependent multiply-adds. Returns false if any byte is not a digit.
+ */
+inline bool parse8(const char* s, unsigned* out)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t v;
+    memcpy(&v, s, sizeof(v));
+
+    // every byte must be 0x30..0x39
+    if (((v & 0xF0F0F0F0F0F0F0F0ULL) | (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) != 0x3333333333333333ULL) {
+        return false;
+    }
+
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+         (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    *out = (unsigned) v;
+    return true;
+#else
+    unsigned v = 0;
+    for (int i = 0; i < 8; i++) {
+        unsigned c = (unsigned) (s[i] - '0');
+        if (c > 9) return false;
+        v = v * 10 + c;
+    }
+    *out = v;
+    return true;
+#endif
+}
+
+// HH:MM:SS[.fraction] as nanoseconds from midnight, -1 if malformed
+inline J parseclock(const char* s, size_t len)
+{
+    if (len < 8 || ':' != s[2] || ':' != s[5] || !isdigit2(s) || !isdigit2(s + 3) || !isdigit2(s + 6)) {
+        return -1;
+    }
+
+    unsigned hour = parse2(s), minute = parse2(s + 3), second = parse2(s + 6);
+    if (hour > 23 || minute > 59 || second > 60) return -1;
+
+    J nanos = ((J) hour * 3600 + minute * 60 + second) * NANOS_PER_SECOND;
+    if (8 == len) return nanos;
+
+    // up to nine fractional digits, scaled to nanoseconds
+    if ('.' != s[8] || len < 10 || len > 18) return -1;
+
+    J fraction = 0;
+    size_t digits = len - 9;
+    for (size_t i = 9; i < len; i++) {
+        unsigned c = (unsigned) (s[i] - '0');
+        if (c > 9) return -1;
+        fraction = fraction * 10 + c;
+    }
+
+    static const J scale[10] = { 1000000000LL, 100000000LL, 10000000LL, 1000000LL, 100000LL, 10000LL, 1000LL, 100LL, 10LL, 1LL };
+    return nanos + fraction * scale[digits];
+}
+
+// YYYYMMDD as days from 2000.01.01, ni if malformed
+inline I parsedate(const char* s, size_t len)
+{
+    unsigned ymd;
+    if (len < 8 || !parse8(s, &ymd)) return ni;
+
+    unsigned month = (ymd / 100) % 100, day = ymd % 100;
+    if (month < 1 || month > 12 || day < 1 || day > 31) return ni;
+
+    return daysfromcivil((I) (ymd / 10000), month, day) - KDB_EPOCH_DAYS;
+}
+
+// YYYYMMDD-HH:MM:SS[.sss[sss[sss]]] as nanoseconds from 2000.01.01, nj if malformed
+inline J parsetimestamp(const char* s, size_t len)
+{
+    if (len < 17 || '-' != s[8]) return nj;
+
+    I days = parsedate(s, 8);
+    J clock = parseclock(s + 9, len - 9);
+    if (ni == days || clock < 0) return nj;
+
+    return (J) days * NANOS_PER_DAY + clock;
+}
+
+// HH:MM:SS[.sss] as milliseconds from midnight, ni if malformed
+inline I parsetime(const char* s, size_t len)
+{
+    J clock = parseclock(s, len);
+    return clock < 0 ? ni : (I) (clock / 1000000);
+}
+
+static const char digitpairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+inline char* write2(char* p, unsigned v)
+{
+    memcpy(p, &digitpairs[v * 2], 2);
+    return p + 2;
+}
+
+inline char* writedate(char* p, I days)
+{
+    I y;
+    unsigned m, d;
+    civilfromdays(days + KDB_EPOCH_DAYS, &y, &m, &d);
+    p = write2(p, (unsigned) y / 100);
+    p = write2(p, (unsigned) y % 100);
+    p = write2(p, m);
+    return write2(p, d);
+}
+
+// HH:MM:SS followed by the first `digits` fractional digits of nanos
+inline char* writeclock(char* p, J nanos, int digits)
+{
+    J seconds = nanos / NANOS_PER_SECOND;
+    p = write2(p, (unsigned) (seconds / 3600));
+    *p++ = ':';
+    p = write2(p, (unsigned) (seconds / 60 % 60));
+    *p++ = ':';
+    p = write2(p, (unsigned) (seconds % 60));
+
+    if (digits > 0) {
+        J fraction = nanos % NANOS_PER_SECOND;
+        char buf[9];
+        for (int i = 8; i >= 0; i--) { buf[i] = (char) ('0' + fraction % 10); fraction /= 10; }
+        *p++ = '.';
+        memcpy(p, buf, (size_t) digits);
+        p += digits;
+    }
+
+    return p;
+}
+
+/* Formatters:
+ *   Write into buf (which must hold at least 32 bytes) and return the number
+ *   of characters written. Nulls and values before 0001.01.01 or after
+ *   9999.12.31 produce an empty string.
+ */
+inline size_t formattimestamp(char* buf, J nanos, int digits = 3)
+{
+    if (nj == nanos || nanos == wj || nanos == -wj) return 0;
+
+    J days = nanos / NANOS_PER_DAY;
+    J clock = nanos % NANOS_PER_DAY;
+    if (clock < 0) { clock += NANOS_PER_DAY; days--; }
+    if (days < -730119 || days > 2921939) return 0;
+
+    char* p = writedate(buf, (I) days);
+    *p++ = '-';
+    return (size_t) (writeclock(p, clock, digits) - buf);
+}
+
+inline size_t formatdate(char* buf, I days)
+{
+    if (ni == days || days < -730119 || days > 2921939) return 0;
+    return (size_t) (writedate(buf, days) - buf);
+}
+
+inline size_t formattime(char* buf, I millis)
+{
+    if (ni == millis || millis < 0 || millis >= 86400000) return 0;
+    return (size_t) (writeclock(buf, (J) millis * 1000000, 3) - buf);
+}
+
+// the current UTC time as a timestamp
+inline J currenttimestamp()
+{
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count() - (J) KDB_EPOCH_DAYS * NANOS_PER_DAY;
+}
+
+#endif
@@ -0,0 +1,469 @@
+#ifndef KDBFIX_TICKERPLANT_H
+#define KDBFIX_TICKERPLANT_H
+
+#include <kx/k.h>
+
+#include "columns.h"
+#include "spec.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* PublishEntry:
+ *   The tickerplant table a MsgType is published to and the tags that make
+ *   up its columns, in order. Only top level fields are published.
+ */
+struct PublishEntry
+{
+    std::string table;
+    std::vector<int> tags;
+};
+
+/* PublishSet:
+ *   The published MsgTypes, read by the session threads without locking and
+ *   replaced by .fix.publish with an atomic swap as FilterSet is. Entries
+ *   are shared between sets so an entry that is not changed keeps its
+ *   address, which is what the publisher groups rows by.
+ */
+class PublishSet
+{
+    public:
+    const PublishEntry* find(const std::string& msgtype) const
+    {
+        auto found = entries.find(msgtype);
+        return found != entries.end() ? found->second.get() : nullptr;
+    }
+
+    static const PublishSet* active() { return current().load(std::memory_order_acquire); }
+
+    static void set(const std::string& msgtype, const std::string& table, const std::vector<int>& tags)
+    {
+        update([&](PublishSet& set) {
+            std::shared_ptr<PublishEntry> entry(new PublishEntry);
+            entry->table = table;
+            entry->tags = tags;
+            set.entries[msgtype] = entry;
+        });
+    }
+
+    static void remove(const std::string& msgtype)
+    {
+        update([&](PublishSet& set) { set.entries.erase(msgtype); });
+    }
+
+    private:
+    static std::atomic<const PublishSet*>& current()
+    {
+        static std::atomic<const PublishSet*> set(nullptr);
+        return set;
+    }
+
+    template<typename F>
+    static void update(F change)
+    {
+        static std::mutex lock;
+        static std::vector<const PublishSet*> retired;
+        std::lock_guard<std::mutex> guard(lock);
+
+        const PublishSet* previous = active();
+        PublishSet* next = previous ? new PublishSet(*previous) : new PublishSet;
+        change(*next);
+
+        current().store(next->entries.empty() ? nullptr : next, std::memory_order_release);
+        if (previous) retired.push_back(previous);
+        if (next->entries.empty()) delete next;
+    }
+
+    std::unordered_map<std::string, std::shared_ptr<const PublishEntry>> entries;
+};
+
+// one field of a published row, length -1 when the message does not have it
+struct PublishField
+{
+    const char* value;
+    int32_t length;
+};
+
+/* TickerplantPublisher:
+ *   Sends the rows of published MsgTypes straight to a tickerplant as
+ *   asynchronous .u.upd[table;columns] calls over kdb+ IPC, without going
+ *   through q. Session threads only copy the field text into a pending
+ *   buffer. The publisher thread wakes every FlushInterval milliseconds, or
+ *   sooner once BatchSize rows are pending, decodes the rows into typed
+ *   columns per table and serialises one call per table. A table's columns
+ *   are typed from the spec of the first session to publish to it and every
+ *   row is decoded from its text to those types, so sessions whose
+ *   FixedPoint, SymbolTags or FIX version differ send the same schema.
+ *
+ *   Serialised calls queue until they are written. While the tickerplant
+ *   is down they are kept, up to BufferSize bytes with the oldest dropped
+ *   first, and the connection is retried every ReconnectInterval
+ *   milliseconds. A call that was partly written when the connection broke
+ *   is sent again in full, so the tickerplant never sees half a batch.
+ */
+class TickerplantPublisher
+{
+    public:
+    struct Settings
+    {
+        std::string host = "localhost";
+        int port = 0;
+        std::string user;                   // user:password
+        std::string function = ".u.upd";
+        size_t batch = 1000;                // rows
+        int interval = 10;                  // milliseconds
+        size_t capacity = 64 << 20;         // bytes
+        int reconnect = 1000;               // milliseconds
+    };
+
+    explicit TickerplantPublisher(const Settings& settings)
+        : settings(settings), published(0), batches(0), dropped(0), buffered(0), connects(0), connected(false),
+          stopping(false), fd(-1), sent(0)
+    {
+        publisher = std::thread([this] { run(); });
+    }
+
+    TickerplantPublisher(const TickerplantPublisher&) = delete;
+    TickerplantPublisher& operator=(const TickerplantPublisher&) = delete;
+
+    ~TickerplantPublisher()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        publisher.join();
+
+        if (-1 != fd) close(fd);
+        for (auto& table : tables) {
+            for (K column : table->columns) r0(column);
+        }
+    }
+
+    // session thread, queues a row of entry decoded with spec
+    void push(const PublishEntry* entry, const Spec* spec, const std::vector<PublishField>& fields)
+    {
+        size_t bytes = 0;
+        for (auto& field : fields) bytes += field.length > 0 ? (size_t) field.length : 0;
+
+        std::unique_lock<std::mutex> guard(lock);
+        if (buffered.load(std::memory_order_relaxed) + pendingText.size() + bytes > settings.capacity) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        pendingRows.push_back({ entry, spec, pendingFields.size() });
+        for (auto& field : fields) {
+            pendingFields.push_back({ pendingText.size(), field.length });
+            if (field.length > 0) pendingText.append(field.value, (size_t) field.length);
+        }
+
+        if (pendingRows.size() == settings.batch) {
+            guard.unlock();
+            wakeup.notify_one();
+        }
+    }
+
+    const Settings settings;
+
+    std::atomic<uint64_t> published;        // rows written to the tickerplant
+    std::atomic<uint64_t> batches;
+    std::atomic<uint64_t> dropped;          // rows lost to a full buffer
+    std::atomic<uint64_t> buffered;         // bytes serialised but not yet written
+    std::atomic<uint64_t> connects;
+    std::atomic<bool> connected;
+
+    private:
+    struct PendingRow
+    {
+        const PublishEntry* entry;
+        const Spec* spec;
+        size_t fields;
+    };
+
+    struct PendingField
+    {
+        size_t offset;
+        int32_t length;
+    };
+
+    // the columns being filled for one entry, typed from the first row's spec
+    struct Table
+    {
+        const PublishEntry* entry;
+        const Spec* spec;               // decodes every row of the table
+        std::vector<I> types;
+        std::vector<K> columns;
+        J rows;
+    };
+
+    struct Call
+    {
+        std::string bytes;
+        J rows;
+    };
+
+    void run()
+    {
+        std::vector<PendingRow> rows;
+        std::vector<PendingField> fields;
+        std::string text;
+
+        std::unique_lock<std::mutex> guard(lock);
+        for (bool last = false; !last; ) {
+            wakeup.wait_for(guard, std::chrono::milliseconds(settings.interval), [&] {
+                return stopping || pendingRows.size() >= settings.batch;
+            });
+            last = stopping;
+
+            rows.swap(pendingRows);
+            fields.swap(pendingFields);
+            text.swap(pendingText);
+            guard.unlock();
+
+            decode(rows, fields, text);
+            rows.clear();
+            fields.clear();
+            text.clear();
+            flush();
+            send(last);
+
+            guard.lock();
+        }
+
+        m9();
+    }
+
+    Table& table(const PublishEntry* entry, const Spec* spec)
+    {
+        auto found = byEntry.find(entry);
+        if (found != byEntry.end()) return *found->second;
+
+        std::unique_ptr<Table> table(new Table);
+        table->entry = entry;
+        table->spec = spec;
+        table->rows = 0;
+        for (int tag : entry->tags) {
+            I type = ColumnType(*spec, tag);
+            table->types.push_back(type);
+            table->columns.push_back(ktn(type, 0));
+        }
+        byEntry[entry] = table.get();
+        tables.push_back(std::move(table));
+        return *tables.back();
+    }
+
+    void decode(const std::vector<PendingRow>& rows, const std::vector<PendingField>& fields, const std::string& text)
+    {
+        for (auto& row : rows) {
+            Table& t = table(row.entry, row.spec);
+            for (size_t c = 0; c < t.columns.size(); c++) {
+                const PendingField& field = fields[row.fields + c];
+                if (field.length < 0) {
+                    AppendColumnNull(&t.columns[c], t.types[c]);
+                } else {
+                    AppendColumnField(&t.columns[c], t.types[c], t.spec->types, row.entry->tags[c],
+                        text.data() + field.offset, (size_t) field.length);
+                }
+            }
+            t.rows++;
+        }
+    }
+
+    // serialises a call per table with rows, in the order tables were seen
+    void flush()
+    {
+        for (auto& t : tables) {
+            if (!t->rows) continue;
+
+            K columns = ktn(0, (J) t->columns.size());
+            for (size_t c = 0; c < t->columns.size(); c++) {
+                kK(columns)[c] = t->columns[c];
+                t->columns[c] = ktn(t->types[c], 0);
+            }
+            K call = knk(3, kp((S) settings.function.c_str()), ks((S) t->entry->table.c_str()), columns);
+            K bytes = b9(3, call);
+            r0(call);
+
+            if (!bytes || KG != bytes->t) {
+                dropped.fetch_add((uint64_t) t->rows, std::memory_order_relaxed);
+            } else {
+                queue.push_back({ std::string((const char*) kG(bytes), (size_t) bytes->n), t->rows });
+                buffered.fetch_add((uint64_t) bytes->n, std::memory_order_relaxed);
+            }
+            if (bytes) r0(bytes);
+            t->rows = 0;
+        }
+
+        // the call being written stays, the oldest after it go first
+        while (buffered.load(std::memory_order_relaxed) > settings.capacity && queue.size() > 1) {
+            auto oldest = sent ? queue.begin() + 1 : queue.begin();
+            buffered.fetch_sub(oldest->bytes.size(), std::memory_order_relaxed);
+            dropped.fetch_add((uint64_t) oldest->rows, std::memory_order_relaxed);
+            queue.erase(oldest);
+        }
+    }
+
+    void send(bool last)
+    {
+        if (-1 == fd && !reconnect(last)) return;
+
+        // the tickerplant does not reply to asynchronous calls, anything it
+        // sends is discarded and end of file is a disconnect
+        char discard[4096];
+        for (;;) {
+            ssize_t n = recv(fd, discard, sizeof discard, MSG_DONTWAIT);
+            if (0 == n || (n < 0 && EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)) {
+                disconnect();
+                return;
+            }
+            if (n < 0) break;
+        }
+
+        while (!queue.empty()) {
+            Call& call = queue.front();
+            ssize_t n = ::send(fd, call.bytes.data() + sent, call.bytes.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n > 0) {
+                sent += (size_t) n;
+                if (sent < call.bytes.size()) continue;
+
+                published.fetch_add((uint64_t) call.rows, std::memory_order_relaxed);
+                batches.fetch_add(1, std::memory_order_relaxed);
+                buffered.fetch_sub(call.bytes.size(), std::memory_order_relaxed);
+                queue.pop_front();
+                sent = 0;
+            } else if (n < 0 && EINTR == errno) {
+                continue;
+            } else if (n < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+                // a slow tickerplant holds the rest for the next wakeup
+                if (!wait(POLLOUT, settings.interval)) return;
+            } else {
+                disconnect();
+                return;
+            }
+        }
+    }
+
+    bool reconnect(bool now)
+    {
+        auto time = std::chrono::steady_clock::now();
+        if (!now && attempted.time_since_epoch().count() &&
+            time - attempted < std::chrono::milliseconds(settings.reconnect)) {
+            return false;
+        }
+        attempted = time;
+
+        fd = open();
+        if (-1 == fd) return false;
+
+        sent = 0;
+        connects.fetch_add(1, std::memory_order_relaxed);
+        connected.store(true, std::memory_order_relaxed);
+        return true;
+    }
+
+    void disconnect()
+    {
+        close(fd);
+        fd = -1;
+        sent = 0;
+        connected.store(false, std::memory_order_relaxed);
+    }
+
+    bool wait(short events, int timeout)
+    {
+        pollfd p = { fd, events, 0 };
+        return poll(&p, 1, timeout) > 0 && (p.revents & events);
+    }
+
+    // connects and logs in with capability 3, -1 on failure
+    int open()
+    {
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        if (0 != getaddrinfo(settings.host.c_str(), std::to_string(settings.port).c_str(), &hints, &addresses)) {
+            return -1;
+        }
+
+        int s = -1;
+        for (addrinfo* a = addresses; a && -1 == s; a = a->ai_next) {
+            s = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+            if (-1 == s) continue;
+            fcntl(s, F_SETFL, O_NONBLOCK);
+
+            fd = s;
+            int error = 0;
+            socklen_t size = sizeof error;
+            bool ok = 0 == connect(s, a->ai_addr, a->ai_addrlen) ||
+                (EINPROGRESS == errno && wait(POLLOUT, CONNECT_TIMEOUT) &&
+                 0 == getsockopt(s, SOL_SOCKET, SO_ERROR, &error, &size) && 0 == error);
+            if (!ok) {
+                close(s);
+                s = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+        fd = -1;
+        if (-1 == s) return -1;
+
+        int on = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+
+        std::string login = settings.user + "\3";
+        login.push_back('\0');
+        fd = s;
+        char capability = 0;
+        bool ok = (ssize_t) login.size() == ::send(s, login.data(), login.size(), MSG_NOSIGNAL) &&
+            wait(POLLIN, CONNECT_TIMEOUT) && 1 == recv(s, &capability, 1, 0);
+        fd = -1;
+        if (!ok) {
+            close(s);
+            return -1;
+        }
+        return s;
+    }
+
+    static const int CONNECT_TIMEOUT = 1000;
+
+    std::thread publisher;
+    std::mutex lock;
+    std::condition_variable wakeup;
+    bool stopping;
+
+    // filled by the session threads under lock
+    std::vector<PendingRow> pendingRows;
+    std::vector<PendingField> pendingFields;
+    std::string pendingText;
+
+    // publisher thread only
+    std::vector<std::unique_ptr<Table>> tables;
+    std::unordered_map<const PublishEntry*, Table*> byEntry;
+    std::deque<Call> queue;
+    int fd;
+    size_t sent;
+    std::chrono::steady_clock::time_point attempted;
+};
+
+#endif
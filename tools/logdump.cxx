@@ -0,0 +1,56 @@
+#include "logformat.h"
+#include "temporal.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+/* logdump:
+ *   Prints a binary session log written with LogType=async in the text
+ *   format of FileLog, one "YYYYMMDD-HH:MM:SS.sss : text" line per record.
+ *   By default the messages are printed (the .messages.current.log view);
+ *   -e prints the events instead and -a everything, with the direction.
+ *
+ *   usage: logdump [-e|-a] file
+ */
+
+int main(int argc, char* argv[])
+{
+    bool events = false, all = false;
+    int arg = 1;
+    for (; arg < argc && '-' == argv[arg][0]; arg++) {
+        if (0 == strcmp(argv[arg], "-e")) events = true;
+        else if (0 == strcmp(argv[arg], "-a")) all = true;
+        else break;
+    }
+
+    if (arg != argc - 1) {
+        fprintf(stderr, "usage: %s [-e|-a] file\n", argv[0]);
+        return 2;
+    }
+
+    LogReader reader(argv[arg]);
+    if (!reader.ok()) {
+        fprintf(stderr, "%s: not a binary session log\n", argv[arg]);
+        return 1;
+    }
+
+    uint8_t type;
+    int64_t time;
+    std::string text;
+    char stamp[32];
+
+    while (reader.next(&type, &time, text)) {
+        if (!all && events != (LOG_EVENT == type)) continue;
+
+        size_t n = formattimestamp(stamp, time - (J) KDB_EPOCH_DAYS * NANOS_PER_DAY);
+        if (all) {
+            const char* direction = LOG_INCOMING == type ? "in" : LOG_OUTGOING == type ? "out" : "event";
+            printf("%.*s : %s : %s\n", (int) n, stamp, direction, text.c_str());
+        } else {
+            printf("%.*s : %s\n", (int) n, stamp, text.c_str());
+        }
+    }
+
+    return 0;
+}